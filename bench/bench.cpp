@@ -0,0 +1,102 @@
+/*
+    Benchmark harness. Each benchmark is calibrated once to find how many
+    calls fill a sample, then every sample makes that same number of calls,
+    so samples are directly comparable and the median is stable from run to
+    run.
+*/
+
+#include <stdio.h>
+#include <stdint.h>
+#include <algorithm>
+#include <chrono>
+#include <unistd.h>
+#include "bench.hpp"
+
+static double elapsed_ns(const Benchmark &benchmark, uint64_t iterations)
+{
+    auto start = chrono::steady_clock::now();
+    for(uint64_t i = 0; i < iterations; i++)
+    {
+        benchmark.run();
+    }
+    return chrono::duration<double, nano>(chrono::steady_clock::now() - start).count();
+}
+
+BenchmarkResult run_benchmark(const Benchmark &benchmark, const bench_options &options)
+{
+    BenchmarkResult result;
+    result.name = benchmark.name;
+    result.bytes = benchmark.bytes;
+
+    if(benchmark.setup)
+    {
+        benchmark.setup();
+    }
+
+    /* Double the call count until a run is long enough, which also warms up caches */
+    double target_ns = options.sample_ms * 1e6;
+    uint64_t iterations = 1;
+    double ns = elapsed_ns(benchmark, iterations);
+    while(ns < BENCH_WARMUP_MS * 1e6 && iterations < (1ULL << 40))
+    {
+        iterations *= 2;
+        ns = elapsed_ns(benchmark, iterations);
+    }
+    iterations = max<uint64_t>(1, (uint64_t)(iterations * target_ns / max(ns, 1.0)));
+
+    vector<double> samples;
+    for(int i = 0; i < options.samples; i++)
+    {
+        samples.push_back(elapsed_ns(benchmark, iterations) / iterations);
+    }
+    sort(samples.begin(), samples.end());
+
+    if(benchmark.teardown)
+    {
+        benchmark.teardown();
+    }
+
+    result.iterations = iterations;
+    result.median_ns = samples[samples.size() / 2];
+    result.min_ns = samples.front();
+    result.max_ns = samples.back();
+    return result;
+}
+
+FILE *open_results(const string &output)
+{
+    FILE *fd = output.empty() ? fdopen(dup(fileno(stdout)), "w") : fopen(output.c_str(), "w");
+    if(!fd)
+    {
+        printf("Error: Can't open file `%s' for writing.\n", output.c_str());
+        return nullptr;
+    }
+    fflush(stdout);
+    if(!freopen("/dev/null", "w", stdout))
+    {
+        fclose(fd);
+        return nullptr;
+    }
+    return fd;
+}
+
+/* Results as JSON, one benchmark per line so runs diff cleanly */
+void write_results(FILE *fd, const vector<BenchmarkResult> &results, const bench_options &options)
+{
+    fprintf(fd, "{\n");
+    fprintf(fd, "  \"samples\": %d,\n", options.samples);
+    fprintf(fd, "  \"sample_ms\": %d,\n", options.sample_ms);
+    fprintf(fd, "  \"benchmarks\": [\n");
+    for(size_t i = 0; i < results.size(); i++)
+    {
+        const BenchmarkResult &result = results[i];
+        double mb_per_s = result.bytes ? result.bytes * 1e3 / result.median_ns : 0;
+        fprintf(fd, "    {\"name\": \"%s\", \"iterations\": %llu, \"median_ns\": %.2f, \"min_ns\": %.2f, \"max_ns\": %.2f, \"bytes\": %zu, \"mb_per_s\": %.2f}%s\n",
+            result.name.c_str(), (unsigned long long)result.iterations, result.median_ns, result.min_ns, result.max_ns,
+            result.bytes, mb_per_s, i + 1 < results.size() ? "," : "");
+    }
+    fprintf(fd, "  ]\n");
+    fprintf(fd, "}\n");
+}
+
+/* End */
@@ -0,0 +1,63 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdio.h>
+#include <functional>
+#include <string>
+#include <vector>
+using namespace std;
+
+#define BENCH_SAMPLES           9       /* Timed samples per benchmark, the median is reported */
+#define BENCH_SAMPLE_MS         20      /* Minimum length of each sample */
+#define BENCH_WARMUP_MS         10      /* Untimed run before the first sample */
+
+/* Keep the compiler from optimizing away a result or the work behind it */
+template<typename T> inline void keep(const T &value)
+{
+    asm volatile("" : : "r,m"(value) : "memory");
+}
+
+/* One benchmark. run() does the work once, bytes is how much data that is
+   (zero if throughput doesn't apply), setup() is called before timing and
+   teardown() after it. */
+class Benchmark
+{
+public:
+    string name;
+    size_t bytes = 0;
+    function<void(void)> run;
+    function<void(void)> setup;
+    function<void(void)> teardown;
+};
+
+/* Timing for one benchmark, all times in nanoseconds per run() */
+class BenchmarkResult
+{
+public:
+    string name;
+    size_t bytes = 0;
+    uint64_t iterations = 0;        /* Calls per sample */
+    double median_ns = 0;
+    double min_ns = 0;
+    double max_ns = 0;
+};
+
+/* Settings for a benchmark run */
+class bench_options
+{
+public:
+    int samples = BENCH_SAMPLES;
+    int sample_ms = BENCH_SAMPLE_MS;
+    string filter;                  /* Only run benchmarks with this in their name */
+};
+
+BenchmarkResult run_benchmark(const Benchmark &benchmark, const bench_options &options);
+void write_results(FILE *fd, const vector<BenchmarkResult> &results, const bench_options &options);
+
+/* Open the results file (stdout if empty) and send everything else printed to /dev/null */
+FILE *open_results(const string &output);
+
+/* End to end runs of the read command, see e2e.cpp */
+int run_e2e(int argc, char *argv[]);
+
+/* End */
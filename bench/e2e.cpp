@@ -0,0 +1,411 @@
+/*
+    End to end read benchmark
+
+    Runs the same steps as `hdread read` and `hdread check` against the
+    software reader: open, ready handshake, link negotiation, command and
+    parameter exchange, seeks, the 4K dump, writing the output files and
+    the ROM analysis. Every combination of link rate, transfer mode,
+    injected line error rate and host read size is run several times and
+    the median of each phase is kept. Results are compared with a baseline file, and any phase
+    that got slower or sent more data by more than the threshold fails the
+    run:
+
+      ./hdbench e2e [--repeats count] [--baseline file.json] [--threshold percent] [--output file.json]
+
+    The firmware's page size is fixed at 64 bytes and isn't varied. The
+    host read size is the most the transport hands over per read (one 64
+    byte USB packet, or 4K), not a protocol page size; it stands in for
+    the page size as the other thing that sets how data is batched.
+    The wire and clock times are what the hardware would take, from the
+    emulator's model; wall and CPU times are what the host spent.
+*/
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <algorithm>
+#include <map>
+#include <string>
+#include <vector>
+#include "bench.hpp"
+#include "emulator.hpp"
+#include "phases.hpp"
+#include "reader.hpp"
+#include "utility.hpp"
+using namespace std;
+
+#define E2E_REPEATS             5
+#define E2E_THRESHOLD           25.0    /* Percent a metric can grow before it's a regression */
+#define E2E_TIME_FLOOR_US       2000.0  /* Host time differences below this are noise */
+#define E2E_SEED                2       /* Line errors that make the framed reads resend */
+
+const int e2e_baud_rates[] = {2000000, 1000000, 500000, LINK_BASE_BAUD_RATE};
+const char *e2e_modes[] = {"raw", "compact", "framed", "snapshot"};
+const double e2e_error_rates[] = {0.0, 0.0005};
+const size_t e2e_read_sizes[] = {0x40, 0x1000};    /* Host read chunk, the firmware page is always 64 */
+
+/* A MemoryTransport that hands over at most read_size bytes per read, like a serial port would */
+class ChunkedTransport : public MemoryTransport
+{
+public:
+    ChunkedTransport(TransportPeer *peer, size_t read_size) : MemoryTransport(peer), read_size_(read_size)
+    {
+    }
+
+    size_t read_some(uint8_t *data, size_t size, int timeout_ms) override
+    {
+        return MemoryTransport::read_some(data, min(size, read_size_), timeout_ms);
+    }
+
+private:
+    size_t read_size_;
+};
+
+/* One measurement, for a phase or for the whole run ("total") */
+class e2e_record
+{
+public:
+    string config;
+    string phase;
+    bool ok = true;
+    double wall_us = 0.0;
+    double cpu_us = 0.0;
+    size_t bytes = 0;               /* Received by the host */
+    double wire_us = 0.0;           /* Total only, modeled */
+    double clock_us = 0.0;          /* Total only, modeled */
+    size_t mismatches = 0;          /* Total only, ROM bytes that differ from the image */
+};
+
+class e2e_options
+{
+public:
+    int repeats = E2E_REPEATS;
+    double threshold = E2E_THRESHOLD;
+    string baseline;
+    string output;
+    string filter;
+};
+
+/* Test image with a reset vector check_rom() accepts */
+static vector<uint8_t> e2e_rom(void)
+{
+    vector<uint8_t> rom(ROM_SIZE);
+    uint32_t state = E2E_SEED;
+    for(auto &value : rom)
+    {
+        state = state * 1103515245 + 12345;
+        value = state >> 16;
+    }
+    rom[0xFF6] = 0x0F;
+    rom[0xFF7] = 0x80;
+    return rom;
+}
+
+/* Run read, write and check once, and return the total followed by each phase */
+static vector<e2e_record> run_once(const string &config, const vector<uint8_t> &rom, int baud_rate,
+    const string &mode, double error_rate, size_t read_size, const string &filename)
+{
+    emulator_options settings;
+    settings.line_errors = error_rate;
+    settings.seed = E2E_SEED;
+
+    ReaderEmulator emulator(rom, settings);
+    Comms comms;
+    PhaseTimer timer;
+    comms.use_transport(make_unique<ChunkedTransport>(&emulator, read_size));
+    comms.phases = &timer;
+
+    read_options options;
+    options.baud_rate = baud_rate;
+    options.compact = mode == "compact";
+    options.framed = mode == "framed";
+    options.snapshot = mode == "snapshot";
+
+    read_result result;
+    bool ok = comms.connect(-1, "") && read_rom(comms, options, result);
+    if(ok)
+    {
+        comms.mark_phase("write");
+        ok = write_read_result(filename, result);
+        comms.mark_phase("check");
+        check_rom(result.rom.data());
+    }
+    timer.stop(comms.rx_bytes);
+    comms.close();
+
+    /* A read that reports success with a wrong ROM is a failure too */
+    size_t mismatches = 0;
+    for(int address = 0x80; ok && address < ROM_SIZE; address++)
+    {
+        mismatches += result.rom[address] != rom[address];
+    }
+    if(mismatches)
+    {
+        ok = false;
+    }
+
+    e2e_record total;
+    total.config = config;
+    total.phase = "total";
+    total.ok = ok;
+    total.wall_us = timer.wall_us();
+    total.cpu_us = timer.cpu_us();
+    total.bytes = comms.rx_bytes;
+    total.wire_us = emulator.line_us;
+    total.clock_us = emulator.clock_us;
+    total.mismatches = mismatches;
+
+    vector<e2e_record> records = {total};
+    for(auto &phase : timer.phases())
+    {
+        e2e_record record;
+        record.config = config;
+        record.phase = phase.name;
+        record.ok = ok;
+        record.wall_us = phase.wall_us;
+        record.cpu_us = phase.cpu_us;
+        record.bytes = phase.bytes;
+        records.push_back(record);
+    }
+    return records;
+}
+
+static double median(vector<double> values)
+{
+    sort(values.begin(), values.end());
+    return values[values.size() / 2];
+}
+
+/* Median over repeated runs, phase by phase. The byte counts and modeled
+   times are the same every run, since the faults are seeded. */
+static vector<e2e_record> combine(const vector<vector<e2e_record>> &runs)
+{
+    vector<e2e_record> records = runs[0];
+    for(auto &record : records)
+    {
+        vector<double> wall;
+        vector<double> cpu;
+        for(auto &run : runs)
+        {
+            for(auto &other : run)
+            {
+                if(other.phase == record.phase)
+                {
+                    wall.push_back(other.wall_us);
+                    cpu.push_back(other.cpu_us);
+                    record.ok = record.ok && other.ok;
+                }
+            }
+        }
+        record.wall_us = median(wall);
+        record.cpu_us = median(cpu);
+    }
+    return records;
+}
+
+/* One record per line, so read_records() can load it back without a JSON parser */
+static void write_records(FILE *fd, const vector<e2e_record> &records, const e2e_options &options)
+{
+    fprintf(fd, "{\n");
+    fprintf(fd, "  \"repeats\": %d,\n", options.repeats);
+    fprintf(fd, "  \"records\": [\n");
+    for(size_t i = 0; i < records.size(); i++)
+    {
+        const e2e_record &record = records[i];
+        fprintf(fd, "    {\"config\": \"%s\", \"phase\": \"%s\", \"ok\": %d, \"wall_us\": %.1f, \"cpu_us\": %.1f, \"bytes\": %zu, "
+            "\"wire_us\": %.1f, \"clock_us\": %.1f, \"mismatches\": %zu}%s\n",
+            record.config.c_str(), record.phase.c_str(), record.ok ? 1 : 0, record.wall_us, record.cpu_us, record.bytes,
+            record.wire_us, record.clock_us, record.mismatches, i + 1 < records.size() ? "," : "");
+    }
+    fprintf(fd, "  ]\n");
+    fprintf(fd, "}\n");
+}
+
+static bool read_records(const string &filename, map<string, e2e_record> &records)
+{
+    FILE *fd = fopen(filename.c_str(), "r");
+    if(!fd)
+    {
+        fprintf(stderr, "Error: Can't open file `%s' for reading.\n", filename.c_str());
+        return false;
+    }
+
+    char line[0x200];
+    while(fgets(line, sizeof(line), fd))
+    {
+        char config[0x40];
+        char phase[0x40];
+        int ok;
+        e2e_record record;
+        if(sscanf(line, " {\"config\": \"%63[^\"]\", \"phase\": \"%63[^\"]\", \"ok\": %d, \"wall_us\": %lf, \"cpu_us\": %lf, \"bytes\": %zu, "
+            "\"wire_us\": %lf, \"clock_us\": %lf, \"mismatches\": %zu", config, phase, &ok, &record.wall_us, &record.cpu_us,
+            &record.bytes, &record.wire_us, &record.clock_us, &record.mismatches) != 9)
+        {
+            continue;
+        }
+        record.config = config;
+        record.phase = phase;
+        record.ok = ok != 0;
+        records[record.config + " " + record.phase] = record;
+    }
+    fclose(fd);
+    return true;
+}
+
+/* Report a metric that grew past the threshold, floor is the smallest change that counts */
+static bool regressed(const e2e_record &record, const char *metric, double value, double baseline, double floor, double threshold)
+{
+    if(value <= baseline * (1.0 + threshold / 100.0) || value - baseline <= floor)
+    {
+        return false;
+    }
+    fprintf(stderr, "Error: %s %s %s regressed from %.1f to %.1f (+%.0f%%).\n", record.config.c_str(), record.phase.c_str(),
+        metric, baseline, value, baseline > 0 ? (value / baseline - 1.0) * 100.0 : 100.0);
+    return true;
+}
+
+static int compare(const vector<e2e_record> &records, const map<string, e2e_record> &baseline, double threshold)
+{
+    int regressions = 0;
+    for(auto &record : records)
+    {
+        auto entry = baseline.find(record.config + " " + record.phase);
+        if(entry == baseline.end())
+        {
+            continue;
+        }
+        const e2e_record &base = entry->second;
+
+        if(base.ok && !record.ok)
+        {
+            fprintf(stderr, "Error: %s failed, it passed in the baseline.\n", record.config.c_str());
+            ++regressions;
+            continue;
+        }
+        regressions += regressed(record, "wall_us", record.wall_us, base.wall_us, E2E_TIME_FLOOR_US, threshold);
+        regressions += regressed(record, "cpu_us", record.cpu_us, base.cpu_us, E2E_TIME_FLOOR_US, threshold);
+        regressions += regressed(record, "bytes", record.bytes, base.bytes, 0.0, threshold);
+        regressions += regressed(record, "wire_us", record.wire_us, base.wire_us, 0.0, threshold);
+        regressions += regressed(record, "clock_us", record.clock_us, base.clock_us, 0.0, threshold);
+        regressions += regressed(record, "mismatches", record.mismatches, base.mismatches, 0.0, 0.0);
+    }
+    return regressions;
+}
+
+static void usage(const char *name)
+{
+    printf("Usage: %s e2e [--repeats count] [--baseline file.json] [--threshold percent] [--filter name] [--output file.json]\n", name);
+    printf("  --repeats    Runs of each configuration, the median is kept (default %d)\n", E2E_REPEATS);
+    printf("  --baseline   Fail if a phase regressed against the results in this file\n");
+    printf("  --threshold  Percentage a phase can grow before it counts (default %.0f)\n", E2E_THRESHOLD);
+    printf("  --filter     Only run configurations with this in their name, e.g. 2000000/framed\n");
+    printf("  --output     Write JSON results to a file instead of stdout, to use as a baseline\n");
+}
+
+int run_e2e(int argc, char *argv[])
+{
+    e2e_options options;
+
+    for(int i = 1; i < argc; i++)
+    {
+        if(!strcmp(argv[i], "--repeats") && i + 1 < argc)
+        {
+            options.repeats = max(1, atoi(argv[++i]));
+        }
+        else if(!strcmp(argv[i], "--baseline") && i + 1 < argc)
+        {
+            options.baseline = argv[++i];
+        }
+        else if(!strcmp(argv[i], "--threshold") && i + 1 < argc)
+        {
+            options.threshold = atof(argv[++i]);
+        }
+        else if(!strcmp(argv[i], "--filter") && i + 1 < argc)
+        {
+            options.filter = argv[++i];
+        }
+        else if(!strcmp(argv[i], "--output") && i + 1 < argc)
+        {
+            options.output = argv[++i];
+        }
+        else
+        {
+            usage(argv[0]);
+            return 1;
+        }
+    }
+
+    map<string, e2e_record> baseline;
+    if(!options.baseline.empty() && !read_records(options.baseline, baseline))
+    {
+        return 1;
+    }
+
+    char directory[] = "/tmp/hdbench.XXXXXX";
+    if(!mkdtemp(directory))
+    {
+        fprintf(stderr, "Error: Can't create a temporary directory.\n");
+        return 1;
+    }
+    string filename = string(directory) + "/dump.bin";
+
+    FILE *fd = open_results(options.output);
+    if(!fd)
+    {
+        return 1;
+    }
+
+    vector<uint8_t> rom = e2e_rom();
+    vector<e2e_record> records;
+    for(int baud_rate : e2e_baud_rates)
+    {
+        for(const char *mode : e2e_modes)
+        {
+            for(double error_rate : e2e_error_rates)
+            {
+                for(size_t read_size : e2e_read_sizes)
+                {
+                    string config = format("%d/%s/%g/%zu", baud_rate, mode, error_rate, read_size);
+                    if(config.find(options.filter) == string::npos)
+                    {
+                        continue;
+                    }
+                    fprintf(stderr, "Status: Running %s.\n", config.c_str());
+
+                    vector<vector<e2e_record>> runs;
+                    for(int repeat = 0; repeat < options.repeats; repeat++)
+                    {
+                        runs.push_back(run_once(config, rom, baud_rate, mode, error_rate, read_size, filename));
+                    }
+                    vector<e2e_record> result = combine(runs);
+                    records.insert(records.end(), result.begin(), result.end());
+                }
+            }
+        }
+    }
+
+    for(const char *suffix : {"", ".log", ".conf"})
+    {
+        unlink((filename + suffix).c_str());
+    }
+    rmdir(directory);
+
+    write_records(fd, records, options);
+    fclose(fd);
+
+    int regressions = compare(records, baseline, options.threshold);
+    if(regressions)
+    {
+        fprintf(stderr, "Error: %d regressions against `%s'.\n", regressions, options.baseline.c_str());
+        return 1;
+    }
+    if(!options.baseline.empty())
+    {
+        fprintf(stderr, "Status: No regressions against `%s'.\n", options.baseline.c_str());
+    }
+    return 0;
+}
+
+/* End */
@@ -0,0 +1,382 @@
+/*
+    Microbenchmarks for the utility and firmware hot paths
+
+    Runs without a reader: the target end of the protocol is a canned byte
+    stream, and the firmware functions are built against the host shim in
+    firmware/host. Results are written as JSON:
+
+      ./hdbench [--filter name] [--samples count] [--sample-ms ms] [--output file.json]
+
+    hdbench e2e runs the whole read command against an emulated reader
+    instead, see e2e.cpp.
+*/
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <string>
+#include <vector>
+#include "bench.hpp"
+#include "reader.hpp"
+#include "utility.hpp"
+#include "third_party/sha256.h"
+#include "../firmware/hdread/target.hpp"
+using namespace std;
+
+/* From the firmware, see firmware/hdread/cmds.hpp */
+uint8_t shuffle(uint8_t in);
+uint8_t nbit(uint8_t value);
+uint16_t decode_address(target_state_t *state);
+
+#define BENCH_READ_CHUNK        0x1000  /* Most the canned target hands over per read */
+#define BENCH_SEED              0x6805
+
+/* The target end of a MemoryTransport that replays a recorded stream */
+class ReplayPeer : public TransportPeer
+{
+public:
+    void receive(const uint8_t *data, size_t size) override
+    {
+    }
+
+    size_t transmit(uint8_t *data, size_t size) override
+    {
+        size = min(size, min<size_t>(BENCH_READ_CHUNK, stream.size() - position_));
+        memcpy(data, &stream[position_], size);
+        position_ += size;
+        return size;
+    }
+
+    void reset(void) override
+    {
+        position_ = 0;
+    }
+
+    vector<uint8_t> stream;
+
+private:
+    size_t position_ = 0;
+};
+
+/* Repeatable test data */
+static vector<uint8_t> random_data(size_t size)
+{
+    vector<uint8_t> data(size);
+    uint32_t state = BENCH_SEED;
+    for(auto &value : data)
+    {
+        state = state * 1103515245 + 12345;
+        value = state >> 16;
+    }
+    return data;
+}
+
+/* A ROM image check_rom() accepts, so it goes on to the checksum and SHA-256 */
+static vector<uint8_t> test_rom(void)
+{
+    vector<uint8_t> rom = random_data(ROM_SIZE);
+    rom[0xFF6] = 0x0F;
+    rom[0xFF7] = 0x80;
+    return rom;
+}
+
+/* What the firmware sends for a 4K read in each transfer mode */
+static vector<uint8_t> page_stream(const vector<uint8_t> &data, size_t page_size)
+{
+    vector<uint8_t> stream;
+    for(size_t offset = 0; offset < data.size(); offset += page_size)
+    {
+        stream.push_back(SUB_CMD_SEND_PAGE);
+        stream.insert(stream.end(), &data[offset], &data[offset] + page_size);
+    }
+    stream.push_back(SUB_CMD_EXIT);
+    return stream;
+}
+
+static vector<uint8_t> data_stream(const vector<uint8_t> &data, size_t block_size)
+{
+    vector<uint8_t> stream;
+    for(size_t offset = 0; offset < data.size(); offset += block_size)
+    {
+        stream.push_back(SUB_CMD_SEND_DATA);
+        stream.push_back(block_size);
+        stream.insert(stream.end(), &data[offset], &data[offset] + block_size);
+    }
+    stream.push_back(SUB_CMD_EXIT);
+    return stream;
+}
+
+static vector<uint8_t> frame_stream(const vector<uint8_t> &data, size_t frame_size)
+{
+    vector<uint8_t> stream;
+    uint16_t seq = 0;
+    for(size_t offset = 0; offset < data.size(); offset += frame_size, seq++)
+    {
+        size_t start = stream.size() + 1;
+        stream.push_back(SUB_CMD_FRAME);
+        stream.push_back(FRAME_DATA);
+        stream.push_back(seq & 0xFF);
+        stream.push_back(seq >> 8);
+        stream.push_back(frame_size);
+        stream.insert(stream.end(), &data[offset], &data[offset] + frame_size);
+
+        uint16_t crc = FRAME_CRC_INIT;
+        for(size_t i = start; i < stream.size(); i++)
+        {
+            crc = crc16_update(crc, stream[i]);
+        }
+        stream.push_back(crc & 0xFF);
+        stream.push_back(crc >> 8);
+    }
+    stream.push_back(SUB_CMD_EXIT);
+    return stream;
+}
+
+/* Receive a canned stream with Comms::dispatch_target() */
+static Benchmark dispatch_benchmark(const string &name, vector<uint8_t> stream, size_t rx_size)
+{
+    auto peer = make_shared<ReplayPeer>();
+    auto comms = make_shared<Comms>();
+    auto buffer = make_shared<vector<uint8_t>>(rx_size);
+
+    peer->stream = move(stream);
+    comms->use_transport(make_unique<MemoryTransport>(peer.get()));
+
+    Benchmark benchmark;
+    benchmark.name = name;
+    benchmark.bytes = peer->stream.size();
+    benchmark.run = [peer, comms, buffer]() {
+        command_context p;
+        p.rx_buffer = buffer->data();
+        p.rx_size = buffer->size();
+        peer->reset();
+        if(!comms->dispatch_target(&p))
+        {
+            fprintf(stderr, "Error: Replayed stream was rejected.\n");
+            exit(1);
+        }
+        keep(buffer->data()[0]);
+    };
+    return benchmark;
+}
+
+static vector<Benchmark> benchmarks(void)
+{
+    vector<Benchmark> list;
+    auto rom = make_shared<vector<uint8_t>>(test_rom());
+    auto blank = make_shared<vector<uint8_t>>(ROM_SIZE, 0xFF);
+    auto raw = make_shared<vector<uint8_t>>(random_data(ROM_SIZE * 4));
+    auto snapshots = make_shared<vector<uint8_t>>(random_data(ROM_SIZE * SNAPSHOT_SIZE));
+
+    /* Firmware address decoding, over every port value */
+    list.push_back({"firmware/shuffle", 0x100, []() {
+        uint8_t sum = 0;
+        for(int value = 0; value < 0x100; value++)
+        {
+            uint8_t in = value;
+            keep(in);
+            sum += shuffle(in);
+        }
+        keep(sum);
+    }});
+
+    list.push_back({"firmware/nbit", 0x100, []() {
+        uint8_t sum = 0;
+        for(int value = 0; value < 0x100; value++)
+        {
+            uint8_t in = value;
+            keep(in);
+            sum += nbit(in);
+        }
+        keep(sum);
+    }});
+
+    list.push_back({"firmware/decode_address", 0x100, [raw]() {
+        target_state_t *states = (target_state_t *)raw->data();
+        uint16_t sum = 0;
+        for(int index = 0; index < 0x100; index++)
+        {
+            sum += decode_address(&states[index]);
+        }
+        keep(sum);
+    }});
+
+    /* Receive path, 4K of data in each transfer mode */
+    list.push_back(dispatch_benchmark("comms/dispatch_target/send_page", page_stream(*raw, 0x40), raw->size()));
+    list.push_back(dispatch_benchmark("comms/dispatch_target/send_data", data_stream(*rom, 0x40), rom->size()));
+    list.push_back(dispatch_benchmark("comms/dispatch_target/frame", frame_stream(*rom, FRAME_MAX_SIZE), rom->size()));
+
+    list.push_back({"utility/print_hexdump/unique", ROM_SIZE, [rom]() {
+        print_hexdump(rom->data(), rom->size());
+    }});
+
+    list.push_back({"utility/print_hexdump/blank", ROM_SIZE, [blank]() {
+        print_hexdump(blank->data(), blank->size());
+    }});
+
+    /* Building the ROM image from raw test data, as read does */
+    list.push_back({"reader/checksum_pass", ROM_SIZE * 4, [raw]() {
+        uint8_t image[ROM_SIZE];
+        keep(checksum_pass(raw->data(), 0, ROM_SIZE, image));
+        keep(image[0x80]);
+    }});
+
+    /* Decoding port snapshots from read mode 0x09 */
+    list.push_back({"reader/unscramble_snapshots", ROM_SIZE * SNAPSHOT_SIZE, [snapshots]() {
+        uint8_t entries[ROM_SIZE * 4];
+        unscramble_snapshots(snapshots->data(), ROM_SIZE, entries);
+        keep(entries[0x80]);
+    }});
+
+    /* Analysis, as check does */
+    list.push_back({"reader/check_rom", ROM_SIZE, [rom]() {
+        string report = check_rom(rom->data());
+        keep(report.size());
+    }});
+
+    list.push_back({"reader/sha256/self_check", 0x78, [rom]() {
+        uint8_t digest[SHA256_DIGEST_LENGTH];
+        sha256(rom->data(), 0x78, digest);
+        keep(digest[0]);
+    }});
+
+    list.push_back({"reader/sha256/rom", ROM_SIZE, [rom]() {
+        uint8_t digest[SHA256_DIGEST_LENGTH];
+        sha256(rom->data(), rom->size(), digest);
+        keep(digest[0]);
+    }});
+
+    /* Writing the ROM image and raw test data, as read does after decoding */
+    Benchmark write_result;
+    auto result = make_shared<read_result>();
+    auto directory = make_shared<string>();
+    result->rom = *rom;
+    result->log = *raw;
+    write_result.name = "reader/write_read_result";
+    write_result.bytes = result->rom.size() + result->log.size();
+    write_result.setup = [directory]() {
+        char path[] = "/tmp/hdbench.XXXXXX";
+        if(!mkdtemp(path))
+        {
+            fprintf(stderr, "Error: Can't create a temporary directory.\n");
+            exit(1);
+        }
+        *directory = path;
+    };
+    write_result.run = [result, directory]() {
+        if(!write_read_result(*directory + "/dump.bin", *result))
+        {
+            fprintf(stderr, "Error: Can't write the read result.\n");
+            exit(1);
+        }
+    };
+    write_result.teardown = [directory]() {
+        for(const char *suffix : {"", ".log"})
+        {
+            unlink((*directory + "/dump.bin" + suffix).c_str());
+        }
+        rmdir(directory->c_str());
+    };
+    list.push_back(write_result);
+
+    list.push_back({"reader/bememory_readw", ROM_SIZE * 2, [rom]() {
+        static BeMemory<ROM_SIZE> memory;
+        memcpy(memory.data, rom->data(), ROM_SIZE);
+        uint16_t sum = 0;
+        for(int address = 0; address < ROM_SIZE; address++)
+        {
+            sum += memory.readw(address);
+        }
+        keep(sum);
+    }});
+
+    return list;
+}
+
+static void usage(const char *name)
+{
+    printf("Usage: %s [--filter name] [--samples count] [--sample-ms ms] [--output file.json] [--list]\n", name);
+    printf("       %s e2e --help\n", name);
+    printf("  --filter     Only run benchmarks with this in their name\n");
+    printf("  --samples    Timed samples per benchmark (default %d)\n", BENCH_SAMPLES);
+    printf("  --sample-ms  Minimum length of each sample (default %d)\n", BENCH_SAMPLE_MS);
+    printf("  --output     Write JSON results to a file instead of stdout\n");
+    printf("  --list       List the benchmarks and exit\n");
+}
+
+int main(int argc, char *argv[])
+{
+    if(argc > 1 && !strcmp(argv[1], "e2e"))
+    {
+        return run_e2e(argc - 1, argv + 1);
+    }
+
+    bench_options options;
+    string output;
+    bool list_only = false;
+
+    for(int i = 1; i < argc; i++)
+    {
+        if(!strcmp(argv[i], "--filter") && i + 1 < argc)
+        {
+            options.filter = argv[++i];
+        }
+        else if(!strcmp(argv[i], "--samples") && i + 1 < argc)
+        {
+            options.samples = max(1, atoi(argv[++i]));
+        }
+        else if(!strcmp(argv[i], "--sample-ms") && i + 1 < argc)
+        {
+            options.sample_ms = max(1, atoi(argv[++i]));
+        }
+        else if(!strcmp(argv[i], "--output") && i + 1 < argc)
+        {
+            output = argv[++i];
+        }
+        else if(!strcmp(argv[i], "--list"))
+        {
+            list_only = true;
+        }
+        else
+        {
+            usage(argv[0]);
+            return 1;
+        }
+    }
+
+    vector<Benchmark> list = benchmarks();
+    if(list_only)
+    {
+        for(auto &benchmark : list)
+        {
+            printf("%s\n", benchmark.name.c_str());
+        }
+        return 0;
+    }
+
+    /* The code under test prints, keep that out of the results */
+    FILE *fd = open_results(output);
+    if(!fd)
+    {
+        return 1;
+    }
+
+    vector<BenchmarkResult> results;
+    for(auto &benchmark : list)
+    {
+        if(benchmark.name.find(options.filter) == string::npos)
+        {
+            continue;
+        }
+        fprintf(stderr, "Status: Running %s.\n", benchmark.name.c_str());
+        results.push_back(run_benchmark(benchmark, options));
+    }
+
+    write_results(fd, results, options);
+    fclose(fd);
+    return 0;
+}
+
+/* End */
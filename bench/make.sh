@@ -0,0 +1,17 @@
+#!/bin/sh
+# Microbenchmarks, see main.cpp. The firmware is built against the host
+# shim in firmware/host the same way hdsim is, then linked with the utility.
+# -fpermissive is what the Arduino toolchain builds sketches with.
+FIRMWARE=../firmware/hdread
+HOST=../firmware/host
+UTILITY=../utility
+OPT=${OPT:--O2}
+mkdir -p obj || exit 1
+for source in board cmds comms frame target uart; do
+    g++ -c $FIRMWARE/$source.cpp -o obj/firmware_$source.o -I$HOST -std=gnu++17 -fpermissive $OPT || exit 1
+done
+g++ -c -x c++ $FIRMWARE/hdread.ino -o obj/firmware_hdread.o -I$HOST -std=gnu++17 -fpermissive $OPT || exit 1
+g++ -c $HOST/sim.cpp -o obj/sim.o -I$HOST -I$UTILITY -std=gnu++17 $OPT || exit 1
+g++ main.cpp bench.cpp e2e.cpp $UTILITY/comms.cpp $UTILITY/consensus.cpp $UTILITY/utility.cpp $UTILITY/reader.cpp $UTILITY/emulator.cpp \
+    $UTILITY/hd6805.cpp $UTILITY/phases.cpp \
+    $UTILITY/posixserial.cpp $UTILITY/third_party/sha256.c obj/*.o -I. -I$UTILITY -I$UTILITY/third_party -o hdbench -std=c++17 -pthread $OPT
@@ -1,17 +1,17 @@
 
 #include <Arduino.h>
 #include "board.hpp"
+#include "uart.hpp"
 
 #if DEBUG_ENABLED
 
-#define DebugSerial Serial
-
+/* Debug output shares the host UART */
 constexpr size_t kDebugMsgBufferSize = 0x100;
 uint8_t debug_msg_buffer[kDebugMsgBufferSize];
 
 void debug_init(uint32_t baud_rate)
 {
-  DebugSerial.begin(baud_rate);
+  uart_init(baud_rate);
   debug_printf(F("*** DEBUG TERMINAL ***\n"));
 }
 
@@ -27,8 +27,8 @@ void debug_printf(const char *fmt, ...)
   va_end(ap);
 
   /* Send buffer */
-  DebugSerial.write(debug_msg_buffer, strlen(debug_msg_buffer));
-  DebugSerial.flush();
+  uart_write(debug_msg_buffer, strlen(debug_msg_buffer));
+  uart_flush();
 }
 
 #endif /* DEBUG_ENABLED */
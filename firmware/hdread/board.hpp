@@ -12,7 +12,7 @@ constexpr int pin_b5        = 5;
 constexpr int pin_b6        = 6;
 constexpr int pin_b7        = 7;
 constexpr int pin_res_n     = 8;
-constexpr int pin_extal     = 9;
+constexpr int pin_extal     = 9;  // PB1, see clock_address_unrolled()
 constexpr int pin_tps_en_n  = 10;
 constexpr int pin_b0        = 11;
 constexpr int pin_b1        = 12;
@@ -33,3 +33,9 @@ void debug_printf(const char *fmt, ...);
 #endif
 
 constexpr uint32_t kHostBaudRate = 115200;
+
+/* Rates the host can switch to with CMD_LINK. These are exact with U2X at
+   16 MHz, 230400 and other standard rates are off by more than 3%. */
+constexpr uint32_t kLinkBaudRates[] = {2000000, 1000000, 500000, 250000};
+constexpr uint16_t kLinkTestSize    = 0x100;  /* Test pattern bytes echoed at the new rate */
+constexpr uint16_t kLinkTimeoutMs   = 250;    /* Revert to kHostBaudRate if the host goes quiet */
@@ -5,6 +5,10 @@
 #include "comms.hpp"
 #include "target.hpp"
 #include "board.hpp"
+#include "uart.hpp"
+#include "frame.hpp"
+#include "stats.hpp"
+#include <EEPROM.h>
 
 constexpr size_t kMaxStates = 4;
 target_state_t state[kMaxStates];
@@ -39,6 +43,17 @@ uint8_t nbit(uint8_t value)
   return count;
 }
 
+/* Convert the multiplexed address on ports B/C to a logical address.
+   Port B carries A7-A0 in the order undone by shuffle(), and port C has
+   A8 and A9 swapped. Reset enters the output sequence at 0xD9E, which is
+   sampled as AH:ADL = 0E:EA, and from there it takes 4880 clocks (610 bus
+   cycles) to wrap to 0x000. */
+uint16_t decode_address(target_state_t *state)
+{
+  uint8_t adh = (state->ah & 0x0C) | ((state->ah >> 1) & 0x01) | ((state->ah << 1) & 0x02);
+  return adh << 8 | shuffle(state->adl);
+}
+
 
 /*-----------------------------------------------------------*/
 /*-----------------------------------------------------------*/
@@ -67,6 +82,84 @@ void cmd_nop(void)
 }
 
 
+/* Rate set by the last CMD_LINK, only kept for the command that follows it */
+uint32_t link_baud_rate = kHostBaudRate;
+
+/* Switch to a faster baud rate. The host sends the rate as four bytes and
+   we reply with COMMS_ACK if it is supported, then switch. At the new rate
+   we echo a test pattern from the host, and wait for the host to confirm
+   it came back intact. If anything times out or the host doesn't confirm,
+   go back to kHostBaudRate. */
+void cmd_link(void)
+{
+  comms_acknowledge_command(CMD_LINK);
+
+  uint8_t rate[4];
+  comms_get(rate, sizeof(rate));
+  uint32_t baud_rate = (uint32_t)rate[3] << 24 | (uint32_t)rate[2] << 16 | (uint32_t)rate[1] << 8 | rate[0];
+
+  bool supported = false;
+  for(uint8_t i = 0; i < sizeof(kLinkBaudRates) / sizeof(kLinkBaudRates[0]); i++)
+  {
+    if(kLinkBaudRates[i] == baud_rate)
+    {
+      supported = true;
+    }
+  }
+
+  if(!supported)
+  {
+    comms_sendb(COMMS_NACK);
+    return;
+  }
+
+  comms_sendb(COMMS_ACK);
+  uart_flush();
+  uart_init(baud_rate);
+
+  bool passed = true;
+  for(uint16_t i = 0; i < kLinkTestSize; i++)
+  {
+    uint8_t value;
+    if(!comms_getb_timeout(&value, kLinkTimeoutMs))
+    {
+      passed = false;
+      break;
+    }
+    comms_sendb(value);
+  }
+
+  uint8_t confirm = 0;
+  if(passed && comms_getb_timeout(&confirm, kLinkTimeoutMs) && confirm == COMMS_ACK)
+  {
+    comms_sendb(COMMS_ACK);
+    link_baud_rate = baud_rate;
+    return;
+  }
+
+  uart_flush();
+  uart_init(kHostBaudRate);
+}
+
+// Go back to the base rate so the PC can talk to us again without a reset
+void link_reset(void)
+{
+  if(link_baud_rate != kHostBaudRate)
+  {
+    uart_flush();
+    uart_init(kHostBaudRate);
+    link_baud_rate = kHostBaudRate;
+  }
+}
+
+// Answer the PC's probe to see if we're already running
+void cmd_sync(void)
+{
+  comms_acknowledge_command(CMD_SYNC);
+  comms_send_ready();
+}
+
+
 /*-----------------------------------------------------------*/
 /*-----------------------------------------------------------*/
 
@@ -376,7 +469,18 @@ void validate_adl_1bit(void)
 }
 
 
-uint32_t seek_bus_cycle(uint16_t address, bool debug)
+// Count a seek and the clocks it took
+static void count_seek(uint32_t clocks)
+{
+  ++read_stats.seeks;
+  read_stats.seek_clocks += clocks;
+  if(clocks > read_stats.seek_max)
+  {
+    read_stats.seek_max = clocks;
+  }
+}
+
+uint32_t seek_bus_cycle(uint16_t address, bool debug, uint32_t limit)
 {
   uint32_t cycles_elapsed = 0;
   bool seeking = true;
@@ -392,13 +496,19 @@ uint32_t seek_bus_cycle(uint16_t address, bool debug)
     }
     if(debug)
     {
-      comms_printf("AH=%02X ADL=%02X NUM=%d TEST=%d\n", 
+      comms_event(EVENT_SEEK_STATE,
         state[0].ah, state[0].adl, state[0].num, state[0].strobe);
     }
+    if(limit && cycles_elapsed >= limit)
+    {
+      count_seek(cycles_elapsed);
+      return kSeekTimeout;
+    }
     clock_target(1);
     ++cycles_elapsed;
   }
 
+  count_seek(cycles_elapsed);
   return cycles_elapsed;
 }
 
@@ -406,31 +516,31 @@ uint32_t seek_bus_cycle(uint16_t address, bool debug)
 void test_address_wrapping(void)
 {
   uint32_t cycles; 
-  comms_printf("Status: Test address wrapping.\n");
+  comms_event(EVENT_TEST_WRAPPING);
   reset_target();
 
   // Find first bus cycle of reset vector fetch (reading vector LSB at 0x0FFE)
-  comms_printf("Status: Seek first bus cycle.\n");
+  comms_event(EVENT_SEEK_FIRST);
   cycles = seek_bus_cycle(0x0FFE, false);  
-  comms_printf("Result: Found first bus cycle in %d clocks.\n", cycles);
+  comms_event(EVENT_FOUND_FIRST, cycles);
 
   // Seek past startup sequence to beginning of output sequence
-  comms_printf("Status: Seek first bus cycle.\n");
+  comms_event(EVENT_SEEK_FIRST);
   cycles = seek_bus_cycle(0x0EEA, false);  
-  comms_printf("Result: Found output sequence in %d clocks.\n", cycles);
+  comms_event(EVENT_FOUND_OUTPUT, cycles);
 
   // In output sequence, find when address counter resets
-  comms_printf("Status: Seek zero bus cycle.\n");
+  comms_event(EVENT_SEEK_ZERO);
   cycles = seek_bus_cycle(0x0000, false);  
-  comms_printf("Result: Found address wrap in %d clocks.\n", cycles);
+  comms_event(EVENT_FOUND_WRAP, cycles);
   
   // In output sequence, find when address counter resets again
-  comms_printf("Status: Seek zero bus cycle.\n");
+  comms_event(EVENT_SEEK_ZERO);
   cycles = seek_bus_cycle(0x0FFF, false);  
-  comms_printf("Result: Found address wrap-1 in %d clocks.\n", cycles);
+  comms_event(EVENT_FOUND_WRAP_LAST, cycles);
 
   // So it takes 32768 clocks to wrap, which is 32K/8 = 4096 NUM cycles
-  comms_printf("Status: Finished.\n");
+  comms_event(EVENT_FINISHED);
 }
 
 /*-----------------------------------------------------------*/
@@ -442,23 +552,23 @@ void test_address_wrapping(void)
 void test_address_output(bool dump)
 {
   uint32_t cycles; 
-  comms_printf("Status: Test address wrapping.\n");
+  comms_event(EVENT_TEST_WRAPPING);
   reset_target();
 
   // Find first bus cycle of reset vector fetch (reading vector LSB at 0x0FFE)
-  comms_printf("Status: Seek first bus cycle.\n");
+  comms_event(EVENT_SEEK_FIRST);
   cycles = seek_bus_cycle(0x0FFE, false);  
-  comms_printf("Result: Found first bus cycle in %d clocks.\n", cycles);
+  comms_event(EVENT_FOUND_FIRST, cycles);
 
   // Seek past startup sequence to beginning of output sequence
-  comms_printf("Status: Seek first bus cycle.\n");
+  comms_event(EVENT_SEEK_FIRST);
   cycles = seek_bus_cycle(0x0EEA, false);
-  comms_printf("Result: Found output sequence in %d clocks.\n", cycles);
+  comms_event(EVENT_FOUND_OUTPUT, cycles);
 
   // In output sequence, find when address counter resets
-  comms_printf("Status: Seek zero bus cycle.\n");
+  comms_event(EVENT_SEEK_ZERO);
   cycles = seek_bus_cycle(0x0000, false);  
-  comms_printf("Result: Found address wrap in %d clocks.\n", cycles);
+  comms_event(EVENT_FOUND_WRAP, cycles);
 
   int write_count = 0;
   uint32_t cycles_elapsed = 0;
@@ -473,23 +583,22 @@ void test_address_output(bool dump)
     {
       if(dump)
       {
-        comms_printf("%04X,", state[0].ah << 8 | state[0].adl);
+        comms_event(EVENT_ADDRESS, state[0].ah << 8 | state[0].adl);
       }
       else
       {
         if((write_count & 0x0F) == 0x00)
         {
-          comms_printf("%04X: ", cycles_elapsed);
-          comms_printf("%02X: ", state[0].ah);
+          comms_event(EVENT_ROW_START, cycles_elapsed, state[0].ah);
           latched_ah = state[0].ah;
         }
     
-        comms_printf("%02X%c", state[0].adl, 
+        comms_event(EVENT_ROW_DATA, state[0].adl, 
           (latched_ah != state[0].ah) ? '*' : ' ');
    
         if((write_count & 0x0F) == 0x0F)
         {
-          comms_printf("\n");
+          comms_event(EVENT_NEWLINE);
         }
       
         ++write_count;
@@ -505,16 +614,16 @@ void test_address_output(bool dump)
     clock_target(8);
     ++cycles_elapsed;
   }
-  comms_printf("\n");
+  comms_event(EVENT_NEWLINE);
   
   // In output sequence, find when address counter resets again
   
-  comms_printf("Status: Seek zero bus cycle.\n");
+  comms_event(EVENT_SEEK_ZERO);
   cycles = seek_bus_cycle(0x0FFF, false);  
-  comms_printf("Result: Found address wrap-1 in %d clocks.\n", cycles);
+  comms_event(EVENT_FOUND_WRAP_LAST, cycles);
 
   // So it takes 32768 clocks to wrap, which is 32K/8 = 4096 NUM cycles
-  comms_printf("Status: Finished.\n");
+  comms_event(EVENT_FINISHED);
 }
 
 
@@ -524,23 +633,23 @@ void test_address_output(bool dump)
 void test_dump(bool dump)
 {
   uint32_t cycles; 
-  comms_printf("Status: Test address wrapping.\n");
+  comms_event(EVENT_TEST_WRAPPING);
   reset_target();
 
   // Find first bus cycle of reset vector fetch (reading vector LSB at 0x0FFE)
-  comms_printf("Status: Seek first bus cycle.\n");
+  comms_event(EVENT_SEEK_FIRST);
   cycles = seek_bus_cycle(0x0FFE, false);  
-  comms_printf("Result: Found first bus cycle in %d clocks.\n", cycles);
+  comms_event(EVENT_FOUND_FIRST, cycles);
 
   // Seek past startup sequence to beginning of output sequence
-  comms_printf("Status: Seek first bus cycle.\n");
+  comms_event(EVENT_SEEK_FIRST);
   cycles = seek_bus_cycle(0x0EEA, false);  
-  comms_printf("Result: Found output sequence in %d clocks.\n", cycles);
+  comms_event(EVENT_FOUND_OUTPUT, cycles);
 
   // In output sequence, find when address counter resets
-  comms_printf("Status: Seek zero bus cycle.\n");
+  comms_event(EVENT_SEEK_ZERO);
   cycles = seek_bus_cycle(0x0000, false);  
-  comms_printf("Result: Found address wrap in %d clocks.\n", cycles);
+  comms_event(EVENT_FOUND_WRAP, cycles);
 
   // Dump address data
 
@@ -562,22 +671,19 @@ void test_dump(bool dump)
     get_target_state(&state[3]);
     clock_target(2);
 
-    comms_printf("%02X", state[0].ah);
-    comms_printf("%02X", state[0].adl);
-    comms_printf("%02X", state[1].adl);
-    comms_printf("%02X,", state[3].adl);
+    comms_event(EVENT_DUMP_ENTRY, state[0].ah, state[0].adl, state[1].adl, state[3].adl);
 
 }
-  comms_printf("\n");
+  comms_event(EVENT_NEWLINE);
   
   
   // In output sequence, find when address counter resets again
-  comms_printf("Status: Seek zero bus cycle1.\n");
+  comms_event(EVENT_SEEK_ZERO);
   cycles = seek_bus_cycle(0x0FFF, false);  
-  comms_printf("Result: Found address wrap-1 in %d clocks.\n", cycles);
+  comms_event(EVENT_FOUND_WRAP_LAST, cycles);
 
   // So it takes 32768 clocks to wrap, which is 32K/8 = 4096 NUM cycles
-  comms_printf("Status: Finished.\n");
+  comms_event(EVENT_FINISHED);
 }
 
 /*-----------------------------------------------------------*/
@@ -599,26 +705,168 @@ void free_run(void)
 /*-----------------------------------------------------------*/
 /*-----------------------------------------------------------*/
 
-void binary_dump(bool dump)
+/*-----------------------------------------------------------*/
+/* Seek calibration */
+/*-----------------------------------------------------------*/
+
+/* Number of clocks from the reset vector fetch at 0xFFE to the address the
+   output sequence starts from. That address depends on the opcode set by
+   the port A jumpers (0xD9E for NOP), so it is used as the calibration key. */
+constexpr uint8_t kEntryClocks = 16;
+
+/* Clocks from reset to 0xFFE found by the last seek_entry(), saved with
+   the calibration for the entry address it found */
+static uint16_t reset_clocks = 0;
+
+// Find the calibration slot for an entry address, or -1 if there isn't one
+int find_calibration(uint16_t entry, seek_calibration_t *calibration)
+{
+  for(uint8_t slot = 0; slot < kCalibrationSlots; slot++)
+  {
+    EEPROM.get(kCalibrationBase + slot * sizeof(seek_calibration_t), *calibration);
+    if(calibration->magic == kCalibrationMagic && calibration->entry == entry)
+    {
+      return slot;
+    }
+  }
+  return -1;
+}
+
+// Find the reset distance saved in any slot, or 0 if there isn't one. It
+// doesn't depend on the entry address, which isn't known until after it.
+uint16_t find_reset_clocks(void)
+{
+  seek_calibration_t calibration;
+  for(uint8_t slot = 0; slot < kCalibrationSlots; slot++)
+  {
+    EEPROM.get(kCalibrationBase + slot * sizeof(seek_calibration_t), calibration);
+    if(calibration.magic == kCalibrationMagic && calibration.reset_clocks > kSeekMargin)
+    {
+      return calibration.reset_clocks;
+    }
+  }
+  return 0;
+}
+
+// Save calibration, replacing the slot for this entry address or an empty one
+void save_calibration(uint16_t entry, uint16_t wrap_clocks)
+{
+  seek_calibration_t calibration;
+  int slot = find_calibration(entry, &calibration);
+
+  for(uint8_t index = 0; slot < 0 && index < kCalibrationSlots; index++)
+  {
+    EEPROM.get(kCalibrationBase + index * sizeof(seek_calibration_t), calibration);
+    if(calibration.magic != kCalibrationMagic)
+    {
+      slot = index;
+    }
+  }
+
+  /* All slots used, evict one based on the entry address */
+  if(slot < 0)
+  {
+    slot = entry % kCalibrationSlots;
+  }
+
+  calibration.magic = kCalibrationMagic;
+  calibration.entry = entry;
+  calibration.wrap_clocks = wrap_clocks;
+  calibration.reset_clocks = reset_clocks;
+  EEPROM.put(kCalibrationBase + slot * sizeof(seek_calibration_t), calibration);
+  comms_event(EVENT_CALIBRATION_SAVED, entry, wrap_clocks);
+}
+
+// Reset target and step to the entry address of the output sequence. Like
+// seek_address_wrap(), a calibrated reset distance is burst most of the way.
+uint16_t seek_entry(void)
 {
   constexpr uint16_t startAddress1 = 0xFFE;
-  constexpr uint16_t startAddress2 = 0xEEA;
-  
+
   uint32_t cycles; 
-  comms_printf("Status: Test address wrapping.\n");
+  uint16_t calibrated = find_reset_clocks();
+  comms_event(EVENT_TEST_WRAPPING);
   reset_target();
 
-  comms_printf("Status: Seek first bus cycle.\n");
-  cycles = seek_bus_cycle(startAddress1, false);  
-  comms_printf("Result: Found first bus cycle in %d clocks.\n", cycles);
+  comms_event(EVENT_SEEK_FIRST);
+  if(calibrated)
+  {
+    uint16_t burst = calibrated - kSeekMargin;
+    clock_target(burst);
+    cycles = seek_bus_cycle(startAddress1, false, 2 * kSeekMargin);
+    if(cycles != kSeekTimeout)
+    {
+      comms_event(EVENT_FOUND_FIRST_FAST, burst, cycles);
+      cycles += burst;
+    }
+    else
+    {
+      /* Missed it, start over and measure it again */
+      comms_event(EVENT_CALIBRATION_STALE, startAddress1);
+      reset_target();
+      comms_event(EVENT_SEEK_FIRST);
+    }
+  }
+  if(!calibrated || cycles == kSeekTimeout)
+  {
+    cycles = seek_bus_cycle(startAddress1, false);  
+    comms_event(EVENT_FOUND_FIRST, cycles);
+  }
+  reset_clocks = cycles;
+
+  clock_target(kEntryClocks);
+  get_target_state(&state[0]);
+  for(uint8_t i = 0; i < 8 && state[0].num != 0; i++)
+  {
+    clock_target(1);
+    get_target_state(&state[0]);
+  }
+
+  uint16_t entry = decode_address(&state[0]);
+  comms_event(EVENT_FOUND_ENTRY, entry);
+  return entry;
+}
+
+/* Reset target and seek to the first bus cycle after the address wraps.
+   The number of clocks from the entry address to the wrap is deterministic,
+   so once it has been measured we burst most of the way there and only
+   single step the last kSeekMargin or so clocks. */
+void seek_address_wrap(void)
+{
+  uint32_t cycles; 
+  seek_calibration_t calibration;
+  uint16_t entry = seek_entry();
+
+  comms_event(EVENT_SEEK_ZERO);
+  if(find_calibration(entry, &calibration) >= 0 && calibration.wrap_clocks > kSeekMargin)
+  {
+    uint16_t burst = calibration.wrap_clocks - kSeekMargin;
+    clock_target(burst);
+    cycles = seek_bus_cycle(0x0000, false, 2 * kSeekMargin);
+    if(cycles != kSeekTimeout)
+    {
+      comms_event(EVENT_FOUND_WRAP_FAST, burst, cycles);
+      if(burst + cycles != calibration.wrap_clocks || reset_clocks != calibration.reset_clocks)
+      {
+        save_calibration(entry, burst + cycles);
+      }
+      return;
+    }
 
-  comms_printf("Status: Seek first bus cycle.\n");
-  cycles = seek_bus_cycle(startAddress2, false);  
-  comms_printf("Result: Found output sequence in %d clocks.\n", cycles);
+    /* Missed the wrap, start over and measure it again */
+    comms_event(EVENT_CALIBRATION_STALE, entry);
+    entry = seek_entry();
+    comms_event(EVENT_SEEK_ZERO);
+  }
 
-  comms_printf("Status: Seek zero bus cycle.\n");
   cycles = seek_bus_cycle(0x0000, false);  
-  comms_printf("Result: Found address wrap in %d clocks.\n", cycles);
+  comms_event(EVENT_FOUND_WRAP, cycles);
+  save_calibration(entry, cycles);
+}
+
+void binary_dump(bool dump)
+{
+  seek_address_wrap();
 
   size_t index = 0;
   uint32_t address = 0;
@@ -631,15 +879,11 @@ void binary_dump(bool dump)
     constexpr uint16_t mask = 0x0100;
     if((last & mask) != (next & mask))
     {
-      comms_printf("Reading offset %04X\n", next);
+      comms_event(EVENT_READ_OFFSET, next);
       last = next;
     }
 
-    for(int i = 0; i < 4; i++)
-    {
-      get_target_state(&state[i]);
-      clock_target(2);
-    }
+    clock_address(state);
 
     page_buffer[index + 0] = state[0].ah;
     page_buffer[index + 1] = state[0].adl;
@@ -662,8 +906,280 @@ void binary_dump(bool dump)
       index -= kPageSize;
     }
   }
-  comms_printf("Checksum = %02X\n", checksum);
-  comms_printf("Status: Finished.\n");
+  comms_event(EVENT_CHECKSUM, checksum);
+  comms_event(EVENT_FINISHED);
+}
+
+// Mode 0x06 in bursts: clock and sample as many addresses as read_buffer
+// holds with nothing else going on, then send them while EXTAL is held
+// static, which the HD6805 tolerates. The data sent is the same as for
+// binary_dump(), but clocking no longer waits on the UART.
+void burst_dump(void)
+{
+  constexpr uint16_t kBurstAddresses = kReadBufferSize / kPageSize * kPageSize / 4;
+  static_assert(kBurstAddresses % (kPageSize / 4) == 0 && kMemorySize % (kPageSize / 4) == 0, "Bursts must be whole pages");
+
+  seek_address_wrap();
+  comms_event(EVENT_BURST_SIZE, kBurstAddresses);
+
+  uint8_t checksum = kChecksumInit;
+  for(uint16_t address = 0; address < kMemorySize; address += kBurstAddresses)
+  {
+    uint16_t count = (kMemorySize - address < kBurstAddresses) ? kMemorySize - address : kBurstAddresses;
+    for(uint16_t offset = (address + 0xFF) & ~0xFF; offset < address + count; offset += 0x100)
+    {
+      comms_event(EVENT_READ_OFFSET, offset);
+    }
+
+    uint8_t *entry = read_buffer;
+    for(uint16_t i = 0; i < count; i++)
+    {
+      clock_address(state);
+      *entry++ = state[0].ah;
+      *entry++ = state[0].adl;
+      *entry++ = state[1].ah;
+      *entry++ = state[3].adl;
+    }
+
+    // Don't checksum first 128 bytes as this is RAM, I/O, and unallocated memory locations
+    uint16_t size = count * 4;
+    uint16_t first = (address >= kRiotSize) ? 0 : (kRiotSize - address) * 4;
+    for(uint16_t i = first; i < size; i++)
+    {
+      checksum += read_buffer[i];
+    }
+
+    for(uint16_t offset = 0; offset < size; offset += kPageSize)
+    {
+      comms_sendb(SUB_CMD_SEND_PAGE);
+      comms_send(read_buffer + offset, kPageSize);
+    }
+  }
+  comms_event(EVENT_CHECKSUM, checksum);
+  comms_event(EVENT_FINISHED);
+}
+
+// Mode 0x09, like mode 0x06 but each address is sent as the port snapshot
+// from clock_address_snapshot() and left to the host to decode. Snapshots
+// are packed back to back and sent as pages, so one can straddle two pages.
+// With READ_FLAG_BURST read_buffer is filled before any page is sent.
+// The firmware never sees the decoded bytes, so the checksum is of every
+// port byte sent, for the host to check before decoding.
+void snapshot_dump(bool burst)
+{
+  static_assert(kMemorySize * kSnapshotSize % kPageSize == 0, "Snapshots must fill whole pages");
+  uint16_t full = burst ? kReadBufferSize - kSnapshotSize + 1 : kPageSize;
+
+  seek_address_wrap();
+  if(burst)
+  {
+    /* At most, bytes left over from the last burst are sent with the next one */
+    comms_event(EVENT_BURST_SIZE, kReadBufferSize / kSnapshotSize);
+  }
+
+  uint16_t index = 0;
+  uint8_t checksum = kChecksumInit;
+  for(uint16_t address = 0; address < kMemorySize; address++)
+  {
+    if((address & 0xFF) == 0)
+    {
+      comms_event(EVENT_READ_OFFSET, address);
+    }
+
+    clock_address_snapshot(read_buffer + index);
+    for(uint8_t i = 0; i < kSnapshotSize; i++)
+    {
+      checksum += read_buffer[index + i];
+    }
+    index += kSnapshotSize;
+    if(index < full && address != kMemorySize - 1)
+    {
+      continue;
+    }
+
+    uint16_t sent = 0;
+    for(; sent + kPageSize <= index; sent += kPageSize)
+    {
+      comms_sendb(SUB_CMD_SEND_PAGE);
+      comms_send(read_buffer + sent, kPageSize);
+    }
+    memmove(read_buffer, read_buffer + sent, index - sent);
+    index -= sent;
+  }
+  comms_event(EVENT_CHECKSUM, checksum);
+  comms_event(EVENT_FINISHED);
+}
+
+// Send the full bus state for an address that didn't match the expected sequence
+bool send_exception(uint16_t address, bool framed)
+{
+  uint8_t record[] = {
+    (uint8_t)((address >> 0) & 0xFF),
+    (uint8_t)((address >> 8) & 0xFF),
+    state[0].ah,
+    state[0].adl,
+    state[1].ah,
+    state[3].adl,
+  };
+
+  if(framed)
+  {
+    return frame_send(FRAME_EXCEPTION, record, sizeof(record));
+  }
+  comms_sendb(SUB_CMD_EXCEPTION);
+  comms_send(record, sizeof(record));
+  return true;
+}
+
+// Send a block of data bytes, either bare or as a frame
+bool send_block(uint8_t *data, uint8_t size, bool framed)
+{
+  if(framed)
+  {
+    return frame_send(FRAME_DATA, data, size);
+  }
+  comms_send_data(data, size);
+  return true;
+}
+
+// Seek to a logical address, single stepping at most limit clocks
+uint32_t seek_address(uint16_t address, uint32_t limit)
+{
+  for(uint32_t cycles = 0; cycles <= limit; cycles++)
+  {
+    get_target_state(&state[0]);
+    if(state[0].strobe == 1 && state[0].num == 0 && decode_address(&state[0]) == address)
+    {
+      count_seek(cycles);
+      return cycles;
+    }
+    clock_target(1);
+  }
+  count_seek(limit);
+  return kSeekTimeout;
+}
+
+// Go back to bare sub-commands at the end of a framed dump
+static bool compact_dump_end(bool framed)
+{
+  if(framed && !frame_end())
+  {
+    comms_event(EVENT_FRAME_FAILED);
+    return false;
+  }
+  return true;
+}
+
+/* Same sequence as binary_dump(), but only data bytes are sent for the
+   addresses from start to start + length - 1. The address sequence is
+   checked here and any address that doesn't match is sent as an exception
+   record so the host can rebuild the log file. Exceptions are sent in
+   stream order, so the host knows which data byte they belong to.
+
+   The address counter keeps wrapping every 4096 bus cycles, so further
+   passes are read without resetting the target or seeking again.
+
+   When framed, every pass is acknowledged by the host before its result
+   is sent, so a bad frame only costs resending the frames after it. The
+   events of the dump go in frames as well, up to the FRAME_END. */
+void compact_dump(uint16_t start, uint16_t length, uint8_t passes, bool framed)
+{
+  seek_address_wrap();
+  if(framed)
+  {
+    frame_begin();
+  }
+
+  /* Every address takes the same number of clocks, so skip straight to the start */
+  uint16_t skip = start;
+  for(uint8_t pass = 0; pass < passes; pass++)
+  {
+    if(skip)
+    {
+      /* A short skip is all margin, single step the whole way */
+      uint32_t clocks = (uint32_t)skip * kClocksPerAddress;
+      uint32_t limit = clocks + kSeekMargin;
+      if(clocks > kSeekMargin)
+      {
+        clock_target(clocks - kSeekMargin);
+        limit = 2 * kSeekMargin;
+      }
+      uint32_t cycles = seek_address(start, limit);
+      if(cycles == kSeekTimeout)
+      {
+        comms_event(EVENT_SEEK_FAILED, start);
+        compact_dump_end(framed);
+        return;
+      }
+      comms_event(EVENT_FOUND_START, start, cycles);
+    }
+    skip = kMemorySize - length;
+
+    size_t index = 0;
+    uint8_t checksum = kChecksumInit;
+    uint16_t exceptions = 0;
+
+    for(uint16_t count = 0; count < length; count++)
+    {
+      uint16_t address = (start + count) & (kMemorySize - 1);
+
+      clock_address(state);
+
+      if(decode_address(&state[0]) != address || state[1].ah != state[0].ah)
+      {
+        if(index && !send_block(page_buffer, index, framed))
+        {
+          break;
+        }
+        index = 0;
+        if(!send_exception(address, framed))
+        {
+          break;
+        }
+        ++exceptions;
+        ++read_stats.mismatches;
+      }
+
+      // Checksum matches binary_dump() so the host can verify the rebuilt log
+      if(address >= kRiotSize)
+      {
+        checksum += state[0].ah + state[0].adl + state[1].ah + state[3].adl;
+      }
+
+      page_buffer[index++] = state[3].adl;
+      if(index >= kPageSize || count == length - 1)
+      {
+        if(!send_block(page_buffer, index, framed))
+        {
+          break;
+        }
+        index = 0;
+      }
+    }
+
+    if(framed && !frame_finish())
+    {
+      comms_event(EVENT_FRAME_FAILED);
+      return;
+    }
+    comms_event(EVENT_PASS_RESULT, pass + 1, exceptions, checksum);
+
+    // Host sends ESC once it has enough passes in agreement
+    if(pass + 1 < passes && (framed ? frame_stop_requested() : comms_abort_requested()))
+    {
+      comms_event(EVENT_PASSES_STOPPED, pass + 1);
+      break;
+    }
+  }
+  if(!compact_dump_end(framed))
+  {
+    return;
+  }
+  if(framed)
+  {
+    comms_event(EVENT_FRAME_STATS, frame_stats.sent, frame_stats.resent, frame_stats.naks, frame_stats.timeouts);
+  }
+  comms_event(EVENT_FINISHED);
 }
 
 
@@ -671,9 +1187,30 @@ void cmd_read(void)
 {
   comms_acknowledge_command(CMD_READ);
   comms_get_parameters(parameters);  
-  comms_printf("Got command parameter = %02X\n", parameters[0]);
+  uint32_t start = micros();
+  uart_reset_stats();
+  read_stats_reset();
+  read_stats_timing = parameters[READ_PARAM_FLAGS] & READ_FLAG_TIMING;
+  comms_event(EVENT_READ_MODE, parameters[READ_PARAM_MODE]);
+
+  uint16_t rate_khz = set_clock_rate(parameters[READ_PARAM_CLOCK_LO] | parameters[READ_PARAM_CLOCK_HI] << 8);
+  if(rate_khz == kClockRateLegacy)
+  {
+    comms_event(EVENT_CLOCK_LEGACY);
+  }
+  else
+  {
+    comms_event(EVENT_CLOCK_TIMER, rate_khz);
+  }
 
-  switch(parameters[0])
+  bool unrolled = parameters[READ_PARAM_FLAGS] & READ_FLAG_UNROLLED;
+  set_address_loop(unrolled);
+  if(unrolled)
+  {
+    comms_event(EVENT_CLOCK_UNROLLED, kUnrolledRateKhz);
+  }
+
+  switch(parameters[READ_PARAM_MODE])
   {
     case 0x00:
       read_raw_cycles();
@@ -700,23 +1237,64 @@ void cmd_read(void)
       break;
 
     case 0x06:
-      binary_dump(false);
+      if(parameters[READ_PARAM_FLAGS] & READ_FLAG_BURST)
+      {
+        burst_dump();
+      }
+      else
+      {
+        binary_dump(false);
+      }
       break;
 
     case 0x07:
       free_run();
       break;
+
+    case 0x08:
+      {
+        uint16_t start = (parameters[READ_PARAM_START_LO] | parameters[READ_PARAM_START_HI] << 8) & (kMemorySize - 1);
+        uint16_t length = parameters[READ_PARAM_LENGTH_LO] | parameters[READ_PARAM_LENGTH_HI] << 8;
+        uint8_t passes = parameters[READ_PARAM_PASSES];
+        if(length == 0 || length > kMemorySize)
+        {
+          length = kMemorySize;
+        }
+        bool framed = parameters[READ_PARAM_FLAGS] & READ_FLAG_FRAMED;
+        compact_dump(start, length, passes ? passes : 1, framed);
+      }
+      break;
       
+    case 0x09:
+      snapshot_dump(parameters[READ_PARAM_FLAGS] & READ_FLAG_BURST);
+      break;
+
     default:
-      comms_printf("Unknown parameter value %02X\n", parameters[0]);
+      comms_event(EVENT_UNKNOWN_MODE, parameters[READ_PARAM_MODE]);
       break;
   }
+
+  comms_event(EVENT_UART_STATS,
+    uart_stats.tx_high_water, kUartTxRingSize - 1, uart_stats.tx_stalls, uart_stats.rx_overruns);
+
+  read_stats_timing = false;
+  read_stats.read_us = micros() - start;
+  comms_send_stats();
   
-  comms_printf("Normal exit.\n");
+  comms_event(EVENT_NORMAL_EXIT);
   comms_sendb(SUB_CMD_EXIT);    
 }
 
 
+// Send the counters from the last read again
+void cmd_stats(void)
+{
+  comms_acknowledge_command(CMD_STATS);
+  comms_send_stats();
+  comms_sendb(SUB_CMD_EXIT);
+}
+
+
 void comms_dispatch(void)
 {
   uint8_t command = comms_getb();
@@ -741,11 +1319,25 @@ void comms_dispatch(void)
       cmd_read();
       break;
 
+    case CMD_LINK:
+      cmd_link();
+      return;
+
+    case CMD_SYNC:
+      cmd_sync();
+      break;
+
+    case CMD_STATS:
+      cmd_stats();
+      break;
+
     default:
       comms_sendb(COMMS_NACK);
       comms_sendb(command);
       break;
   }
+
+  link_reset();
 }
 
 /* End */
@@ -1,18 +1,73 @@
 
 #pragma once
 
+#include "target.hpp"
+
+/* Parameter layout for CMD_READ */
+enum read_parameter {
+  READ_PARAM_MODE         =   0x00,   /* Read mode, see cmd_read() */
+  READ_PARAM_CLOCK_LO     =   0x01,   /* EXTAL rate in kHz, zero for bit-banged clock */
+  READ_PARAM_CLOCK_HI     =   0x02,
+  READ_PARAM_START_LO     =   0x03,   /* First address for mode 0x08 */
+  READ_PARAM_START_HI     =   0x04,
+  READ_PARAM_LENGTH_LO    =   0x05,   /* Number of addresses for mode 0x08, zero for all */
+  READ_PARAM_LENGTH_HI    =   0x06,
+  READ_PARAM_PASSES       =   0x07,   /* Number of passes for mode 0x08, zero for one */
+  READ_PARAM_FLAGS        =   0x08,   /* Options, see read_flag */
+};
+
+/* Read options */
+enum read_flag {
+  READ_FLAG_FRAMED        =   0x01,   /* Mode 0x08 only, send data and exceptions as frames, see frame.hpp */
+  READ_FLAG_TIMING        =   0x02,   /* Time clocking, sampling and sending, see stats.hpp */
+  READ_FLAG_UNROLLED      =   0x04,   /* Modes 0x06, 0x08 and 0x09, clock each address with clock_address_unrolled() */
+  READ_FLAG_BURST         =   0x08,   /* Modes 0x06 and 0x09, capture into read_buffer then send, see burst_dump() */
+};
+
+constexpr uint32_t kSeekTimeout     = 0xFFFFFFFF; /* seek_bus_cycle() hit its limit */
+constexpr uint16_t kSeekMargin      = 16;         /* Clocks single stepped either side of a calibrated seek */
+
+/* Seek calibration cached in EEPROM */
+class seek_calibration_t {
+public:
+  uint16_t magic;
+  uint16_t entry;         /* Address the output sequence starts from */
+  uint16_t wrap_clocks;   /* Clocks from the entry address to the address wrap */
+  uint16_t reset_clocks;  /* Clocks from reset to the reset vector fetch at 0xFFE */
+};
+
+constexpr uint16_t kCalibrationMagic  = 0x6806;  /* Changes with the layout so old slots are ignored */
+constexpr int kCalibrationBase        = 0x000;  /* EEPROM offset */
+constexpr uint8_t kCalibrationSlots   = 4;
+
 uint8_t shuffle(uint8_t in);
 uint8_t nbit(uint8_t value);
+uint16_t decode_address(target_state_t *state);
 void run_read();
 int cmd_echo(void);
+void cmd_link(void);
+void link_reset(void);
+void cmd_sync(void);
 void read_raw_cycles(void);
 void validate_adl(void);
 void validate_adl_1bit(void);
-uint32_t seek_bus_cycle(uint16_t address, bool debug);
+uint32_t seek_bus_cycle(uint16_t address, bool debug, uint32_t limit = 0);
 void test_address_wrapping(void);
 void test_address_output(bool dump);
 void test_dump(bool dump);
 void free_run(void);
+int find_calibration(uint16_t entry, seek_calibration_t *calibration);
+uint16_t find_reset_clocks(void);
+void save_calibration(uint16_t entry, uint16_t wrap_clocks);
+uint16_t seek_entry(void);
+void seek_address_wrap(void);
 void binary_dump(bool dump);
+void burst_dump(void);
+void snapshot_dump(bool burst);
+bool send_exception(uint16_t address, bool framed);
+uint32_t seek_address(uint16_t address, uint32_t limit);
+bool send_block(uint8_t *data, uint8_t size, bool framed);
+void compact_dump(uint16_t start, uint16_t length, uint8_t passes, bool framed);
 void cmd_read(void);
+void cmd_stats(void);
 void comms_dispatch(void);
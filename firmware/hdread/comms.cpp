@@ -3,35 +3,89 @@
 #include <Arduino.h>
 #include "comms.hpp"
 #include "board.hpp"
+#include "frame.hpp"
+#include "uart.hpp"
+#include "stats.hpp"
 
-char fmt_buffer[kMaxMsgSize];
-char msg_buffer[kMaxMsgSize];
 uint8_t parameters[kMaxParameters];
-uint8_t page_buffer[kPageSize];
+uint8_t read_buffer[kReadBufferSize];
+static_assert(kReadBufferSize + kUartTxRingSize + kUartRxRingSize + kOtherGlobals + kStackReserve <= kSramSize,
+  "read_buffer leaves too little SRAM for the stack");
 
 // Get byte from host PC
 uint8_t comms_getb(void)
 {
-  while(Serial.available() == 0)
+  while(uart_available() == 0)
   {
       delayMicroseconds(1);
   }
   
-  return Serial.read();
+  return uart_getb();
 }
 
-// Send byte to host PC
+// Get byte from host PC, returns false if nothing arrives in time
+bool comms_getb_timeout(uint8_t *data, uint16_t timeout_ms)
+{
+  uint32_t start = millis();
+  while(uart_available() == 0)
+  {
+    if(millis() - start >= timeout_ms)
+    {
+      return false;
+    }
+  }
+
+  *data = uart_getb();
+  return true;
+}
+
+// Check for an abort request from the host PC without waiting
+bool comms_abort_requested(void)
+{
+  while(uart_available())
+  {
+    if(uart_getb() == ASCII_ESC)
+    {
+      return true;
+    }
+  }
+  return false;
+}
+
+// Send byte to host PC, queued in the UART TX ring so this doesn't wait for it to go out
 void comms_sendb(uint8_t data)
 {
-  Serial.write(data);
-  Serial.flush();
+  if(!read_stats_timing)
+  {
+    uart_putb(data);
+    return;
+  }
+
+  uint32_t start = micros();
+  uart_putb(data);
+  read_stats.send_us += micros() - start;
 }
 
 // Send bytes to host PC
-void comms_send(uint8_t *data, size_t size)
+void comms_send(const uint8_t *data, size_t size)
+{
+  if(!read_stats_timing)
+  {
+    uart_write(data, size);
+    return;
+  }
+
+  uint32_t start = micros();
+  uart_write(data, size);
+  read_stats.send_us += micros() - start;
+}
+
+// Send variable length data block to host PC
+void comms_send_data(uint8_t *data, uint8_t size)
 {
-  Serial.write(data, size);
-  Serial.flush();
+  comms_sendb(SUB_CMD_SEND_DATA);
+  comms_sendb(size);
+  comms_send(data, size);
 }
 
 // Get bytes from host PC
@@ -40,11 +94,9 @@ void comms_get(uint8_t *data, size_t size)
   size_t offset = 0;
   while(offset < size)
   {
-    int bytes_ready = Serial.available();
-    if(bytes_ready)
+    if(uart_available())
     {
-      int bytes_read = Serial.readBytes(&data[offset], bytes_ready);
-      offset += bytes_read;
+      data[offset++] = uart_getb();
     }
     else
     {
@@ -63,8 +115,10 @@ void comms_puts(const char *msg)
   comms_send(msg, size);
 }
 
+// Formatted text log, only used by diagnostic modes. Use comms_event() elsewhere.
 void comms_printf(const char *fmt, ...)
 {
+  char msg_buffer[kMaxMsgSize];
   memset(msg_buffer, 0, sizeof(msg_buffer));
   va_list ap;
   va_start(ap, fmt);
@@ -73,16 +127,92 @@ void comms_printf(const char *fmt, ...)
   comms_puts(msg_buffer);
 }
 
+// Send binary log event, arguments are sent as unsigned LEB128 varints
+void comms_send_event(uint8_t id, uint8_t argc, const uint32_t *args)
+{
+  uint8_t event[2 + kMaxEventArgs * 5];
+  uint8_t size = 0;
+  event[size++] = id;
+  event[size++] = argc;
+  for(uint8_t i = 0; i < argc; i++)
+  {
+    uint32_t value = args[i];
+    while(value >= 0x80)
+    {
+      event[size++] = (value & 0x7F) | 0x80;
+      value >>= 7;
+    }
+    event[size++] = value;
+  }
+
+  /* A framed dump sends everything in frames, see frame.hpp */
+  if(frame_active())
+  {
+    frame_send(FRAME_EVENT, event, size);
+    return;
+  }
+  comms_sendb(SUB_CMD_EVENT);
+  comms_send(event, size);
+}
+
+void comms_event(uint8_t id)
+{
+  comms_send_event(id, 0, NULL);
+}
+
+void comms_event(uint8_t id, uint32_t a0)
+{
+  uint32_t args[] = {a0};
+  comms_send_event(id, 1, args);
+}
+
+void comms_event(uint8_t id, uint32_t a0, uint32_t a1)
+{
+  uint32_t args[] = {a0, a1};
+  comms_send_event(id, 2, args);
+}
+
+void comms_event(uint8_t id, uint32_t a0, uint32_t a1, uint32_t a2)
+{
+  uint32_t args[] = {a0, a1, a2};
+  comms_send_event(id, 3, args);
+}
+
+void comms_event(uint8_t id, uint32_t a0, uint32_t a1, uint32_t a2, uint32_t a3)
+{
+  uint32_t args[] = {a0, a1, a2, a3};
+  comms_send_event(id, 4, args);
+}
+
 void comms_get_parameters(uint8_t *parameters)
 {
   comms_sendb(SUB_CMD_GET_PARAMETERS);
   uint8_t size = comms_getb();
-  comms_printf(PSTR("Get %d parameters from host\n"), size);
+  /* Parameters the host doesn't send read as zero */
+  memset(parameters, 0, kMaxParameters);
+  comms_event(EVENT_GET_PARAMETERS, size);
   for(int i = 0; i < size; i++) {
     parameters[i] = comms_getb();
   }
 }
 
+// Send the counters from the last read, see stats.hpp
+void comms_send_stats(void)
+{
+  const uint32_t *fields = (const uint32_t *)&read_stats;
+  comms_sendb(SUB_CMD_STATS);
+  comms_sendb(kStatsFields * sizeof(uint32_t));
+  for(uint8_t i = 0; i < kStatsFields; i++)
+  {
+    uint32_t value = fields[i];
+    for(uint8_t j = 0; j < sizeof(uint32_t); j++)
+    {
+      comms_sendb(value & 0xFF);
+      value >>= 8;
+    }
+  }
+}
+
 // Send COMMS_ACK and the command back
 void comms_acknowledge_command(uint8_t command)
 {
@@ -90,5 +220,12 @@ void comms_acknowledge_command(uint8_t command)
   comms_sendb(command);
 }
 
+// Tell the PC we're running and which protocol version we speak
+void comms_send_ready(void)
+{
+  comms_sendb(SUB_CMD_READY);
+  comms_send(kReadyMagic, sizeof(kReadyMagic));
+  comms_sendb(kProtocolVersion);
+}
 
 /* End */
@@ -1,6 +1,8 @@
 
 #pragma once
 
+#include "events.hpp"
+
 #define ASCII_ESC             0x1B    /* Escape key */
 #define COMMS_ACK             0xA5    /* Command accepted */
 #define COMMS_NACK            0xAA    /* Command rejected */
@@ -17,30 +19,68 @@ enum  main_cmd {
   CMD_FUSE                =   0x24,  
   CMD_MODE                =   0x26,
   CMD_TEST                =   0x27,
+  CMD_LINK                =   0x28,
+  CMD_SYNC                =   0x29,
+  CMD_STATS               =   0x2A,
 };
 
 /* Commands we send the PC to process */
 enum sub_cmd {
   SUB_CMD_LOG             =   0x22,   /* Print message to PC */
+  SUB_CMD_SYNC            =   0x23,   /* Start of resent frames, see frame.hpp */
   SUB_CMD_EXIT            =   0x24,   /* Tell PC to stop processing commands */
   SUB_CMD_GET_PAGE        =   0x25,   /* Get binary data from PC */
   SUB_CMD_SEND_PAGE       =   0x26,   /* Send binary data to PC */
   SUB_CMD_GET_PARAMETERS  =   0x27,   /* Get parameter list from PC */
+  SUB_CMD_SEND_DATA       =   0x28,   /* Send variable length data to PC */
+  SUB_CMD_EXCEPTION       =   0x29,   /* Send unexpected bus state to PC */
+  SUB_CMD_EVENT           =   0x2A,   /* Send binary log event to PC */
+  SUB_CMD_FRAME           =   0x2B,   /* Send sequenced, checked frame to PC */
+  SUB_CMD_READY           =   0x2C,   /* Firmware is running, see comms_send_ready() */
+  SUB_CMD_STATS           =   0x2D,   /* Counters from the last read, see stats.hpp */
 };
 
 constexpr size_t kMaxParameters = 0x10;
 constexpr size_t kPageSize      = 0x40;
 constexpr size_t kMaxMsgSize    = 0x80;
+constexpr size_t kReadBufferSize = 0x400;   /* page_buffer then the frame window, see frame.cpp */
 constexpr uint8_t kChecksumInit = 0x81;
 
+/* SRAM budget on the ATmega328P, checked in comms.cpp. read_buffer gets what
+   is left after the UART rings, the other globals (an estimated 0xA0 bytes
+   including the Arduino core) and the stack, deepest in comms_printf(). */
+constexpr size_t kSramSize      = 0x800;
+constexpr size_t kOtherGlobals  = 0x100;
+constexpr size_t kStackReserve  = 0x180;
+
+/* Sent after SUB_CMD_READY, followed by kProtocolVersion */
+constexpr uint8_t kReadyMagic[] = {'H', 'D', '6'};
+constexpr uint8_t kProtocolVersion = 7;
+
 extern uint8_t parameters[kMaxParameters];
-extern uint8_t page_buffer[kPageSize];
+
+/* Read data is staged in read_buffer. Normal reads use the start of it as
+   page_buffer and framed reads keep the frame window after that; a burst
+   capture (see burst_dump()) uses neither, so it takes the whole buffer. */
+extern uint8_t read_buffer[kReadBufferSize];
+constexpr uint8_t *page_buffer = read_buffer;
 
 uint8_t comms_getb(void);
+bool comms_getb_timeout(uint8_t *data, uint16_t timeout_ms);
+bool comms_abort_requested(void);
 void comms_sendb(uint8_t data);
-void comms_send(uint8_t *data, size_t size);
+void comms_send(const uint8_t *data, size_t size);
+void comms_send_data(uint8_t *data, uint8_t size);
 void comms_get(uint8_t *data, size_t size);
 void comms_puts(const char *msg);
 void comms_printf(const char *fmt, ...);
+void comms_send_event(uint8_t id, uint8_t argc, const uint32_t *args);
+void comms_event(uint8_t id);
+void comms_event(uint8_t id, uint32_t a0);
+void comms_event(uint8_t id, uint32_t a0, uint32_t a1);
+void comms_event(uint8_t id, uint32_t a0, uint32_t a1, uint32_t a2);
+void comms_event(uint8_t id, uint32_t a0, uint32_t a1, uint32_t a2, uint32_t a3);
 void comms_get_parameters(uint8_t *parameters);
 void comms_acknowledge_command(uint8_t command);
+void comms_send_ready(void);
+void comms_send_stats(void);
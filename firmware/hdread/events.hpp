@@ -0,0 +1,57 @@
+#pragma once
+
+#include <stdint.h>
+
+/* Binary log events sent with SUB_CMD_EVENT in place of formatted text.
+   Each event is sent as the event ID, the argument count, then each
+   argument as an unsigned LEB128 varint. The host includes this file and
+   formats events using the strings in the table, which are not compiled
+   into the firmware. Arguments are passed to printf() as 32-bit unsigned
+   values so only integer and %c conversions can be used. */
+
+constexpr uint8_t kMaxEventArgs = 4;
+
+#define EVENT_TABLE(X) \
+  X(EVENT_GET_PARAMETERS,   "Get %u parameters from host\n") \
+  X(EVENT_READ_MODE,        "Got command parameter = %02X\n") \
+  X(EVENT_UNKNOWN_MODE,     "Unknown parameter value %02X\n") \
+  X(EVENT_CLOCK_LEGACY,     "Status: Using bit-banged EXTAL clock.\n") \
+  X(EVENT_CLOCK_TIMER,      "Status: Using Timer1 EXTAL clock at %u kHz.\n") \
+  X(EVENT_CLOCK_UNROLLED,   "Status: Using unrolled EXTAL loop at %u kHz.\n") \
+  X(EVENT_BURST_SIZE,       "Status: Capturing %u addresses per burst.\n") \
+  X(EVENT_UART_STATS,       "Result: TX ring high water %u/%u bytes, %u stalls, %u RX overruns.\n") \
+  X(EVENT_NORMAL_EXIT,      "Normal exit.\n") \
+  X(EVENT_TEST_WRAPPING,    "Status: Test address wrapping.\n") \
+  X(EVENT_SEEK_FIRST,       "Status: Seek first bus cycle.\n") \
+  X(EVENT_SEEK_ZERO,        "Status: Seek zero bus cycle.\n") \
+  X(EVENT_FOUND_FIRST,      "Result: Found first bus cycle in %u clocks.\n") \
+  X(EVENT_FOUND_FIRST_FAST, "Result: Found first bus cycle in %u + %u clocks (calibrated).\n") \
+  X(EVENT_FOUND_OUTPUT,     "Result: Found output sequence in %u clocks.\n") \
+  X(EVENT_FOUND_WRAP,       "Result: Found address wrap in %u clocks.\n") \
+  X(EVENT_FOUND_WRAP_LAST,  "Result: Found address wrap-1 in %u clocks.\n") \
+  X(EVENT_FOUND_ENTRY,      "Result: Found output sequence at %03X.\n") \
+  X(EVENT_FOUND_WRAP_FAST,  "Result: Found address wrap in %u + %u clocks (calibrated).\n") \
+  X(EVENT_CALIBRATION_SAVED,"Result: Saved seek calibration for %03X (%u clocks).\n") \
+  X(EVENT_CALIBRATION_STALE,"Status: Seek calibration for %03X is stale, recalibrating.\n") \
+  X(EVENT_FOUND_START,      "Result: Found start address %03X in %u clocks.\n") \
+  X(EVENT_SEEK_FAILED,      "Error: Couldn't find address %03X.\n") \
+  X(EVENT_SEEK_STATE,       "AH=%02X ADL=%02X NUM=%u TEST=%u\n") \
+  X(EVENT_READ_OFFSET,      "Reading offset %04X\n") \
+  X(EVENT_PASS_RESULT,      "Result: Pass %u, %u address exceptions, checksum = %02X\n") \
+  X(EVENT_CHECKSUM,         "Checksum = %02X\n") \
+  X(EVENT_FRAME_STATS,      "Status: %u frames sent, %u resent, %u NAKs, %u timeouts.\n") \
+  X(EVENT_FRAME_FAILED,     "Error: Host stopped acknowledging frames.\n") \
+  X(EVENT_PASSES_STOPPED,   "Status: Stopped by host after %u passes.\n") \
+  X(EVENT_FINISHED,         "Status: Finished.\n") \
+  X(EVENT_ADDRESS,          "%04X,") \
+  X(EVENT_ROW_START,        "%04X: %02X: ") \
+  X(EVENT_ROW_DATA,         "%02X%c") \
+  X(EVENT_DUMP_ENTRY,       "%02X%02X%02X%02X,") \
+  X(EVENT_NEWLINE,          "\n") \
+
+enum event_id {
+#define EVENT_ID(id, fmt) id,
+  EVENT_TABLE(EVENT_ID)
+#undef EVENT_ID
+  EVENT_COUNT
+};
@@ -0,0 +1,191 @@
+#include <stdint.h>
+#include <Arduino.h>
+#include <util/crc16.h>
+#include "comms.hpp"
+#include "frame.hpp"
+#include "uart.hpp"
+
+frame_stats_t frame_stats;
+
+class frame_slot_t {
+public:
+  uint8_t type;
+  uint8_t size;
+  uint8_t data[kFrameMaxSize];
+};
+
+/* Kept in read_buffer after page_buffer, see comms.hpp */
+static frame_slot_t *const frame_window = (frame_slot_t *)(read_buffer + kPageSize);
+static_assert(kPageSize + kFrameWindow * sizeof(frame_slot_t) <= kReadBufferSize, "Frame window doesn't fit in read_buffer");
+static uint16_t next_seq;         /* Sequence number of the next new frame */
+static uint16_t acked_seq;        /* Oldest frame the PC hasn't acknowledged */
+static uint32_t last_progress;    /* Time of the last new frame or acknowledgement */
+static uint8_t retries;
+static bool stop_requested;
+static bool active;               /* Between frame_begin() and frame_end(), or until the PC stops answering */
+
+static void frame_transmit(uint16_t seq)
+{
+  frame_slot_t *slot = &frame_window[seq % kFrameWindow];
+  uint8_t header[] = {slot->type, (uint8_t)(seq & 0xFF), (uint8_t)(seq >> 8), slot->size};
+  uint16_t crc = kFrameCrcInit;
+
+  for(uint8_t i = 0; i < sizeof(header); i++)
+  {
+    crc = _crc_xmodem_update(crc, header[i]);
+  }
+  for(uint8_t i = 0; i < slot->size; i++)
+  {
+    crc = _crc_xmodem_update(crc, slot->data[i]);
+  }
+
+  comms_sendb(SUB_CMD_FRAME);
+  comms_send(header, sizeof(header));
+  comms_send(slot->data, slot->size);
+  comms_sendb((crc >> 0) & 0xFF);
+  comms_sendb((crc >> 8) & 0xFF);
+}
+
+// Go back and resend every frame from seq onwards
+static void frame_resend(uint16_t seq)
+{
+  comms_send(kFrameSync, sizeof(kFrameSync));
+  for(; seq != next_seq; seq++)
+  {
+    frame_transmit(seq);
+    ++frame_stats.resent;
+  }
+  last_progress = millis();
+}
+
+// Wait until no more than count frames are unacknowledged
+static bool frame_wait(uint8_t count)
+{
+  while((uint16_t)(next_seq - acked_seq) > count)
+  {
+    frame_poll();
+    if(millis() - last_progress >= kFrameTimeoutMs)
+    {
+      if(++retries > kFrameRetries)
+      {
+        active = false;
+        return false;
+      }
+      ++frame_stats.timeouts;
+      frame_resend(acked_seq);
+    }
+  }
+  return true;
+}
+
+void frame_begin(void)
+{
+  next_seq = 0;
+  acked_seq = 0;
+  retries = 0;
+  stop_requested = false;
+  last_progress = millis();
+  memset(&frame_stats, 0, sizeof(frame_stats));
+  active = true;
+  comms_send(kFrameSync, sizeof(kFrameSync));
+}
+
+// Queue a frame and send it, waiting for room in the window first
+bool frame_send(uint8_t type, const uint8_t *data, uint8_t size)
+{
+  if(!active || !frame_wait(kFrameWindow - 1))
+  {
+    return false;
+  }
+
+  frame_slot_t *slot = &frame_window[next_seq % kFrameWindow];
+  slot->type = type;
+  slot->size = size;
+  if(size)
+  {
+    memcpy(slot->data, data, size);
+  }
+
+  frame_transmit(next_seq++);
+  ++frame_stats.sent;
+  last_progress = millis();
+
+  frame_poll();
+  return true;
+}
+
+// Wait until the PC has acknowledged every frame
+bool frame_finish(void)
+{
+  return active && frame_wait(0);
+}
+
+// Send FRAME_END and wait until the PC has it, then go back to bare sub-commands
+bool frame_end(void)
+{
+  if(!frame_send(FRAME_END, NULL, 0) || !frame_finish())
+  {
+    return false;
+  }
+  active = false;
+  return true;
+}
+
+// Check if sub-commands go in frames, see comms_send_event()
+bool frame_active(void)
+{
+  return active;
+}
+
+// Handle acknowledgements and stop requests from the PC without waiting
+void frame_poll(void)
+{
+  while(uart_available())
+  {
+    uint8_t control = uart_getb();
+    if(control == ASCII_ESC)
+    {
+      stop_requested = true;
+      continue;
+    }
+    if(control != FRAME_ACK && control != FRAME_NAK)
+    {
+      continue;
+    }
+
+    uint8_t lo, hi;
+    if(!comms_getb_timeout(&lo, kFrameTimeoutMs) || !comms_getb_timeout(&hi, kFrameTimeoutMs))
+    {
+      return;
+    }
+
+    // Ignore anything outside the unacknowledged window
+    uint16_t seq = lo | hi << 8;
+    if((uint16_t)(seq - acked_seq) > (uint16_t)(next_seq - acked_seq))
+    {
+      continue;
+    }
+
+    if(seq != acked_seq)
+    {
+      acked_seq = seq;
+      retries = 0;
+      last_progress = millis();
+    }
+
+    if(control == FRAME_NAK && seq != next_seq)
+    {
+      ++frame_stats.naks;
+      frame_resend(seq);
+    }
+  }
+}
+
+// Check if the PC has asked for the read to stop
+bool frame_stop_requested(void)
+{
+  frame_poll();
+  return stop_requested;
+}
+
+/* End */
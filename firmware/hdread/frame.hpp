@@ -0,0 +1,55 @@
+#pragma once
+
+#include "comms.hpp"
+
+/* Framed transfer of read data. Each frame is sent as
+
+     [SUB_CMD_FRAME][type][seq lo][seq hi][size][payload...][crc lo][crc hi]
+
+   with a CRC-16/CCITT (0x1021, initial 0xFFFF) over everything after the
+   sub-command byte. Up to kFrameWindow frames may be unacknowledged, and
+   are kept so they can be resent when the PC reports a bad frame.
+
+   Between frame_begin() and frame_end() events are sent as frames too, so
+   the PC can treat any other byte as a damaged frame. */
+
+/* Frame types */
+enum frame_type {
+  FRAME_DATA              =   0x01,   /* Data bytes in stream order */
+  FRAME_EXCEPTION         =   0x02,   /* Unexpected bus state, same layout as SUB_CMD_EXCEPTION */
+  FRAME_EVENT             =   0x03,   /* Binary log event, same layout as SUB_CMD_EVENT */
+  FRAME_END               =   0x04,   /* Last frame, sub-commands are sent bare again */
+};
+
+/* Messages the PC sends back while frames are in flight, followed by a 16-bit sequence number */
+enum frame_control {
+  FRAME_ACK               =   0x06,   /* Every frame before seq was received */
+  FRAME_NAK               =   0x15,   /* Frame seq was bad or missing, resend from it */
+};
+
+constexpr uint8_t kFrameWindow      = 4;        /* Unacknowledged frames kept for resending */
+constexpr uint8_t kFrameMaxSize     = 0x40;     /* Largest payload, the same as a page */
+constexpr uint16_t kFrameCrcInit    = 0xFFFF;
+constexpr uint16_t kFrameTimeoutMs  = 100;      /* Resend everything unacknowledged after this long */
+constexpr uint8_t kFrameRetries     = 10;       /* Give up after this many timeouts in a row */
+
+/* Sent before the first frame, and before resent frames so the PC can find the start of a frame again */
+constexpr uint8_t kFrameSync[] = {SUB_CMD_SYNC, 0x5A, 0xC3};
+
+class frame_stats_t {
+public:
+  uint16_t sent;            /* Frames sent for the first time */
+  uint16_t resent;          /* Frames sent again after a NAK or timeout */
+  uint16_t naks;            /* NAKs received from the PC */
+  uint16_t timeouts;        /* Times the PC stopped acknowledging */
+};
+
+extern frame_stats_t frame_stats;
+
+void frame_begin(void);
+bool frame_send(uint8_t type, const uint8_t *data, uint8_t size);
+bool frame_finish(void);
+bool frame_end(void);
+bool frame_active(void);
+void frame_poll(void);
+bool frame_stop_requested(void);
@@ -13,6 +13,7 @@
 #include "target.hpp"
 #include "board.hpp"
 #include "cmds.hpp"
+#include "uart.hpp"
 
 void setup() 
 {
@@ -57,11 +58,13 @@ void setup()
   digitalWrite(pin_b6, LOW);
   digitalWrite(pin_b7, LOW);
 
+  set_clock_rate(kClockRateLegacy);
+
   debug_init(kHostBaudRate);
-  Serial.begin(kHostBaudRate);
+  uart_init(kHostBaudRate);
+  comms_send_ready();
 }
 
 void loop() {
   comms_dispatch();
-  delay(100);
 }
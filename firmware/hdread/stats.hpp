@@ -0,0 +1,41 @@
+#pragma once
+
+#include <stdint.h>
+#include <string.h>
+
+/* Counters for the last read, sent to the host with SUB_CMD_STATS at the end
+   of every read and in answer to CMD_STATS. The record is a size byte then
+   each field below in order as a little endian uint32_t, and the host
+   decodes it with this table.
+
+   Times are micros() totals, so they have its 4us resolution. Clocking,
+   sampling and send times are only counted when the read sets
+   READ_FLAG_TIMING, as timing every sample slows the read down. */
+#define STATS_TABLE(X) \
+  X(clocks)           /* EXTAL clocks issued */ \
+  X(seeks)            /* seek_bus_cycle() and seek_address() calls */ \
+  X(seek_clocks)      /* Clocks spent in them */ \
+  X(seek_max)         /* Clocks in the longest one */ \
+  X(mismatches)       /* Addresses that didn't match the expected sequence */ \
+  X(read_us)          /* Whole read command */ \
+  X(clock_us)         /* In clock_target() */ \
+  X(sample_us)        /* In get_target_state() */ \
+  X(send_us)          /* In comms_sendb() and comms_send() */ \
+  X(stall_us)         /* Waiting for UART TX ring space, always counted */ \
+
+class read_stats_t {
+public:
+#define STATS_FIELD(name) uint32_t name;
+  STATS_TABLE(STATS_FIELD)
+#undef STATS_FIELD
+};
+
+constexpr uint8_t kStatsFields = sizeof(read_stats_t) / sizeof(uint32_t);
+
+extern read_stats_t read_stats;
+extern bool read_stats_timing;
+
+inline void read_stats_reset(void)
+{
+  memset(&read_stats, 0, sizeof(read_stats));
+}
@@ -1,11 +1,112 @@
 
 #include <stdint.h>
+#include <Arduino.h>
 #include "target.hpp"
 #include "board.hpp"
+#include "stats.hpp"
+#include "uart.hpp"
+
+read_stats_t read_stats;
+bool read_stats_timing = false;
+
+/* Compare value for the Timer1 clock engine, zero when bit-banging EXTAL */
+static uint16_t clock_compare = 0;
+
+/* Clocks per interrupt-free burst at the current clock and baud rate */
+static uint16_t clock_burst = kClockBurstSize;
+
+/* Use clock_address_unrolled() for each address of a dump */
+static bool address_unrolled = false;
+
+// Select the EXTAL clock rate in kHz, returns the rate actually used
+uint16_t set_clock_rate(uint16_t rate_khz)
+{
+  /* Stop timer and return EXTAL to the port latch, idle level is high */
+  TCCR1B = 0;
+  TCCR1A = 0;
+  digitalWrite(pin_extal, HIGH);
+
+  if(rate_khz == kClockRateLegacy)
+  {
+    clock_compare = 0;
+    return kClockRateLegacy;
+  }
+
+  if(rate_khz < kClockRateMinKhz)
+  {
+    rate_khz = kClockRateMinKhz;
+  }
+  if(rate_khz > kClockRateMaxKhz)
+  {
+    rate_khz = kClockRateMaxKhz;
+  }
+
+  /* A burst runs with interrupts disabled, so the RX ISR can't empty the
+     USART while it runs and only its two byte FIFO holds what the host
+     sends. Keep a burst within that many byte times at the current baud
+     rate; a slow clock on a fast link gets single clock bursts. */
+  uint32_t burst = (uint32_t)rate_khz * 1000UL * kUartBitsPerByte * kClockBurstBytes / uart_baud_rate();
+  if(burst < 1)
+  {
+    burst = 1;
+  }
+  if(burst > kClockBurstSize)
+  {
+    burst = kClockBurstSize;
+  }
+  clock_burst = burst;
+
+  /* Each compare match toggles OC1A, so one EXTAL period is two matches */
+  clock_compare = (F_CPU / 2000UL) / rate_khz - 1;
+  OCR1A = clock_compare;
+  TCNT1 = 0;
+
+  /* Force OC1A high to match the idle level, then switch to toggle mode */
+  TCCR1A = _BV(COM1A1) | _BV(COM1A0);
+  TCCR1C = _BV(FOC1A);
+  TCCR1A = _BV(COM1A0);
+  TCCR1B = _BV(WGM12);
+
+  return (F_CPU / 2000UL) / (clock_compare + 1);
+}
+
+// Issue EXTAL clocks from Timer1 with interrupts disabled so no edge is missed
+static void clock_target_burst(uint16_t count)
+{
+  uint16_t edges = count * 2;
+  uint8_t sreg = SREG;
+  cli();
+
+  TCNT1 = 0;
+  TIFR1 = _BV(OCF1A);
+  TCCR1B = _BV(WGM12) | _BV(CS10);
+  while(edges--)
+  {
+    while((TIFR1 & _BV(OCF1A)) == 0)
+      ;
+    TIFR1 = _BV(OCF1A);
+  }
+  TCCR1B = _BV(WGM12);
+
+  SREG = sreg;
+}
 
 // Pulse target clock pin N times
-void clock_target(int count)
+static void clock_target_pulses(int count)
 {
+  /* Timer1 engine: the clock is static between bursts, so sampling after
+     this returns happens at the same phase as with the bit-banged clock */
+  if(clock_compare)
+  {
+    while(count > 0)
+    {
+      uint16_t burst = (count > clock_burst) ? clock_burst : count;
+      clock_target_burst(burst);
+      count -= burst;
+    }
+    return;
+  }
+
   for(int i = 0; i < count; i++)
   {
     digitalWrite(pin_extal, LOW);
@@ -15,6 +116,20 @@ void clock_target(int count)
   }
 }
 
+void clock_target(int count)
+{
+  read_stats.clocks += count;
+  if(!read_stats_timing)
+  {
+    clock_target_pulses(count);
+    return;
+  }
+
+  uint32_t start = micros();
+  clock_target_pulses(count);
+  read_stats.clock_us += micros() - start;
+}
+
 // Reset target
 void reset_target(void)
 {
@@ -24,7 +139,7 @@ void reset_target(void)
 }
 
 // Sample ports B and C
-void get_target_state(target_state_t *state)
+static inline void sample_target_state(target_state_t *state)
 {
 #if 1
   state->adl = (PIND & 0xFC) | ((PINB >> 3) & 0x03);
@@ -55,5 +170,206 @@ void get_target_state(target_state_t *state)
 #endif  
 }
 
+void get_target_state(target_state_t *state)
+{
+  if(!read_stats_timing)
+  {
+    sample_target_state(state);
+    return;
+  }
+
+  uint32_t start = micros();
+  sample_target_state(state);
+  read_stats.sample_us += micros() - start;
+}
+
+
+// Select how clock_address() works for the next read. Seeks still use the
+// clock set with set_clock_rate().
+void set_address_loop(bool unrolled)
+{
+  address_unrolled = unrolled;
+}
+
+/* One address (a NOP bus cycle, 8 EXTAL clocks) in straight line code.
+   Only the samples a dump uses are taken: all of ports B and C at phase 0
+   for the address, port C at phase 1 for AH again, and port B at phase 3
+   for the data byte. Phase 2 is not sampled.
+
+   EXTAL is taken from Timer1 for the address if the clock engine is in use;
+   OC1A and the port latch are both high between clocks so there is no edge.
+   Interrupts are off for the whole address, and every EXTAL half period is
+   20 cycles, OUT included, so the clock runs at exactly 400 kHz within an
+   address. Samples are taken in the last cycles of a high half period,
+   where get_target_state() samples after clock_target(). EXTAL stays high
+   after the last rising edge for a full half period, and for however long
+   the caller takes before the next address.
+
+     cycle   0-2     IN PIND, PINB, PINC         phase 0
+             3       OUT PORTB (EXTAL low)       clock 1
+             23      OUT PORTB (EXTAL high)
+             43      OUT PORTB (EXTAL low)       clock 2, high for 18 more
+             82      IN PINC                     phase 1
+             83      OUT PORTB (EXTAL low)       clock 3, then 4 and 5
+             203     OUT PORTB (EXTAL low)       clock 6, high for 17 more
+             241-242 IN PIND, PINB               phase 3
+             243     OUT PORTB (EXTAL low)       clock 7, then 8
+             323     end, 6 INs + 8 * 40 - 3 cycles
+
+   Each OUT and IN is one cycle and extal_wait n is exactly n cycles, so
+   the IN after a shortened wait keeps the low edges 40 cycles apart.
+
+   At 2 Mbps the USART can take at most three bytes while interrupts are
+   off, so a framed read, where the host sends acknowledgements back, can
+   overrun above 1 Mbps. rx_overruns in EVENT_UART_STATS shows it. */
+static void clock_address_unrolled(uint8_t *ports)
+{
+  uint8_t hi = PORTB | _BV(kExtalPortBit);
+  uint8_t lo = hi & ~_BV(kExtalPortBit);
+  uint8_t d0, b0, c0, c1, d3, b3;
+
+  uint8_t tccr1a = TCCR1A;
+  TCCR1A = 0;
+  uint8_t sreg = SREG;
+  cli();
+#if defined(__AVR__)
+  uint8_t wait;
+  asm volatile(
+    /* Wait exactly n cycles: LDI, then 3 per DEC/BRNE pass less one for
+       the last BRNE, then NOPs for the remainder */
+    ".macro extal_wait n\n\t"
+    "ldi %[wait], (\\n) / 3\n\t"
+    "1: dec %[wait]\n\t"
+    "brne 1b\n\t"
+    ".rept (\\n) %% 3\n\t"
+    "nop\n\t"
+    ".endr\n\t"
+    ".endm\n\t"
+
+    /* One EXTAL clock, then hold it high for n more cycles */
+    ".macro extal_clock n\n\t"
+    "out %[portb], %[lo]\n\t"
+    "extal_wait 19\n\t"
+    "out %[portb], %[hi]\n\t"
+    "extal_wait \\n\n\t"
+    ".endm\n\t"
+
+    "in %[d0], %[pind]\n\t"
+    "in %[b0], %[pinb]\n\t"
+    "in %[c0], %[pinc]\n\t"
+    "extal_clock 19\n\t"
+    "extal_clock 18\n\t"
+    "in %[c1], %[pinc]\n\t"
+    "extal_clock 19\n\t"
+    "extal_clock 19\n\t"
+    "extal_clock 19\n\t"
+    "extal_clock 17\n\t"
+    "in %[d3], %[pind]\n\t"
+    "in %[b3], %[pinb]\n\t"
+    "extal_clock 19\n\t"
+    "extal_clock 19\n\t"
+
+    ".purgem extal_clock\n\t"
+    ".purgem extal_wait\n\t"
+    : [d0] "=&r" (d0), [b0] "=&r" (b0), [c0] "=&r" (c0), [c1] "=&r" (c1),
+      [d3] "=&r" (d3), [b3] "=&r" (b3), [wait] "=&d" (wait)
+    : [lo] "r" (lo), [hi] "r" (hi),
+      [portb] "I" (_SFR_IO_ADDR(PORTB)), [pinb] "I" (_SFR_IO_ADDR(PINB)),
+      [pinc] "I" (_SFR_IO_ADDR(PINC)), [pind] "I" (_SFR_IO_ADDR(PIND))
+  );
+#else
+  /* Host build, see firmware/host: the same accesses in the same order */
+  auto extal_clock = [&](uint8_t wait) {
+    PORTB = lo;
+    __builtin_avr_delay_cycles(kUnrolledHalfCycles - 1);
+    PORTB = hi;
+    __builtin_avr_delay_cycles(wait);
+  };
+  d0 = PIND;
+  b0 = PINB;
+  c0 = PINC;
+  extal_clock(19);
+  extal_clock(18);
+  c1 = PINC;
+  extal_clock(19);
+  extal_clock(19);
+  extal_clock(19);
+  extal_clock(17);
+  d3 = PIND;
+  b3 = PINB;
+  extal_clock(19);
+  extal_clock(19);
+#endif
+  SREG = sreg;
+  TCCR1A = tccr1a;
+
+  ports[0] = d0;
+  ports[1] = b0;
+  ports[2] = c0;
+  ports[3] = c1;
+  ports[4] = d3;
+  ports[5] = b3;
+}
+
+// Run the unrolled loop for one address and count it in read_stats
+static void clock_address_ports(uint8_t *ports)
+{
+  read_stats.clocks += kClocksPerAddress;
+  if(!read_stats_timing)
+  {
+    clock_address_unrolled(ports);
+    return;
+  }
+
+  uint32_t start = micros();
+  clock_address_unrolled(ports);
+  read_stats.clock_us += micros() - start;
+}
+
+// Sample and clock one address, filling in states[0], states[1].ah and states[3].adl
+void clock_address(target_state_t *states)
+{
+  if(!address_unrolled)
+  {
+    for(uint8_t i = 0; i < 4; i++)
+    {
+      get_target_state(&states[i]);
+      clock_target(2);
+    }
+    return;
+  }
+
+  uint8_t ports[kSnapshotSize];
+  clock_address_ports(ports);
+
+  /* The same decoding as get_target_state() */
+  states[0].adl = (ports[0] & 0xFC) | ((ports[1] >> 3) & 0x03);
+  states[0].ah = (ports[2] & 0x07) | ((ports[2] >> 1) & 0x08);
+  states[0].strobe = (ports[2] >> 3) & 1;
+  states[0].num = (ports[2] >> 5) & 1;
+  states[1].ah = (ports[3] & 0x07) | ((ports[3] >> 1) & 0x08);
+  states[3].adl = (ports[4] & 0xFC) | ((ports[5] >> 3) & 0x03);
+}
+
+// Clock one address and store the ports as read, see kSnapshotSize. None
+// of the decoding get_target_state() does happens here, the host does it.
+void clock_address_snapshot(uint8_t *ports)
+{
+  if(address_unrolled)
+  {
+    clock_address_ports(ports);
+    return;
+  }
+
+  ports[0] = PIND;
+  ports[1] = PINB;
+  ports[2] = PINC;
+  clock_target(2);
+  ports[3] = PINC;
+  clock_target(4);
+  ports[4] = PIND;
+  ports[5] = PINB;
+  clock_target(2);
+}
 
 /* End */
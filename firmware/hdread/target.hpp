@@ -16,9 +16,34 @@ constexpr int kExtalPulseWidthLoUs  = 10;
 constexpr int kExtalPulseWidthHiUs  = 10;
 constexpr int kNumResetClocks       = 8;        /* Seems to be fine with four */
 
+/* Timer1 clock engine. EXTAL is on OC1A (pin 9), so Timer1 in CTC mode with
+   OC1A toggling on compare generates EXTAL in hardware. A rate of zero selects
+   the original digitalWrite()/delayMicroseconds() clock. */
+constexpr uint16_t kClockRateLegacy   = 0;        /* Bit-banged EXTAL */
+constexpr uint16_t kClockRateMinKhz   = 10;       /* Below this the bit-banged clock is faster */
+constexpr uint16_t kClockRateMaxKhz   = 400;      /* 20 CPU cycles per EXTAL half period */
+constexpr uint16_t kClockBurstSize    = 256;      /* Clocks issued with interrupts disabled */
+constexpr uint8_t kClockBurstBytes    = 2;        /* Longest burst in byte times, the USART RX FIFO depth */
+constexpr uint8_t kUartBitsPerByte    = 10;       /* 8-N-1 */
+
+/* Unrolled address loop, see clock_address_unrolled(). EXTAL is toggled
+   with OUT to PORTB, so every half period is an exact number of cycles. */
+constexpr uint8_t kExtalPortBit       = 1;        /* Pin 9 is PB1 */
+constexpr uint8_t kUnrolledHalfCycles = 20;       /* CPU cycles per EXTAL half period */
+constexpr uint16_t kUnrolledRateKhz   = 400;      /* At 16 MHz */
+
 constexpr uint32_t kMemorySize      = 0x1000;   /* 4K address bus */
 constexpr uint32_t kRiotSize        = 0x80;     /* RAM, I/O, timer area */
+constexpr uint16_t kClocksPerAddress = 8;       /* Two NUM cycles per NOP */
+
+/* Port snapshot of one address from clock_address_snapshot(): PIND, PINB
+   and PINC at phase 0, PINC at phase 1, then PIND and PINB at phase 3 */
+constexpr uint8_t kSnapshotSize     = 6;
 
 void get_target_state(target_state_t *state);
+void set_address_loop(bool unrolled);
+void clock_address(target_state_t *states);
+void clock_address_snapshot(uint8_t *ports);
+uint16_t set_clock_rate(uint16_t rate_khz);
 void clock_target(int count);
 void reset_target(void);
@@ -0,0 +1,170 @@
+#include <stdint.h>
+#include <Arduino.h>
+#include <avr/interrupt.h>
+#include "uart.hpp"
+#include "stats.hpp"
+
+constexpr uint8_t kTxMask = kUartTxRingSize - 1;
+constexpr uint8_t kRxMask = kUartRxRingSize - 1;
+
+uart_stats_t uart_stats;
+
+static uint8_t tx_ring[kUartTxRingSize];
+static volatile uint8_t tx_head = 0;
+static volatile uint8_t tx_tail = 0;
+static bool tx_written = false;
+static uint32_t baud = 0;
+
+static uint8_t rx_ring[kUartRxRingSize];
+static volatile uint8_t rx_head = 0;
+static volatile uint8_t rx_tail = 0;
+
+// Move one byte from the TX ring to the USART, called when UDR0 is empty
+static inline void uart_tx_service(void)
+{
+  if(tx_head == tx_tail)
+  {
+    UCSR0B &= ~_BV(UDRIE0);
+    return;
+  }
+
+  uint8_t data = tx_ring[tx_tail];
+  tx_tail = (tx_tail + 1) & kTxMask;
+
+  /* Clear TXC0 so uart_flush() can wait for the shift register to empty */
+  UCSR0A = (UCSR0A & _BV(U2X0)) | _BV(TXC0);
+  UDR0 = data;
+}
+
+ISR(USART_UDRE_vect)
+{
+  uart_tx_service();
+}
+
+ISR(USART_RX_vect)
+{
+  bool overrun = (UCSR0A & _BV(DOR0)) != 0;
+  uint8_t data = UDR0;
+  uint8_t next = (rx_head + 1) & kRxMask;
+
+  if(overrun || next == rx_tail)
+  {
+    ++uart_stats.rx_overruns;
+  }
+
+  if(next != rx_tail)
+  {
+    rx_ring[rx_head] = data;
+    rx_head = next;
+  }
+}
+
+// Configure USART0 for 8-N-1 in double speed mode
+void uart_init(uint32_t baud_rate)
+{
+  uint16_t ubrr = (F_CPU / 4 / baud_rate - 1) / 2;
+
+  UCSR0B = 0;
+  UCSR0A = _BV(U2X0);
+  UBRR0 = ubrr;
+  UCSR0C = _BV(UCSZ01) | _BV(UCSZ00);
+  UCSR0B = _BV(RXEN0) | _BV(TXEN0) | _BV(RXCIE0);
+
+  tx_head = tx_tail = 0;
+  rx_head = rx_tail = 0;
+  tx_written = false;
+  baud = baud_rate;
+}
+
+// Get the baud rate from the last uart_init()
+uint32_t uart_baud_rate(void)
+{
+  return baud;
+}
+
+// Queue a byte for transmission, only waits when the TX ring is full
+void uart_putb(uint8_t data)
+{
+  tx_written = true;
+
+  /* Nothing queued and the data register is free, so skip the ring */
+  if(tx_head == tx_tail && (UCSR0A & _BV(UDRE0)))
+  {
+    UCSR0A = (UCSR0A & _BV(U2X0)) | _BV(TXC0);
+    UDR0 = data;
+    return;
+  }
+
+  uint8_t next = (tx_head + 1) & kTxMask;
+  if(next == tx_tail)
+  {
+    ++uart_stats.tx_stalls;
+    uint32_t start = micros();
+    while(next == tx_tail)
+    {
+      /* Interrupts are off so the ISR can't run, drain the ring by hand */
+      if((SREG & _BV(SREG_I)) == 0 && (UCSR0A & _BV(UDRE0)))
+      {
+        uart_tx_service();
+      }
+    }
+    read_stats.stall_us += micros() - start;
+  }
+
+  tx_ring[tx_head] = data;
+  tx_head = next;
+
+  uint8_t level = (tx_head - tx_tail) & kTxMask;
+  if(level > uart_stats.tx_high_water)
+  {
+    uart_stats.tx_high_water = level;
+  }
+
+  UCSR0B |= _BV(UDRIE0);
+}
+
+void uart_write(const uint8_t *data, size_t size)
+{
+  while(size--)
+  {
+    uart_putb(*data++);
+  }
+}
+
+// Get number of bytes waiting in the RX ring
+uint16_t uart_available(void)
+{
+  return (rx_head - rx_tail) & kRxMask;
+}
+
+// Get next byte from the RX ring, check uart_available() first
+uint8_t uart_getb(void)
+{
+  uint8_t data = rx_ring[rx_tail];
+  rx_tail = (rx_tail + 1) & kRxMask;
+  return data;
+}
+
+// Wait until the TX ring and USART shift register are empty
+void uart_flush(void)
+{
+  if(!tx_written)
+  {
+    return;
+  }
+
+  while((UCSR0B & _BV(UDRIE0)) || (UCSR0A & _BV(TXC0)) == 0)
+  {
+    if((SREG & _BV(SREG_I)) == 0 && (UCSR0A & _BV(UDRE0)))
+    {
+      uart_tx_service();
+    }
+  }
+}
+
+void uart_reset_stats(void)
+{
+  memset(&uart_stats, 0, sizeof(uart_stats));
+}
+
+/* End */
@@ -0,0 +1,29 @@
+#pragma once
+
+/* Interrupt driven USART0 driver. This replaces HardwareSerial, so `Serial'
+   must not be referenced anywhere in the sketch or its USART ISRs will be
+   linked in as well. */
+
+constexpr uint16_t kUartTxRingSize  = 0x100;  /* Power of two, 256 max */
+constexpr uint16_t kUartRxRingSize  = 0x40;   /* Power of two, 256 max */
+
+static_assert((kUartTxRingSize & (kUartTxRingSize - 1)) == 0 && kUartTxRingSize <= 0x100, "Bad TX ring size");
+static_assert((kUartRxRingSize & (kUartRxRingSize - 1)) == 0 && kUartRxRingSize <= 0x100, "Bad RX ring size");
+
+class uart_stats_t {
+public:
+  uint16_t tx_high_water;   /* Most bytes queued in the TX ring at once */
+  uint16_t tx_stalls;       /* Number of writes that waited for TX ring space */
+  uint16_t rx_overruns;     /* Bytes lost because the RX ring or USART overflowed */
+};
+
+extern uart_stats_t uart_stats;
+
+void uart_init(uint32_t baud_rate);
+uint32_t uart_baud_rate(void);
+void uart_putb(uint8_t data);
+void uart_write(const uint8_t *data, size_t size);
+uint16_t uart_available(void);
+uint8_t uart_getb(void);
+void uart_flush(void);
+void uart_reset_stats(void);
@@ -0,0 +1,44 @@
+#pragma once
+
+/* Just enough of the Arduino core for the sketch to build on the host.
+   Pins and timing are handled by the simulated board, see sim.hpp. */
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <avr/io.h>
+#include <avr/interrupt.h>
+
+#define HIGH                  1
+#define LOW                   0
+#define INPUT                 0
+#define OUTPUT                1
+
+#define F_CPU                 16000000UL
+
+/* Strings stay in RAM */
+#define F(s)                  (s)
+
+constexpr uint8_t A0 = 14;
+constexpr uint8_t A1 = 15;
+constexpr uint8_t A2 = 16;
+constexpr uint8_t A3 = 17;
+constexpr uint8_t A4 = 18;
+constexpr uint8_t A5 = 19;
+
+void pinMode(uint8_t pin, uint8_t mode);
+void digitalWrite(uint8_t pin, uint8_t value);
+int digitalRead(uint8_t pin);
+void delay(unsigned long ms);
+void delayMicroseconds(unsigned int us);
+unsigned long micros(void);
+unsigned long millis(void);
+
+/* avr-gcc builtin, waits exactly this many CPU cycles */
+void __builtin_avr_delay_cycles(unsigned long cycles);
+
+void setup(void);
+void loop(void);
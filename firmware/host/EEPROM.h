@@ -0,0 +1,47 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+uint8_t sim_eeprom_read(int address);
+void sim_eeprom_write(int address, uint8_t value);
+
+/* The EEPROM library, backed by the simulated board */
+class EEPROMClass {
+public:
+  uint8_t read(int address)
+  {
+    return sim_eeprom_read(address);
+  }
+
+  /* Like the real library, only bytes that change are written */
+  void update(int address, uint8_t value)
+  {
+    if(sim_eeprom_read(address) != value)
+    {
+      sim_eeprom_write(address, value);
+    }
+  }
+
+  template<typename T> T &get(int address, T &value)
+  {
+    uint8_t *data = (uint8_t *)&value;
+    for(size_t i = 0; i < sizeof(T); i++)
+    {
+      data[i] = read(address + i);
+    }
+    return value;
+  }
+
+  template<typename T> const T &put(int address, const T &value)
+  {
+    const uint8_t *data = (const uint8_t *)&value;
+    for(size_t i = 0; i < sizeof(T); i++)
+    {
+      update(address + i, data[i]);
+    }
+    return value;
+  }
+};
+
+extern EEPROMClass EEPROM;
@@ -0,0 +1,19 @@
+#pragma once
+
+#include <avr/io.h>
+
+/* Interrupt handlers are plain functions the simulated board calls */
+#define ISR(vector)           extern "C" void vector(void)
+
+extern "C" void USART_RX_vect(void);
+extern "C" void USART_UDRE_vect(void);
+
+static inline void cli(void)
+{
+  SREG = SREG & ~_BV(SREG_I);
+}
+
+static inline void sei(void)
+{
+  SREG = SREG | _BV(SREG_I);
+}
@@ -0,0 +1,115 @@
+#pragma once
+
+#include <stdint.h>
+
+/* The ATmega328P registers the sketch uses. Every access goes to the
+   simulated board, which brings the peripherals up to date first. */
+
+enum sim_register_id {
+  REG_PORTB,
+  REG_PINB,
+  REG_PINC,
+  REG_PIND,
+  REG_TCCR1A,
+  REG_TCCR1B,
+  REG_TCCR1C,
+  REG_TIFR1,
+  REG_OCR1A,
+  REG_TCNT1,
+  REG_UDR0,
+  REG_UCSR0A,
+  REG_UCSR0B,
+  REG_UCSR0C,
+  REG_UBRR0,
+  REG_SREG,
+};
+
+uint16_t sim_read(sim_register_id id);
+void sim_write(sim_register_id id, uint16_t value);
+
+class sim_register_t {
+public:
+  constexpr sim_register_t(sim_register_id id) : id_(id) {}
+
+  operator uint16_t() const
+  {
+    return sim_read(id_);
+  }
+
+  const sim_register_t &operator=(uint16_t value) const
+  {
+    sim_write(id_, value);
+    return *this;
+  }
+
+  const sim_register_t &operator|=(uint16_t value) const
+  {
+    sim_write(id_, sim_read(id_) | value);
+    return *this;
+  }
+
+  const sim_register_t &operator&=(uint16_t value) const
+  {
+    sim_write(id_, sim_read(id_) & value);
+    return *this;
+  }
+
+private:
+  sim_register_id id_;
+};
+
+constexpr sim_register_t PORTB(REG_PORTB);
+constexpr sim_register_t PINB(REG_PINB);
+constexpr sim_register_t PINC(REG_PINC);
+constexpr sim_register_t PIND(REG_PIND);
+constexpr sim_register_t TCCR1A(REG_TCCR1A);
+constexpr sim_register_t TCCR1B(REG_TCCR1B);
+constexpr sim_register_t TCCR1C(REG_TCCR1C);
+constexpr sim_register_t TIFR1(REG_TIFR1);
+constexpr sim_register_t OCR1A(REG_OCR1A);
+constexpr sim_register_t TCNT1(REG_TCNT1);
+constexpr sim_register_t UDR0(REG_UDR0);
+constexpr sim_register_t UCSR0A(REG_UCSR0A);
+constexpr sim_register_t UCSR0B(REG_UCSR0B);
+constexpr sim_register_t UCSR0C(REG_UCSR0C);
+constexpr sim_register_t UBRR0(REG_UBRR0);
+constexpr sim_register_t SREG(REG_SREG);
+
+#define _BV(bit)              (1 << (bit))
+
+/* PORTB */
+#define PORTB1                1
+
+/* TCCR1A */
+#define COM1A1                7
+#define COM1A0                6
+
+/* TCCR1B */
+#define WGM12                 3
+#define CS10                  0
+
+/* TCCR1C */
+#define FOC1A                 7
+
+/* TIFR1 */
+#define OCF1A                 1
+
+/* UCSR0A */
+#define RXC0                  7
+#define TXC0                  6
+#define UDRE0                 5
+#define DOR0                  3
+#define U2X0                  1
+
+/* UCSR0B */
+#define RXCIE0                7
+#define UDRIE0                5
+#define RXEN0                 4
+#define TXEN0                 3
+
+/* UCSR0C */
+#define UCSZ01                2
+#define UCSZ00                1
+
+/* SREG */
+#define SREG_I                7
@@ -0,0 +1,141 @@
+/*
+  Host build of the HD6805V1 reader firmware
+
+  Runs the sketch against a simulated board, with USART0 on a
+  pseudo-terminal that the utility can use as its serial port:
+
+    ./hdsim --profile rom.bin
+    hdread --port /dev/pts/N read dump.bin
+*/
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <termios.h>
+#include <unistd.h>
+#include <string>
+#include <vector>
+#include "Arduino.h"
+#include "sim.hpp"
+#include "profile.hpp"
+
+constexpr uint32_t kProfileLimit = 16;    /* Functions listed after each command */
+
+static void usage(const char *name)
+{
+  printf("Usage: %s [--profile] [--count commands] [--entry address] rom.bin\n", name);
+  printf("  --profile   Print the virtual time taken by firmware functions after each command\n");
+  printf("  --count     Exit after running this many commands\n");
+  printf("  --entry     Address the output sequence starts from (default: reset vector)\n");
+}
+
+static bool load_rom(const char *filename, std::vector<uint8_t> &rom)
+{
+  FILE *fd = fopen(filename, "rb");
+  if(!fd)
+  {
+    printf("Error: Can't open file `%s' for reading.\n", filename);
+    return false;
+  }
+  rom.assign(HD6805_ROM_SIZE, 0xFF);
+  fread(rom.data(), 1, rom.size(), fd);
+  fclose(fd);
+  return true;
+}
+
+// Open a pseudo-terminal for the host, raw so no bytes are translated
+static int open_pty(void)
+{
+  int master = posix_openpt(O_RDWR | O_NOCTTY | O_NONBLOCK);
+  if(master < 0 || grantpt(master) != 0 || unlockpt(master) != 0)
+  {
+    printf("Error: Couldn't create a pseudo-terminal (%s).\n", strerror(errno));
+    return -1;
+  }
+
+  /* Keeping the slave open means reads don't fail before the host attaches */
+  const char *name = ptsname(master);
+  int slave = open(name, O_RDWR | O_NOCTTY);
+  struct termios settings;
+  if(slave < 0 || tcgetattr(slave, &settings) != 0)
+  {
+    printf("Error: Couldn't open `%s'.\n", name);
+    close(master);
+    return -1;
+  }
+  cfmakeraw(&settings);
+  tcsetattr(slave, TCSANOW, &settings);
+
+  printf("Status: Target can attach to %s.\n", name);
+  fflush(stdout);
+  return master;
+}
+
+int main(int argc, char *argv[])
+{
+  bool profile = false;
+  long count = -1;
+  long entry = -1;
+  const char *filename = nullptr;
+
+  for(int i = 1; i < argc; i++)
+  {
+    if(!strcmp(argv[i], "--profile"))
+    {
+      profile = true;
+    }
+    else if(!strcmp(argv[i], "--count") && i + 1 < argc)
+    {
+      count = strtol(argv[++i], NULL, 0);
+    }
+    else if(!strcmp(argv[i], "--entry") && i + 1 < argc)
+    {
+      entry = strtol(argv[++i], NULL, 0) & (HD6805_ROM_SIZE - 1);
+    }
+    else if(argv[i][0] != '-' && !filename)
+    {
+      filename = argv[i];
+    }
+    else
+    {
+      usage(argv[0]);
+      return 1;
+    }
+  }
+
+  std::vector<uint8_t> rom;
+  if(!filename)
+  {
+    usage(argv[0]);
+    return 1;
+  }
+  if(!load_rom(filename, rom))
+  {
+    return 1;
+  }
+
+  int fd = open_pty();
+  if(fd < 0)
+  {
+    return 1;
+  }
+  sim_init(rom, fd);
+  sim_target().entry = entry;
+
+  /* Each pass through loop() runs one command from the host */
+  setup();
+  profile_reset();
+  for(long commands = 0; count < 0 || commands < count; commands++)
+  {
+    loop();
+    sim_flush();
+    if(profile)
+    {
+      profile_report(kProfileLimit);
+    }
+  }
+  return 0;
+}
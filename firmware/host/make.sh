@@ -0,0 +1,8 @@
+#!/bin/sh
+# Host build of the firmware, see main.cpp. Only the sketch is instrumented
+# for profiling, the simulator and everything in this directory are not.
+# -fpermissive is what the Arduino toolchain builds sketches with.
+HOST=$(pwd)
+g++ ../hdread/board.cpp ../hdread/cmds.cpp ../hdread/comms.cpp ../hdread/frame.cpp ../hdread/target.cpp ../hdread/uart.cpp -x c++ ../hdread/hdread.ino -x none \
+    sim.cpp profile.cpp main.cpp ../../utility/hd6805.cpp -o hdsim -I"$HOST" -I../../utility -std=gnu++17 -fpermissive -no-pie -ldl \
+    -finstrument-functions -finstrument-functions-exclude-file-list="$HOST"/,sim.cpp,profile.cpp,main.cpp,utility/,/usr/
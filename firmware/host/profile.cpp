@@ -0,0 +1,152 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <dlfcn.h>
+#include <unistd.h>
+#include <algorithm>
+#include <map>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "profile.hpp"
+#include "sim.hpp"
+
+#define NO_INSTRUMENT         __attribute__((no_instrument_function))
+
+class profile_entry_t {
+public:
+  uint32_t calls = 0;
+  uint64_t cycles = 0;        /* Including callees */
+  uint64_t self = 0;          /* Excluding callees */
+  uint64_t idle = 0;          /* Waiting for the host */
+};
+
+class profile_frame_t {
+public:
+  void *function;
+  uint64_t start;
+  uint64_t idle_start;
+  uint64_t children;
+};
+
+static std::unordered_map<void *, profile_entry_t> entries;
+static std::vector<profile_frame_t> stack;
+static uint64_t report_start = 0;
+static uint64_t report_idle_start = 0;
+
+extern "C" NO_INSTRUMENT void __cyg_profile_func_enter(void *function, void *caller)
+{
+  stack.push_back({function, sim_cycles(), sim_idle_cycles(), 0});
+}
+
+extern "C" NO_INSTRUMENT void __cyg_profile_func_exit(void *function, void *caller)
+{
+  if(stack.empty())
+  {
+    return;
+  }
+  profile_frame_t frame = stack.back();
+  stack.pop_back();
+
+  uint64_t cycles = sim_cycles() - frame.start;
+  profile_entry_t &entry = entries[frame.function];
+  ++entry.calls;
+  entry.cycles += cycles;
+  entry.self += cycles - frame.children;
+  entry.idle += sim_idle_cycles() - frame.idle_start;
+  if(!stack.empty())
+  {
+    stack.back().children += cycles;
+  }
+}
+
+/* Function names from the symbol table, static functions aren't visible to dladdr() */
+static NO_INSTRUMENT const char *profile_name(void *function)
+{
+  static std::map<uintptr_t, std::string> symbols;
+  static uintptr_t base = 0;
+
+  if(symbols.empty())
+  {
+    Dl_info info;
+    if(dladdr((void *)profile_name, &info) && info.dli_fname)
+    {
+      base = (uintptr_t)info.dli_fbase;
+    }
+
+    /* The shell popen() runs has its own /proc/self */
+    char path[0x200] = {0};
+    readlink("/proc/self/exe", path, sizeof(path) - 1);
+    std::string command = std::string("nm -C --defined-only '") + path + "' 2>/dev/null";
+
+    FILE *pipe = popen(command.c_str(), "r");
+    char line[0x200];
+    while(pipe && fgets(line, sizeof(line), pipe))
+    {
+      char type;
+      unsigned long address;
+      int offset;
+      if(sscanf(line, "%lx %c %n", &address, &type, &offset) < 2 || (type != 't' && type != 'T'))
+      {
+        continue;
+      }
+      std::string name(line + offset);
+      name = name.substr(0, name.find_first_of("(\n"));
+      symbols[address] = name;
+    }
+    if(pipe)
+    {
+      pclose(pipe);
+    }
+  }
+
+  /* Position independent executables are relocated by the load address */
+  for(uintptr_t address : {(uintptr_t)function, (uintptr_t)function - base})
+  {
+    auto symbol = symbols.find(address);
+    if(symbol != symbols.end())
+    {
+      return symbol->second.c_str();
+    }
+  }
+
+  static char unknown[0x20];
+  snprintf(unknown, sizeof(unknown), "%p", function);
+  return unknown;
+}
+
+static NO_INSTRUMENT double to_us(uint64_t cycles)
+{
+  return (double)cycles / kSimCyclesPerUs;
+}
+
+void profile_report(uint32_t limit)
+{
+  std::vector<std::pair<void *, profile_entry_t>> sorted(entries.begin(), entries.end());
+  std::sort(sorted.begin(), sorted.end(), [](const auto &a, const auto &b) {
+    return a.second.cycles > b.second.cycles;
+  });
+
+  uint64_t cycles = sim_cycles() - report_start;
+  uint64_t idle = sim_idle_cycles() - report_idle_start;
+  printf("Result: %.1f us, %.1f us of it waiting for the host.\n", to_us(cycles), to_us(idle));
+  printf("Result: %-28s %8s %14s %14s %14s\n", "Function", "Calls", "Total us", "Self us", "Waiting us");
+  for(uint32_t i = 0; i < sorted.size() && i < limit; i++)
+  {
+    const profile_entry_t &entry = sorted[i].second;
+    printf("Result: %-28s %8u %14.1f %14.1f %14.1f\n", profile_name(sorted[i].first),
+      entry.calls, to_us(entry.cycles), to_us(entry.self), to_us(entry.idle));
+  }
+  fflush(stdout);
+  profile_reset();
+}
+
+void profile_reset(void)
+{
+  entries.clear();
+  report_start = sim_cycles();
+  report_idle_start = sim_idle_cycles();
+}
+
+/* End */
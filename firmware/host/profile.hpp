@@ -0,0 +1,12 @@
+#pragma once
+
+#include <stdint.h>
+
+/* Virtual time spent in each firmware function. The firmware is built
+   with -finstrument-functions, so every function entry and exit is seen
+   here without changing the sketch. Times are inclusive of callees, with
+   the time spent idle waiting for the host shown separately. */
+
+/* Print the functions that took the most virtual time, then start over */
+void profile_report(uint32_t limit);
+void profile_reset(void);
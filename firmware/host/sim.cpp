@@ -0,0 +1,611 @@
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <poll.h>
+#include <unistd.h>
+#include <chrono>
+#include <deque>
+#include <memory>
+#include "Arduino.h"
+#include "EEPROM.h"
+#include "sim.hpp"
+
+/* Shield wiring, see board.hpp */
+constexpr uint8_t kPinResN    = 8;
+constexpr uint8_t kPinExtal   = 9;
+
+constexpr uint8_t kRxFifoSize = 2;        /* USART receive buffer */
+constexpr size_t kTxFlushSize = 0x100;    /* Send to the host in chunks this size */
+
+EEPROMClass EEPROM;
+
+class sim_board_t {
+public:
+  uint64_t cycles = 0;
+  uint64_t idle_cycles = 0;
+  uint16_t idle_calls = 0;
+  uint8_t sreg = _BV(SREG_I);             /* The Arduino core enables interrupts before setup() */
+
+  std::unique_ptr<HD6805Model> target;
+  uint8_t portb = 0;                      /* Pins 8-13 */
+  uint8_t latch_extal = 0;
+  uint8_t extal = 0;
+
+  /* Timer1 */
+  uint8_t tccr1a = 0;
+  uint8_t tccr1b = 0;
+  uint16_t ocr1a = 0;
+  uint16_t tcnt1 = 0;
+  bool ocf1a = false;
+  uint8_t oc1a = 0;
+  uint64_t next_match = 0;
+
+  /* USART0 */
+  int fd = -1;
+  uint8_t ucsr0a = 0;
+  uint8_t ucsr0b = 0;
+  uint8_t ucsr0c = 0;
+  uint16_t ubrr0 = 0;
+  uint32_t byte_cycles = 1;
+  bool udr_full = false;
+  uint8_t udr = 0;
+  bool tx_active = false;
+  uint64_t tx_shift_end = 0;
+  bool txc = false;
+  std::deque<uint8_t> rx_fifo;
+  std::deque<uint8_t> rx_line;            /* Sent by the host, still on the wire */
+  uint64_t rx_next_arrival = 0;
+  bool dor = false;
+  uint64_t next_poll = 0;
+  std::vector<uint8_t> tx_out;
+
+  uint8_t eeprom[kSimEepromSize];
+};
+
+static sim_board_t board;
+
+static void sim_advance(uint64_t count);
+
+void sim_init(const std::vector<uint8_t> &rom, int fd)
+{
+  board.target = std::make_unique<HD6805Model>(rom);
+  board.fd = fd;
+  memset(board.eeprom, 0xFF, sizeof(board.eeprom));
+}
+
+uint64_t sim_cycles(void)
+{
+  return board.cycles;
+}
+
+uint64_t sim_idle_cycles(void)
+{
+  return board.idle_cycles;
+}
+
+HD6805Model &sim_target(void)
+{
+  return *board.target;
+}
+
+/*-----------------------------------------------------------*/
+/* Host connection */
+/*-----------------------------------------------------------*/
+
+void sim_flush(void)
+{
+  const uint8_t *data = board.tx_out.data();
+  size_t size = board.tx_out.size();
+
+  while(size)
+  {
+    ssize_t actual = write(board.fd, data, size);
+    if(actual < 0)
+    {
+      if(errno != EAGAIN && errno != EINTR)
+      {
+        break;
+      }
+      struct pollfd entry = {board.fd, POLLOUT, 0};
+      poll(&entry, 1, 100);
+      continue;
+    }
+    data += actual;
+    size -= actual;
+  }
+  board.tx_out.clear();
+}
+
+// Put whatever the host has sent on the wire, arriving one byte time apart
+static void sim_poll_host(int timeout_ms)
+{
+  uint8_t buffer[0x100];
+  struct pollfd entry = {board.fd, POLLIN, 0};
+
+  if(poll(&entry, 1, timeout_ms) <= 0)
+  {
+    return;
+  }
+  ssize_t size = read(board.fd, buffer, sizeof(buffer));
+  if(size <= 0)
+  {
+    return;
+  }
+  if(board.rx_line.empty() && board.rx_next_arrival < board.cycles + board.byte_cycles)
+  {
+    board.rx_next_arrival = board.cycles + board.byte_cycles;
+  }
+  board.rx_line.insert(board.rx_line.end(), buffer, buffer + size);
+}
+
+/* The sketch has been spinning on a delay or millis() with nothing to
+   send, so it is waiting for the host. Wait in real time for it, and
+   let the virtual clock follow, so timeouts still work. */
+static void sim_idle(uint64_t count)
+{
+  sim_flush();
+
+  auto start = std::chrono::steady_clock::now();
+  struct pollfd entry = {board.fd, POLLIN, 0};
+  poll(&entry, 1, 1);
+  uint64_t elapsed = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count();
+
+  elapsed *= kSimCyclesPerUs;
+  if(elapsed < count)
+  {
+    elapsed = count;
+  }
+
+  /* Anything the host sent arrives at the end of the wait. Reading it
+     first would deliver it while the sketch can't run, and overflow the
+     RX ring at high baud rates. */
+  board.idle_cycles += elapsed;
+  board.next_poll = board.cycles + elapsed;
+  sim_advance(elapsed);
+}
+
+/*-----------------------------------------------------------*/
+/* Peripherals */
+/*-----------------------------------------------------------*/
+
+// Track the EXTAL line, the target is clocked on each rising edge
+static void sim_update_extal(void)
+{
+  bool timer_output = board.tccr1a & (_BV(COM1A1) | _BV(COM1A0));
+  uint8_t level = timer_output ? board.oc1a : board.latch_extal;
+
+  if(level && !board.extal)
+  {
+    board.target->clock(1);
+  }
+  board.extal = level;
+}
+
+// Compare output action for a match, or a forced one with FOC1A
+static void sim_timer_compare(void)
+{
+  switch(board.tccr1a & (_BV(COM1A1) | _BV(COM1A0)))
+  {
+    case _BV(COM1A0):
+      board.oc1a ^= 1;
+      break;
+
+    case _BV(COM1A1):
+      board.oc1a = 0;
+      break;
+
+    case _BV(COM1A1) | _BV(COM1A0):
+      board.oc1a = 1;
+      break;
+  }
+  sim_update_extal();
+}
+
+static bool sim_timer_running(void)
+{
+  return board.tccr1b & _BV(CS10);
+}
+
+static void sim_update_timer(void)
+{
+  while(sim_timer_running() && board.cycles >= board.next_match)
+  {
+    board.ocf1a = true;
+    sim_timer_compare();
+    board.next_match += board.ocr1a + 1;
+  }
+}
+
+static void sim_update_usart(void)
+{
+  /* Transmit, the data register moves to the shift register when it empties */
+  if(board.tx_active && board.cycles >= board.tx_shift_end)
+  {
+    if(board.udr_full)
+    {
+      board.tx_out.push_back(board.udr);
+      board.tx_shift_end += board.byte_cycles;
+      board.udr_full = false;
+    }
+    else
+    {
+      board.tx_active = false;
+      board.txc = true;
+    }
+  }
+  if(board.tx_out.size() >= kTxFlushSize)
+  {
+    sim_flush();
+  }
+
+  /* Receive */
+  if(board.cycles >= board.next_poll)
+  {
+    sim_poll_host(0);
+    board.next_poll = board.cycles + kSimPollCycles;
+  }
+  while(!board.rx_line.empty() && board.cycles >= board.rx_next_arrival)
+  {
+    if(board.rx_fifo.size() < kRxFifoSize)
+    {
+      board.rx_fifo.push_back(board.rx_line.front());
+    }
+    else
+    {
+      board.dor = true;
+    }
+    board.rx_line.pop_front();
+    board.rx_next_arrival += board.byte_cycles;
+  }
+}
+
+static void sim_service(void);
+
+static void sim_advance(uint64_t count)
+{
+  uint64_t end = board.cycles + count;
+
+  /* Step through byte boundaries so no USART interrupt is missed */
+  while(board.cycles < end)
+  {
+    uint64_t step = end - board.cycles;
+    if(step > board.byte_cycles)
+    {
+      step = board.byte_cycles;
+    }
+    board.cycles += step;
+    sim_update_timer();
+    sim_update_usart();
+    sim_service();
+  }
+}
+
+// Run any interrupt that is pending and enabled
+static void sim_service(void)
+{
+  while(board.sreg & _BV(SREG_I))
+  {
+    void (*vector)(void) = nullptr;
+    if((board.ucsr0b & _BV(RXCIE0)) && !board.rx_fifo.empty())
+    {
+      vector = USART_RX_vect;
+    }
+    else if((board.ucsr0b & _BV(UDRIE0)) && !board.udr_full)
+    {
+      vector = USART_UDRE_vect;
+    }
+    if(!vector)
+    {
+      return;
+    }
+
+    board.sreg &= ~_BV(SREG_I);
+    sim_advance(kSimInterruptCycles);
+    vector();
+    board.sreg |= _BV(SREG_I);
+  }
+}
+
+// The sketch is waiting, count is how long it asked for
+static void sim_wait(uint64_t count)
+{
+  bool busy = board.tx_active || board.udr_full || (board.ucsr0b & _BV(UDRIE0)) || !board.rx_line.empty();
+  if(++board.idle_calls > kSimIdleCalls && !busy)
+  {
+    sim_idle(count);
+    return;
+  }
+  sim_advance(count);
+}
+
+/*-----------------------------------------------------------*/
+/* Registers */
+/*-----------------------------------------------------------*/
+
+// Ports B, C and D as wired to the target, see get_target_state()
+static uint8_t sim_read_port(sim_register_id id)
+{
+  bus_state state;
+  board.target->sample(state);
+
+  switch(id)
+  {
+    case REG_PINB:
+      return (state.adl & 0x03) << 3;
+
+    case REG_PINC:
+      return (state.ah & 0x07) | (state.strobe << 3) | ((state.ah & 0x08) << 1) | (state.num << 5);
+
+    default:
+      return (state.adl & 0xFC) | 0x03;
+  }
+}
+
+uint16_t sim_read(sim_register_id id)
+{
+  sim_advance(kSimIoCycles);
+
+  switch(id)
+  {
+    case REG_PORTB:
+      return board.portb;
+
+    case REG_PINB:
+    case REG_PINC:
+    case REG_PIND:
+      board.idle_calls = 0;
+      return sim_read_port(id);
+
+    case REG_TCCR1A:
+      return board.tccr1a;
+
+    case REG_TCCR1B:
+      return board.tccr1b;
+
+    case REG_TIFR1:
+      /* Nothing else happens while the sketch polls for a match, so skip to it */
+      if(!board.ocf1a && sim_timer_running())
+      {
+        sim_advance(board.next_match - board.cycles);
+      }
+      return board.ocf1a ? _BV(OCF1A) : 0;
+
+    case REG_OCR1A:
+      return board.ocr1a;
+
+    case REG_UDR0:
+      {
+        board.idle_calls = 0;
+        uint8_t data = 0;
+        if(!board.rx_fifo.empty())
+        {
+          data = board.rx_fifo.front();
+          board.rx_fifo.pop_front();
+        }
+        board.dor = false;
+        return data;
+      }
+
+    case REG_UCSR0A:
+      return (board.rx_fifo.empty() ? 0 : _BV(RXC0)) |
+             (board.txc ? _BV(TXC0) : 0) |
+             (board.udr_full ? 0 : _BV(UDRE0)) |
+             (board.dor ? _BV(DOR0) : 0) |
+             (board.ucsr0a & _BV(U2X0));
+
+    case REG_UCSR0B:
+      return board.ucsr0b;
+
+    case REG_UCSR0C:
+      return board.ucsr0c;
+
+    case REG_UBRR0:
+      return board.ubrr0;
+
+    case REG_SREG:
+      return board.sreg;
+
+    default:
+      return 0;
+  }
+}
+
+static void sim_set_baud_rate(void)
+{
+  uint32_t divider = (board.ucsr0a & _BV(U2X0)) ? 8 : 16;
+  board.byte_cycles = 10 * divider * (board.ubrr0 + 1);
+}
+
+// Drive RES_N and EXTAL from the pin 8 and 9 latches
+static void sim_update_portb(uint8_t value)
+{
+  board.portb = value;
+  board.target->set_reset((value & (1 << (kPinResN - 8))) == 0);
+  board.latch_extal = (value >> (kPinExtal - 8)) & 1;
+  sim_update_extal();
+}
+
+void sim_write(sim_register_id id, uint16_t value)
+{
+  sim_advance(kSimIoCycles);
+
+  switch(id)
+  {
+    case REG_PORTB:
+      sim_update_portb(value);
+      break;
+
+    case REG_TCCR1A:
+      board.tccr1a = value;
+      sim_update_extal();
+      break;
+
+    case REG_TCCR1B:
+      if(!sim_timer_running() && (value & _BV(CS10)))
+      {
+        board.idle_calls = 0;
+        board.next_match = board.cycles + board.ocr1a + 1 - board.tcnt1;
+      }
+      board.tccr1b = value;
+      break;
+
+    case REG_TCCR1C:
+      if(value & _BV(FOC1A))
+      {
+        sim_timer_compare();
+      }
+      break;
+
+    case REG_TIFR1:
+      if(value & _BV(OCF1A))
+      {
+        board.ocf1a = false;
+      }
+      break;
+
+    case REG_OCR1A:
+      board.ocr1a = value;
+      break;
+
+    case REG_TCNT1:
+      board.tcnt1 = value;
+      if(sim_timer_running())
+      {
+        board.next_match = board.cycles + board.ocr1a + 1 - value;
+      }
+      break;
+
+    case REG_UDR0:
+      board.idle_calls = 0;
+      if(!board.tx_active)
+      {
+        board.tx_out.push_back(value);
+        board.tx_shift_end = board.cycles + board.byte_cycles;
+        board.tx_active = true;
+      }
+      else
+      {
+        /* Writing a full data register overwrites it, as on the real part */
+        board.udr = value;
+        board.udr_full = true;
+      }
+      break;
+
+    case REG_UCSR0A:
+      board.ucsr0a = value & _BV(U2X0);
+      if(value & _BV(TXC0))
+      {
+        board.txc = false;
+      }
+      sim_set_baud_rate();
+      break;
+
+    case REG_UCSR0B:
+      board.ucsr0b = value;
+      break;
+
+    case REG_UCSR0C:
+      board.ucsr0c = value;
+      break;
+
+    case REG_UBRR0:
+      board.ubrr0 = value;
+      sim_set_baud_rate();
+      break;
+
+    case REG_SREG:
+      board.sreg = value;
+      break;
+
+    default:
+      break;
+  }
+
+  /* Writes can enable an interrupt that is already pending */
+  sim_service();
+}
+
+/*-----------------------------------------------------------*/
+/* Arduino core */
+/*-----------------------------------------------------------*/
+
+void pinMode(uint8_t pin, uint8_t mode)
+{
+}
+
+void digitalWrite(uint8_t pin, uint8_t value)
+{
+  sim_advance(kSimDigitalWriteCycles);
+  board.idle_calls = 0;
+
+  if(pin >= 8 && pin <= 13)
+  {
+    uint8_t mask = 1 << (pin - 8);
+    sim_update_portb(value ? board.portb | mask : board.portb & ~mask);
+  }
+}
+
+int digitalRead(uint8_t pin)
+{
+  sim_advance(kSimDigitalWriteCycles);
+  board.idle_calls = 0;
+
+  /* Port B on pins 11, 12 and 2-7, port C on A0-A5 */
+  if(pin == 11 || pin == 12)
+  {
+    return (sim_read_port(REG_PINB) >> (pin - 8)) & 1;
+  }
+  if(pin >= 2 && pin <= 7)
+  {
+    return (sim_read_port(REG_PIND) >> pin) & 1;
+  }
+  if(pin >= A0 && pin <= A5)
+  {
+    return (sim_read_port(REG_PINC) >> (pin - A0)) & 1;
+  }
+  return 0;
+}
+
+void delay(unsigned long ms)
+{
+  sim_wait((uint64_t)ms * 1000 * kSimCyclesPerUs);
+}
+
+void delayMicroseconds(unsigned int us)
+{
+  sim_wait((uint64_t)us * kSimCyclesPerUs);
+}
+
+void __builtin_avr_delay_cycles(unsigned long cycles)
+{
+  sim_advance(cycles);
+}
+
+unsigned long micros(void)
+{
+  sim_wait(kSimMillisCycles);
+  return board.cycles / kSimCyclesPerUs;
+}
+
+unsigned long millis(void)
+{
+  sim_wait(kSimMillisCycles);
+  return board.cycles / (1000 * kSimCyclesPerUs);
+}
+
+/*-----------------------------------------------------------*/
+/* EEPROM */
+/*-----------------------------------------------------------*/
+
+uint8_t sim_eeprom_read(int address)
+{
+  return board.eeprom[address % kSimEepromSize];
+}
+
+void sim_eeprom_write(int address, uint8_t value)
+{
+  sim_advance(kSimEepromWriteCycles);
+  board.eeprom[address % kSimEepromSize] = value;
+}
+
+/* End */
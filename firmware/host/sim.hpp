@@ -0,0 +1,39 @@
+#pragma once
+
+#include <stdint.h>
+#include <vector>
+#include "hd6805.hpp"
+
+/* Simulated reader board for the host build of the firmware. The sketch
+   runs unchanged: its register accesses, pin writes and delays all land
+   here and advance a virtual clock counted in ATmega328P cycles. Code in
+   between costs nothing, so the clock measures time spent waiting on the
+   target, the UART and the host, which is what dominates on hardware.
+
+   The target is an HD6805Model wired to ports B, C and D the way the
+   shield is, EXTAL is driven either from the pin 9 latch or from Timer1
+   OC1A, and USART0 is connected to a file descriptor with the timing of
+   the programmed baud rate. */
+
+constexpr uint32_t kSimCyclesPerUs      = 16;       /* 16 MHz */
+constexpr uint32_t kSimIoCycles         = 1;        /* IN/OUT, a register access */
+constexpr uint32_t kSimDigitalWriteCycles = 54;     /* Arduino core digitalWrite(), roughly */
+constexpr uint32_t kSimMillisCycles     = 30;       /* millis()/micros() with interrupts off */
+constexpr uint32_t kSimInterruptCycles  = 20;       /* Vector, register saves and RETI */
+constexpr uint32_t kSimEepromWriteCycles = 3300 * kSimCyclesPerUs;  /* 3.3 ms per byte */
+constexpr uint16_t kSimEepromSize       = 0x400;
+constexpr uint16_t kSimIdleCalls        = 32;       /* Delays in a row before the sketch is idle */
+constexpr uint32_t kSimPollCycles       = 1024;     /* How often to check for host data */
+
+/* Connect the board to a target with this ROM, and USART0 to fd */
+void sim_init(const std::vector<uint8_t> &rom, int fd);
+
+/* Send anything the USART has transmitted */
+void sim_flush(void);
+
+/* Virtual time since power on, and how much of it was spent idle waiting for the host */
+uint64_t sim_cycles(void);
+uint64_t sim_idle_cycles(void);
+
+/* The simulated target, to change its settings */
+HD6805Model &sim_target(void);
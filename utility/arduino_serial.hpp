@@ -1,36 +1,36 @@
 
 #pragma once
 
-#include "winserial.hpp"
+#include "serial.hpp"
 
 class ArduinoSerialPort : public SerialPort
 {
 public:
-    bool openArduino(int com_port, int com_baud_rate)
+    bool openArduino(int com_port, int com_baud_rate, const string &com_device = "", bool reset = true)
     {
-        if(com_port == -1)
+        if(!com_device.empty())
         {
-            if(!scan(&com_port, NULL))
+            printf("Status: Attempting to open %s.\n", com_device.c_str());
+            if(!open(com_device.c_str(), com_baud_rate))
             {
-                printf("Status: Couldn't find a COM port.\n");
+                printf("Error: Couldn't open serial port.\n");
+                return false;
             }
-            else
+        }
+        else
+        {
+            if(!openNumberedPort(com_port, com_baud_rate))
             {
-                printf("Status: Found port COM%d.\n", com_port);
+                return false;
             }
         }
 
-        printf("Status: Attempting to open COM%d.\n", com_port);
-
-        if(!open(com_port, com_baud_rate))
+        /* Reset Arduino */
+        if(reset)
         {
-            printf("Error: Couldn't open serial port.\n");
-            return false;
+            printf("Status: Waiting for Arduino to reboot. \n");
+            resetArduino();
         }
-
-        /* Reset Arduino */
-        printf("Status: Waiting for Arduino to reboot. \n");
-        resetArduino();
         return true;
     }
 
@@ -50,13 +50,41 @@ public:
         flush_rx_queue();
         flush_tx_queue();
 
-        /* Drive DTR# low for 1ms, Arduino reset pulse happens within first 250us */
-        set_dtr(true);
-        Sleep(1);
+        /* Release DTR# long enough for the coupling capacitor to charge, then
+           pull it low for the reset edge and leave it there. Reopening the
+           port asserts DTR# again, which would reset a second time if it
+           was left high. The timing is the same as avrdude's. */
         set_dtr(false);
+        sleep_ms(250);
+        set_dtr(true);
+        sleep_ms(50);
 
         /* Wait for Arduino to boot after reset is relesaed */
-        Sleep(delay_ms);
+        sleep_ms(delay_ms);
     }
-};
 
+private:
+    bool openNumberedPort(int com_port, int com_baud_rate)
+    {
+        if(com_port == -1)
+        {
+            if(!scan(&com_port, NULL))
+            {
+                printf("Status: Couldn't find a COM port.\n");
+            }
+            else
+            {
+                printf("Status: Found port %s.\n", com_port_name(com_port).c_str());
+            }
+        }
+
+        printf("Status: Attempting to open %s.\n", com_port_name(com_port).c_str());
+
+        if(!open(com_port, com_baud_rate))
+        {
+            printf("Error: Couldn't open serial port.\n");
+            return false;
+        }
+        return true;
+    }
+};
@@ -1,12 +1,31 @@
 
 #pragma once
 
-#include "winserial.hpp"
-#include "arduino_serial.hpp"
+#include <string.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <memory>
+#include "phases.hpp"
+#include "transport.hpp"
+#include "../firmware/hdread/events.hpp"
+#include "../firmware/hdread/stats.hpp"
 
 #define TEXT_COLOR_NORMAL       0x07
 #define TEXT_COLOR_TARGET       0x0A
 
+/* Full bus state for an address the target didn't expect (compact read mode) */
+struct read_exception
+{
+    uint32_t offset;        /* Position of the data byte in the received stream */
+    uint16_t address;
+    uint8_t ah;
+    uint8_t adl;
+    uint8_t ah2;
+    uint8_t data;
+};
+
 class command_context
 {
 public:
@@ -29,6 +48,16 @@ public:
     /* Bulk data read back from the target */
     uint8_t *rx_buffer;
     size_t rx_size;
+    size_t rx_received;
+
+    /* Read data comes in frames, anything that looks like one otherwise is noise */
+    bool framed;
+
+    /* Address exceptions reported by the target */
+    vector<read_exception> exceptions;
+
+    /* Called after each block of data is received in compact read mode */
+    function<void(size_t offset, size_t size)> on_data;
 
     command_context()
     {
@@ -36,7 +65,10 @@ public:
         tx_size = 0;
         rx_buffer = nullptr;
         rx_size = 0;
+        rx_received = 0;
+        framed = false;
         parameters.clear();
+        exceptions.clear();
         run = nullptr;
         command = 0;
         type = 0;
@@ -71,6 +103,7 @@ typedef struct {
     string help;
     vector<string> arguments;
     const parse_func parse;
+    bool failed = false;        /* Set when parse returned false, for the exit status */
 
     list<string>::iterator exec(list<string> &tokens, list<string>::iterator &token_it)
     {
@@ -78,6 +111,7 @@ typedef struct {
         if(!this->parse(parser))
         {
             printf("Error parsing or running command.\n");
+            failed = true;
         }
         return parser.token_it_;
     }
@@ -97,6 +131,67 @@ enum {
     SUB_CMD_GET_PAGE,
     SUB_CMD_SEND_PAGE,
     SUB_CMD_GET_PARAMETERS,
+    SUB_CMD_SEND_DATA,
+    SUB_CMD_EXCEPTION,
+    SUB_CMD_EVENT,
+    SUB_CMD_FRAME,
+    SUB_CMD_READY,
+    SUB_CMD_STATS,
+};
+
+/* Banner the firmware sends after SUB_CMD_READY, followed by its protocol version */
+const uint8_t ready_magic[] = {'H', 'D', '6'};
+#define PROTOCOL_VERSION        7
+
+#define READY_PROBE_MS          250     /* Time for running firmware to answer CMD_SYNC */
+#define READY_BOOT_MS           3000    /* Time for the bootloader and setup() after a reset */
+
+/* Framed transfer, must match firmware/hdread/frame.hpp */
+enum {
+    FRAME_DATA          =   0x01,   /* Data bytes in stream order */
+    FRAME_EXCEPTION     =   0x02,   /* Same layout as SUB_CMD_EXCEPTION */
+    FRAME_EVENT         =   0x03,   /* Same layout as SUB_CMD_EVENT */
+    FRAME_END           =   0x04,   /* Last frame, sub-commands are sent bare again */
+};
+
+enum {
+    FRAME_ACK           =   0x06,   /* Every frame before seq was received */
+    FRAME_NAK           =   0x15,   /* Frame seq was bad or missing, resend from it */
+};
+
+#define FRAME_MAX_SIZE          0x40
+#define FRAME_CRC_INIT          0xFFFF
+#define FRAME_HEADER_SIZE       4       /* type, seq lo, seq hi, size */
+#define FRAME_CRC_SIZE          2
+#define FRAME_HUNT_TIMEOUT_MS   5000    /* Longer than a skip at the slowest clock */
+
+/* Marks the start of framing and of resent frames */
+const uint8_t frame_sync[] = {SUB_CMD_SYNC, 0x5A, 0xC3};
+
+/* Parameter layout for CMD_READ, must match firmware/hdread/cmds.hpp */
+enum {
+    READ_PARAM_MODE         =   0x00,
+    READ_PARAM_CLOCK_LO     =   0x01,
+    READ_PARAM_CLOCK_HI     =   0x02,
+    READ_PARAM_START_LO     =   0x03,
+    READ_PARAM_START_HI     =   0x04,
+    READ_PARAM_LENGTH_LO    =   0x05,
+    READ_PARAM_LENGTH_HI    =   0x06,
+    READ_PARAM_PASSES       =   0x07,
+    READ_PARAM_FLAGS        =   0x08,
+};
+
+/* Read options */
+#define READ_FLAG_FRAMED        0x01    /* Mode 0x08 only */
+#define READ_FLAG_TIMING        0x02    /* Time the firmware's work, see stats.hpp */
+#define READ_FLAG_UNROLLED      0x04    /* Cycle-counted address loop, modes 0x06, 0x08 and 0x09 */
+#define READ_FLAG_BURST         0x08    /* Capture blocks before sending them, modes 0x06 and 0x09 */
+
+/* Format strings for binary log events, indexed by event ID */
+static const char *event_formats[] = {
+#define EVENT_FORMAT(id, fmt) fmt,
+    EVENT_TABLE(EVENT_FORMAT)
+#undef EVENT_FORMAT
 };
 
 /* Commands we dispatch on the target */
@@ -111,8 +206,20 @@ enum {
     CMD_FUSE            =   0x24, // program fuses
     CMD_MODE            =   0x26, // set running mode -- special case?
     CMD_TEST            =   0x27, // ?
+    CMD_LINK            =   0x28, // switch baud rate
+    CMD_SYNC            =   0x29, // check firmware is running
+    CMD_STATS           =   0x2A, // counters from the last read
 };
 
+/* Baud rate the firmware starts at, and rates CMD_LINK can switch to (fastest first) */
+#define LINK_BASE_BAUD_RATE     115200
+#define LINK_MAX_BAUD_RATE      2000000
+const int link_baud_rates[] = {2000000, 1000000, 500000, 250000};
+
+#define LINK_TEST_SIZE          0x100   /* Test pattern size, must match kLinkTestSize */
+#define LINK_TIMEOUT_MS         250     /* Must match kLinkTimeoutMs */
+#define LINK_SETTLE_MS          10      /* Time for both ends to switch rates */
+
 enum {
     CMD_NO_RESPONSE,        /* The command returns no information */
     CMD_DISPATCH,           /* The command requires sub dispatch */
@@ -124,20 +231,357 @@ class Comms
 public:
     const size_t page_size = 0x40;
 
+    /* Size of the receive buffer, each read from the port takes as much of it as has arrived */
+    static constexpr size_t kReceiveBufferSize = 0x10000;
+
+    Comms() : rx_data_(kReceiveBufferSize), transport_(make_unique<SerialTransport>(LINK_BASE_BAUD_RATE))
+    {
+    }
+
+    /* Talk to the target through something other than a serial port */
+    void use_transport(unique_ptr<Transport> transport)
+    {
+        transport_ = move(transport);
+    }
+
+    Transport &transport(void)
+    {
+        return *transport_;
+    }
+
+    bool close(void)
+    {
+        return transport_->close();
+    }
+
+    /* Get byte from the receive buffer, refilling it from the port when empty */
     uint8_t getb(void)
     {
-        uint8_t input = 0;
-        while(port.get_rx_queue_size() <= 0)
+        if(rx_head_ == rx_tail_ && !fill(-1))
+        {
+            rx_failed_ = true;
+            return 0;
+        }
+        return rx_data_[rx_head_++];
+    }
+
+    /* Get byte, or return false if nothing arrives in time */
+    bool getb(uint8_t &value, uint32_t timeout_ms)
+    {
+        if(rx_head_ == rx_tail_ && !fill(timeout_ms))
+        {
+            return false;
+        }
+        value = rx_data_[rx_head_++];
+        return true;
+    }
+
+    /* Get a block of bytes. Anything already buffered is copied out, and the
+       rest is read from the port straight into the destination. Returns false
+       if the port stops before all of it arrives. */
+    bool get(uint8_t *data, size_t size)
+    {
+        size_t buffered = min(size, rx_tail_ - rx_head_);
+        memcpy(data, &rx_data_[rx_head_], buffered);
+        rx_head_ += buffered;
+
+        /* Counted the same as fill() */
+        for(size_t offset = buffered; offset < size; )
+        {
+            size_t actual = transport_->read_some(&data[offset], size - offset, -1);
+            if(actual == 0)
+            {
+                rx_failed_ = true;
+                return false;
+            }
+            ++rx_reads;
+            rx_bytes += actual;
+            offset += actual;
+        }
+        return true;
+    }
+
+    /* Make sure size bytes are in the receive buffer and return a pointer to them */
+    uint8_t *peek(size_t size)
+    {
+        if(rx_tail_ - rx_head_ < size)
+        {
+            /* Move the remaining data down so there's room after it */
+            memmove(&rx_data_[0], &rx_data_[rx_head_], rx_tail_ - rx_head_);
+            rx_tail_ -= rx_head_;
+            rx_head_ = 0;
+            while(rx_tail_ < size)
+            {
+                if(!fill(-1))
+                {
+                    return nullptr;
+                }
+            }
+        }
+        return &rx_data_[rx_head_];
+    }
+
+    /* Throw away anything received so far */
+    void discard(void)
+    {
+        transport_->flush_rx_queue();
+        rx_head_ = 0;
+        rx_tail_ = 0;
+    }
+
+    /* Number of reads from the port, and bytes received (read from other threads for progress) */
+    atomic<size_t> rx_reads{0};
+    atomic<size_t> rx_bytes{0};
+
+    /* Where time goes during a command, if set */
+    PhaseTimer *phases = nullptr;
+
+    void mark_phase(const char *name)
+    {
+        if(phases)
+        {
+            phases->mark(name, rx_bytes);
+        }
+    }
+
+    /* Shows how much of the data for a command has arrived, see received() */
+    ProgressMeter progress;
+
+    /* A block of data for the command arrived, rx_offset is the total so far */
+    void received(size_t size, size_t rx_offset)
+    {
+        if(phases)
+        {
+            phases->block(size);
+        }
+        progress.update(rx_offset);
+    }
+
+    /* Counters the firmware sent for the last read, see firmware/hdread/stats.hpp */
+    read_stats_t target_stats = {};
+    bool target_stats_valid = false;
+
+    /* Checksums the firmware reported for each pass of the last read */
+    vector<uint8_t> target_checksums;
+
+    void print_target_stats(void)
+    {
+        const read_stats_t &stats = target_stats;
+        printf("Result: Target issued %u EXTAL clocks, %u in %u seeks (longest %u), %u address mismatches.\n",
+            (unsigned)stats.clocks, (unsigned)stats.seek_clocks, (unsigned)stats.seeks, (unsigned)stats.seek_max, (unsigned)stats.mismatches);
+
+        /* Only the stall time is counted without READ_FLAG_TIMING */
+        double read_ms = stats.read_us / 1e3;
+        if(stats.clock_us || stats.sample_us || stats.send_us)
+        {
+            auto share = [&stats](uint32_t us) { return stats.read_us ? us * 100.0 / stats.read_us : 0.0; };
+            printf("Result: Target read took %.1f ms: clocking %.1f ms (%.0f%%), sampling %.1f ms (%.0f%%), sending %.1f ms (%.0f%%), stalled %.1f ms.\n",
+                read_ms, stats.clock_us / 1e3, share(stats.clock_us), stats.sample_us / 1e3, share(stats.sample_us),
+                stats.send_us / 1e3, share(stats.send_us), stats.stall_us / 1e3);
+        }
+        else
+        {
+            printf("Result: Target read took %.1f ms, stalled %.1f ms.\n", read_ms, stats.stall_us / 1e3);
+        }
+    }
+
+    /* Frames that failed their CRC or arrived out of order, and frames received twice */
+    size_t frame_errors = 0;
+    size_t frame_duplicates = 0;
+
+    /* Send a frame acknowledgement or NAK */
+    void send_frame_control(uint8_t control, uint16_t seq)
+    {
+        uint8_t message[] = {control, (uint8_t)(seq & 0xFF), (uint8_t)(seq >> 8)};
+        transport_->write(message, sizeof(message));
+    }
+
+    /* Skip data until the marker the target sends before resending frames.
+       The target resends until it gives up, so silence means it has. */
+    bool find_frame_sync(void)
+    {
+        size_t matched = 0;
+        while(matched < sizeof(frame_sync))
         {
-            Sleep(1);
+            uint8_t data;
+            if(!getb(data, FRAME_HUNT_TIMEOUT_MS))
+            {
+                return false;
+            }
+            if(data == frame_sync[matched])
+            {
+                ++matched;
+            }
+            else
+            {
+                matched = (data == frame_sync[0]) ? 1 : 0;
+            }
         }
-        port.read(&input, 1);            
-        return input;
+        return true;
+    }
+
+    /* Check and deliver one frame. Frames are only accepted in order, anything
+       bad is NAKed once and skipped until the target goes back and resends. */
+    bool receive_frame(command_context *p, uint32_t &rx_offset)
+    {
+        uint8_t *header = peek(FRAME_HEADER_SIZE);
+        if(!header)
+        {
+            return false;
+        }
+        uint8_t type = header[0];
+        uint16_t seq = header[1] | header[2] << 8;
+        uint8_t size = header[3];
+
+        /* A bad size means the header is damaged, don't trust anything until the resend */
+        if(size > FRAME_MAX_SIZE)
+        {
+            reject_frame();
+            return true;
+        }
+
+        uint8_t *frame = peek(FRAME_HEADER_SIZE + size + FRAME_CRC_SIZE);
+        if(!frame)
+        {
+            return false;
+        }
+        uint8_t *payload = &frame[FRAME_HEADER_SIZE];
+        uint16_t crc = FRAME_CRC_INIT;
+        for(int i = 0; i < FRAME_HEADER_SIZE + size; i++)
+        {
+            crc = crc16_update(crc, frame[i]);
+        }
+        uint16_t expected_crc = payload[size] | payload[size + 1] << 8;
+
+        if(crc != expected_crc)
+        {
+            reject_frame();
+            return true;
+        }
+        rx_head_ += FRAME_HEADER_SIZE + size + FRAME_CRC_SIZE;
+
+        /* Resent frames we already have just need acknowledging again */
+        if((int16_t)(seq - frame_expected_) < 0)
+        {
+            ++frame_duplicates;
+            send_frame_control(FRAME_ACK, frame_expected_);
+            return true;
+        }
+
+        /* A frame was lost before this one */
+        if(seq != frame_expected_)
+        {
+            reject_frame();
+            return true;
+        }
+
+        switch(type)
+        {
+            case FRAME_DATA:
+                if(rx_offset + size > p->rx_size)
+                {
+                    progress.clear();
+                    printf("Error: Target sent more data than expected.\n");
+                    return false;
+                }
+                memcpy(&p->rx_buffer[rx_offset], payload, size);
+                if(p->on_data)
+                {
+                    p->on_data(rx_offset, size);
+                }
+                rx_offset += size;
+                break;
+
+            case FRAME_EXCEPTION:
+                {
+                    read_exception record;
+                    record.offset = rx_offset;
+                    record.address = payload[0] | payload[1] << 8;
+                    record.ah = payload[2];
+                    record.adl = payload[3];
+                    record.ah2 = payload[4];
+                    record.data = payload[5];
+                    p->exceptions.push_back(record);
+                }
+                break;
+
+            case FRAME_EVENT:
+                {
+                    /* Acknowledge first, the event may end the command */
+                    ++frame_expected_;
+                    frame_nak_sent_ = false;
+                    send_frame_control(FRAME_ACK, frame_expected_);
+                    return frame_event(payload, size);
+                }
+
+            case FRAME_END:
+                frame_active_ = false;
+                break;
+
+            default:
+                break;
+        }
+
+        ++frame_expected_;
+        frame_nak_sent_ = false;
+        send_frame_control(FRAME_ACK, frame_expected_);
+        return true;
+    }
+
+    /* Decode an event carried in a frame, the same as SUB_CMD_EVENT without the sub-command */
+    bool frame_event(const uint8_t *payload, uint8_t size)
+    {
+        const uint8_t *end = payload + size;
+        uint32_t args[kMaxEventArgs] = {0};
+        if(size < 2 || payload[1] > kMaxEventArgs)
+        {
+            progress.clear();
+            printf("Error: Bad event frame.\n");
+            return false;
+        }
+        uint8_t id = payload[0];
+        uint8_t argc = payload[1];
+        payload += 2;
+        for(int i = 0; i < argc; i++)
+        {
+            for(int shift = 0; ; shift += 7)
+            {
+                if(payload == end || shift >= 35)
+                {
+                    progress.clear();
+                    printf("Error: Bad event frame.\n");
+                    return false;
+                }
+                uint8_t data = *payload++;
+                args[i] |= (uint32_t)(data & 0x7F) << shift;
+                if((data & 0x80) == 0)
+                {
+                    break;
+                }
+            }
+        }
+        return target_event(id, argc, args);
+    }
+
+    /* Read unsigned LEB128 varint */
+    uint32_t get_varint(void)
+    {
+        uint32_t value = 0;
+        for(int shift = 0; shift < 35; shift += 7)
+        {
+            uint8_t data = getb();
+            value |= (uint32_t)(data & 0x7F) << shift;
+            if((data & 0x80) == 0)
+            {
+                break;
+            }
+        }
+        return value;
     }
 
     void sendb(uint8_t value)
     {
-        port.write(value);
+        transport_->write(value);
     }
 
     bool send_command(uint8_t command)
@@ -157,20 +601,260 @@ public:
         return true;
     }
 
-    bool dispatch_target(uint8_t *tx_buffer, size_t tx_size, uint8_t *rx_buffer, size_t rx_size, vector<uint8_t> *parameters)
+    /* Ask the target to switch to a new baud rate and check the link with a
+       test pattern. On failure both ends go back to the base rate. */
+    bool set_link_rate(int baud_rate)
+    {
+        uint8_t response = 0;
+
+        if(!send_command(CMD_LINK))
+        {
+            return false;
+        }
+
+        for(int i = 0; i < 4; i++)
+        {
+            sendb((baud_rate >> (i * 8)) & 0xFF);
+        }
+
+        if(!getb(response, LINK_TIMEOUT_MS) || response != COMMS_ACK)
+        {
+            printf("Status: Target doesn't support %d bps.\n", baud_rate);
+            return false;
+        }
+
+        /* Switch rates once the target has */
+        sleep_ms(LINK_SETTLE_MS);
+        transport_->set_baud_rate(baud_rate);
+        sleep_ms(LINK_SETTLE_MS);
+        discard();
+
+        /* Send test pattern and check the echo */
+        uint8_t pattern[LINK_TEST_SIZE];
+        uint8_t echo[LINK_TEST_SIZE];
+        for(int i = 0; i < LINK_TEST_SIZE; i++)
+        {
+            pattern[i] = (uint8_t)(i * 167 + 13);
+        }
+        transport_->write(pattern, LINK_TEST_SIZE);
+
+        bool passed = true;
+        for(int i = 0; i < LINK_TEST_SIZE && passed; i++)
+        {
+            passed = getb(echo[i], LINK_TIMEOUT_MS) && echo[i] == pattern[i];
+        }
+
+        if(passed)
+        {
+            sendb(COMMS_ACK);
+            passed = getb(response, LINK_TIMEOUT_MS) && response == COMMS_ACK;
+        }
+
+        if(!passed)
+        {
+            /* Wait for the target to time out and revert */
+            printf("Status: Link test at %d bps failed.\n", baud_rate);
+            transport_->set_baud_rate(LINK_BASE_BAUD_RATE);
+            sleep_ms(LINK_TIMEOUT_MS * 3);
+            discard();
+            return false;
+        }
+
+        return true;
+    }
+
+    /* Wait for the firmware's ready banner, skipping anything else */
+    bool wait_ready(uint32_t timeout_ms)
     {
+        auto deadline = chrono::steady_clock::now() + chrono::milliseconds(timeout_ms);
+        size_t matched = 0;
+        uint8_t data;
+
+        while(true)
+        {
+            auto remaining = chrono::duration_cast<chrono::milliseconds>(deadline - chrono::steady_clock::now()).count();
+            if(remaining <= 0 || !getb(data, remaining))
+            {
+                return false;
+            }
+
+            /* Version byte follows SUB_CMD_READY and the magic */
+            if(matched == sizeof(ready_magic) + 1)
+            {
+                target_version = data;
+                return true;
+            }
+
+            if(matched == 0)
+            {
+                matched = (data == SUB_CMD_READY) ? 1 : 0;
+            }
+            else if(data == ready_magic[matched - 1])
+            {
+                ++matched;
+            }
+            else
+            {
+                matched = (data == SUB_CMD_READY) ? 1 : 0;
+            }
+        }
+    }
+
+    /* Check the firmware is running and idle, and clear out anything left over */
+    bool sync(void)
+    {
+        discard();
+        rx_reads = 0;
+        rx_bytes = 0;
+        sendb(CMD_SYNC);
+        return wait_ready(READY_PROBE_MS);
+    }
+
+    /* Open the port and make sure the firmware is ready. Firmware that is
+       still running from an earlier command answers CMD_SYNC right away,
+       so the Arduino is only reset when it doesn't. */
+    bool connect(int com_port, const string &com_device)
+    {
+        mark_phase("open");
+        if(!transport_->open(com_port, com_device))
+        {
+            return false;
+        }
+        mark_phase("handshake");
+        if(!sync())
+        {
+            printf("Status: Resetting target.\n");
+            mark_phase("reset");
+            if(!transport_->reset())
+            {
+                printf("Status: Can't reset target, waiting for it to start.\n");
+            }
+            discard();
+            if(!wait_ready(READY_BOOT_MS))
+            {
+                /* Older firmware doesn't send a banner, but has had time to boot */
+                printf("Warning: No ready banner from firmware.\n");
+                target_version = 0;
+                return true;
+            }
+        }
+
+        if(target_version != PROTOCOL_VERSION)
+        {
+            printf("Warning: Firmware speaks protocol %d, expected %d.\n", target_version, PROTOCOL_VERSION);
+        }
+        printf("Status: Firmware ready (protocol %d).\n", target_version);
+        return true;
+    }
+
+    /* Protocol version from the firmware's ready banner */
+    int target_version = 0;
+
+    /* Switch to the fastest rate both ends support up to max_rate */
+    int negotiate_link(int max_rate)
+    {
+        mark_phase("link");
+        for(int baud_rate : link_baud_rates)
+        {
+            if(baud_rate > max_rate)
+            {
+                continue;
+            }
+
+            if(set_link_rate(baud_rate))
+            {
+                printf("Status: Link running at %d bps.\n", baud_rate);
+                return baud_rate;
+            }
+        }
+        printf("Status: Link running at %d bps.\n", LINK_BASE_BAUD_RATE);
+        return LINK_BASE_BAUD_RATE;
+    }
+
+    bool dispatch_target(command_context *p)
+    {
+        uint8_t *tx_buffer = p->tx_buffer;
+        uint8_t *rx_buffer = p->rx_buffer;
+        vector<uint8_t> *parameters = &p->parameters;
         uint32_t tx_offset = 0;
         uint32_t rx_offset = 0;
         bool processing = true;
-        static uint8_t last_command = 0xff;
+
+        frame_expected_ = 0;
+        frame_nak_sent_ = false;
+        frame_hunting_ = false;
+        frame_active_ = false;
+        frame_errors = 0;
+        frame_duplicates = 0;
+        rx_failed_ = false;
+        target_stats_valid = false;
+        target_checksums.clear();
+        progress.start(p->rx_buffer ? p->rx_size : 0);
 
         while(processing)
         {
+            /* After a bad frame, nothing can be trusted until the target resends */
+            if(frame_hunting_)
+            {
+                if(!find_frame_sync())
+                {
+                    progress.clear();
+                    printf("Error: Target stopped resending frames.\n");
+                    return false;
+                }
+                frame_hunting_ = false;
+            }
+
+            /* A transport that can't wait, or a port that failed, won't send anything more */
             uint8_t command = getb();
+            if(rx_failed_)
+            {
+                progress.clear();
+                printf("Error: Target stopped sending.\n");
+                return false;
+            }
+
+            /* While framing everything comes in frames, anything else means a frame was damaged */
+            if(frame_active_ && command != SUB_CMD_FRAME && command != SUB_CMD_SYNC)
+            {
+                reject_frame();
+                continue;
+            }
+
             switch(command)
             {
                 case SUB_CMD_SYNC:
-                    // Synchronize with host
+                    // Synchronize with host, or the marker before resent frames
+                    {
+                        uint8_t *marker = peek(sizeof(frame_sync) - 1);
+                        if(marker && !memcmp(marker, &frame_sync[1], sizeof(frame_sync) - 1))
+                        {
+                            rx_head_ += sizeof(frame_sync) - 1;
+                            frame_active_ = p->framed;
+                        }
+                        else if(frame_active_)
+                        {
+                            reject_frame();
+                        }
+                    }
+                    break;
+
+                case SUB_CMD_FRAME:
+                    if(p->framed)
+                    {
+                        mark_phase("dump");
+                        frame_active_ = true;
+                        uint32_t frame_offset = rx_offset;
+                        if(!receive_frame(p, rx_offset))
+                        {
+                            progress.clear();
+                            return false;
+                        }
+                        if(rx_offset != frame_offset)
+                        {
+                            received(rx_offset - frame_offset, rx_offset);
+                        }
+                    }
                     break;
 
                 case SUB_CMD_EXIT:
@@ -184,11 +868,13 @@ public:
 
                 case SUB_CMD_FAIL:            
                     // Command failed
+                    progress.clear();
                     return false;
                     break;
 
                 case SUB_CMD_GET_PARAMETERS:
                     {
+                        mark_phase("parameters");
                         sendb(parameters->size());
                         for(int i = 0; i < parameters->size(); i++)
                         {
@@ -199,6 +885,13 @@ public:
 
                 case SUB_CMD_GET_PAGE:
                     {
+                        /* Only a write has pages to send, anything else is a damaged stream */
+                        if(!tx_buffer || tx_offset + 0x40 > p->tx_size)
+                        {
+                            progress.clear();
+                            printf("Error: Target asked for a page the command doesn't have.\n");
+                            return false;
+                        }
                         for(int chunk = 0; chunk < 4; chunk++)
                         {
                             uint8_t checksum = 0x81;
@@ -212,40 +905,234 @@ public:
                             uint8_t result = getb();
                             printf("Got back %02X, local %02X\n", result, checksum);
                         }
-                        tx_buffer += 0x40;
+                        tx_offset += 0x40;
                     }
                     break;
 
                 case SUB_CMD_SEND_PAGE: 
-//                    printf("Getting page from target (%08X).\n", rx_offset);
-                    port.read(&rx_buffer[rx_offset], page_size);           
+                    mark_phase("dump");
+                    if(rx_offset + page_size > p->rx_size)
+                    {
+                        progress.clear();
+                        printf("Error: Target sent more data than expected.\n");
+                        return false;
+                    }
+                    if(!get(&rx_buffer[rx_offset], page_size))
+                    {
+                        progress.clear();
+                        printf("Error: Target stopped sending.\n");
+                        return false;
+                    }
                     rx_offset += page_size;
+                    received(page_size, rx_offset);
+                    break;
+
+                case SUB_CMD_SEND_DATA:
+                    {
+                        mark_phase("dump");
+                        uint8_t length = getb();
+                        if(rx_offset + length > p->rx_size)
+                        {
+                            progress.clear();
+                            printf("Error: Target sent more data than expected.\n");
+                            return false;
+                        }
+                        if(!get(&rx_buffer[rx_offset], length))
+                        {
+                            progress.clear();
+                            printf("Error: Target stopped sending.\n");
+                            return false;
+                        }
+                        if(p->on_data)
+                        {
+                            p->on_data(rx_offset, length);
+                        }
+                        rx_offset += length;
+                        received(length, rx_offset);
+                    }
+                    break;
+
+                case SUB_CMD_EXCEPTION:
+                    {
+                        mark_phase("dump");
+                        read_exception record;
+                        record.offset = rx_offset;
+                        record.address = getb();
+                        record.address |= getb() << 8;
+                        record.ah = getb();
+                        record.adl = getb();
+                        record.ah2 = getb();
+                        record.data = getb();
+                        p->exceptions.push_back(record);
+                    }
                     break;
 
                 case SUB_CMD_LOG:
                     {
                         uint8_t length = getb();
-                        char buffer[256];
-                        memset(buffer, 0, sizeof(buffer));
-                        for(int i = 0; i < length; i++)
+                        char *message = (char *)peek(length);
+                        if(!message)
                         {
-                            buffer[i] = getb();
+                            return false;
                         }
-                        buffer[255] = 0;
 
+                        /* Print in place, the message may contain a NUL the old handler stopped at */
+                        progress.clear();
                         set_terminal_color(TEXT_COLOR_TARGET);
-                        printf("%s", buffer);
+                        printf("%.*s", (int)strnlen(message, length), message);
                         set_terminal_color(TEXT_COLOR_NORMAL);
+                        rx_head_ += length;
+                    }
+                    break;
+
+                case SUB_CMD_STATS:
+                    {
+                        uint8_t size = getb();
+                        uint8_t *record = peek(size);
+                        if(!record)
+                        {
+                            return false;
+                        }
+
+                        /* Fields a newer firmware adds are skipped, missing ones read as zero */
+                        uint32_t *fields = (uint32_t *)&target_stats;
+                        for(int i = 0; i < kStatsFields; i++)
+                        {
+                            uint32_t value = 0;
+                            for(int j = 3; j >= 0; j--)
+                            {
+                                size_t offset = i * 4 + j;
+                                value = value << 8 | (offset < size ? record[offset] : 0);
+                            }
+                            fields[i] = value;
+                        }
+                        rx_head_ += size;
+                        target_stats_valid = true;
+
+                        progress.clear();
+                        set_terminal_color(TEXT_COLOR_TARGET);
+                        print_target_stats();
+                        set_terminal_color(TEXT_COLOR_NORMAL);
+                    }
+                    break;
+
+                case SUB_CMD_EVENT:
+                    {
+                        uint8_t id = getb();
+                        uint8_t argc = getb();
+                        uint32_t args[kMaxEventArgs] = {0};
+                        if(argc > kMaxEventArgs)
+                        {
+                            progress.clear();
+                            printf("Error: Bad event %02X (%d arguments).\n", id, argc);
+                            return false;
+                        }
+                        for(int i = 0; i < argc; i++)
+                        {
+                            args[i] = get_varint();
+                        }
+                        if(!target_event(id, argc, args))
+                        {
+                            return false;
+                        }
                     }
                     break;
 
                 default:
                     break;
             }
-            last_command = command;
         }
+        progress.finish();
+        p->rx_received = rx_offset;
         return true;
     }
 
-    ArduinoSerialPort port;
+    /* Show an event from the target, returns false if it means the command failed */
+    bool target_event(uint8_t id, uint8_t argc, const uint32_t *args)
+    {
+        /* Anything else is a damaged stream, not a newer firmware */
+        if(id >= EVENT_COUNT)
+        {
+            progress.clear();
+            printf("Error: Unknown event %02X (%d arguments).\n", id, argc);
+            return false;
+        }
+
+        if(id == EVENT_TEST_WRAPPING || id == EVENT_SEEK_FIRST || id == EVENT_SEEK_ZERO)
+        {
+            mark_phase("seek");
+        }
+
+        if(id == EVENT_PASS_RESULT || id == EVENT_CHECKSUM)
+        {
+            target_checksums.push_back(id == EVENT_PASS_RESULT ? args[2] : args[0]);
+        }
+
+        /* Each seek result and status line is a point in the trace */
+        if(phases)
+        {
+            string text = format(event_formats[id], args[0], args[1], args[2], args[3]);
+            text.erase(text.find_last_not_of('\n') + 1);
+            phases->instant(text, rx_bytes);
+        }
+
+        /* The progress line stands in for these */
+        if(id == EVENT_READ_OFFSET && progress.enabled)
+        {
+            return true;
+        }
+
+        progress.clear();
+        set_terminal_color(TEXT_COLOR_TARGET);
+        printf(event_formats[id], args[0], args[1], args[2], args[3]);
+        set_terminal_color(TEXT_COLOR_NORMAL);
+
+        /* The target gave up on the link, so the data can't be complete */
+        return id != EVENT_FRAME_FAILED;
+    }
+
+private:
+    vector<uint8_t> rx_data_;
+    size_t rx_head_ = 0;
+    size_t rx_tail_ = 0;
+    unique_ptr<Transport> transport_;
+    bool rx_failed_ = false;
+
+    uint16_t frame_expected_ = 0;
+    bool frame_nak_sent_ = false;
+    bool frame_hunting_ = false;
+    bool frame_active_ = false;         /* Between the first frame and FRAME_END */
+
+    /* Ask for everything from the expected frame again, once per resend */
+    void reject_frame(void)
+    {
+        ++frame_errors;
+        if(!frame_nak_sent_)
+        {
+            send_frame_control(FRAME_NAK, frame_expected_);
+            frame_nak_sent_ = true;
+        }
+        frame_hunting_ = true;
+    }
+
+    /* Read whatever has arrived into the free space at the end of the receive buffer */
+    bool fill(int timeout_ms)
+    {
+        if(rx_head_ == rx_tail_)
+        {
+            rx_head_ = 0;
+            rx_tail_ = 0;
+        }
+
+        size_t size = transport_->read_some(&rx_data_[rx_tail_], rx_data_.size() - rx_tail_, timeout_ms);
+        if(size == 0)
+        {
+            return false;
+        }
+
+        ++rx_reads;
+        rx_bytes += size;
+        rx_tail_ += size;
+        return true;
+    }
 };
\ No newline at end of file
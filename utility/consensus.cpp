@@ -0,0 +1,104 @@
+#include "consensus.hpp"
+
+/* Locations below this are RAM, I/O and unused, and never agree */
+constexpr uint16_t kRomBase = 0x80;
+
+Consensus::Consensus(uint16_t start, size_t length, int threshold)
+{
+    start_ = start;
+    length_ = length;
+    threshold_ = threshold;
+    passes_ = 0;
+    first_.assign(length, 0);
+    ones_.assign(length * 8, 0);
+}
+
+/* Add one pass of length bytes */
+void Consensus::add_pass(const uint8_t *data)
+{
+    if(passes_ == 0)
+    {
+        first_.assign(data, data + length_);
+    }
+
+    for(size_t index = 0; index < length_; index++)
+    {
+        uint8_t *counts = &ones_[index * 8];
+        for(int bit = 0; bit < 8; bit++)
+        {
+            counts[bit] += (data[index] >> bit) & 1;
+        }
+    }
+    ++passes_;
+}
+
+/* Check if every ROM byte in the window has reached the agreement threshold */
+bool Consensus::converged(void)
+{
+    if(passes_ < threshold_)
+    {
+        return false;
+    }
+
+    for(size_t index = 0; index < length_; index++)
+    {
+        if(address(index) >= kRomBase && agreement(index) < threshold_)
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+/* Get the voted value of a byte */
+uint8_t Consensus::value(size_t index)
+{
+    uint8_t *counts = &ones_[index * 8];
+    uint8_t result = 0;
+
+    for(int bit = 0; bit < 8; bit++)
+    {
+        int zeros = passes_ - counts[bit];
+        if(counts[bit] > zeros || (counts[bit] == zeros && (first_[index] >> bit) & 1))
+        {
+            result |= 1 << bit;
+        }
+    }
+    return result;
+}
+
+/* Get the number of passes agreeing with the vote on the least certain bit */
+uint8_t Consensus::agreement(size_t index)
+{
+    uint8_t *counts = &ones_[index * 8];
+    uint8_t voted = value(index);
+    int result = passes_;
+
+    for(int bit = 0; bit < 8; bit++)
+    {
+        int agree = ((voted >> bit) & 1) ? counts[bit] : passes_ - counts[bit];
+        if(agree < result)
+        {
+            result = agree;
+        }
+    }
+    return result;
+}
+
+/* Get a mask of bits where any pass disagreed with the vote */
+uint8_t Consensus::unstable(size_t index)
+{
+    uint8_t *counts = &ones_[index * 8];
+    uint8_t result = 0;
+
+    for(int bit = 0; bit < 8; bit++)
+    {
+        if(counts[bit] != 0 && counts[bit] != passes_)
+        {
+            result |= 1 << bit;
+        }
+    }
+    return result;
+}
+
+/* End */
@@ -0,0 +1,41 @@
+#pragma once
+
+#include <stdint.h>
+#include <vector>
+using namespace std;
+
+/* Combine several read passes of the same window by majority vote on each
+   bit. The agreement for a byte is the number of passes that agree with
+   the voted value on its least certain bit. A bit is unstable if any pass
+   disagreed with the vote. */
+class Consensus
+{
+public:
+    Consensus(uint16_t start, size_t length, int threshold);
+
+    void add_pass(const uint8_t *data);
+    bool converged(void);
+
+    uint8_t value(size_t index);
+    uint8_t agreement(size_t index);
+    uint8_t unstable(size_t index);
+    uint16_t address(size_t index) { return (start_ + index) & 0xFFF; }
+
+    size_t length(void) { return length_; }
+    int passes(void) { return passes_; }
+    int threshold(void) { return threshold_; }
+
+private:
+    uint16_t start_;
+    size_t length_;
+    int threshold_;
+    int passes_;
+
+    /* Value from the first pass, used to break ties */
+    vector<uint8_t> first_;
+
+    /* Number of passes with each bit set, 8 counters per byte */
+    vector<uint8_t> ones_;
+};
+
+/* End */
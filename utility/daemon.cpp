@@ -0,0 +1,523 @@
+/*
+    Reader daemon. Keeps one or more reader ports open and runs jobs from
+    clients connected to a Unix domain socket. Each request is one line:
+
+        read [options] [file]   Read the ROM. Without a file name the result
+                                is returned inline.
+        check [options]         Read the ROM and return the check report.
+        ports                   List readers and their queued jobs.
+
+    Options are --port name, --range start-end, --passes count,
+    --agree count, --clock rate, --baudrate rate, --compact, --framed,
+    --timing, --unrolled, --burst and --snapshot.
+
+    Responses are one line starting with `ok' or `error', followed by
+    binary data where noted:
+
+        ok <passes> <rom size> <log size> <conf size>   + rom, log, conf
+        ok <passes> file <file>
+        ok <report size>                                + report text
+        ok <count>                                      + one line per reader
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sstream>
+#include "daemon.hpp"
+
+#ifndef _WIN32
+
+#include <errno.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+/* A job queued for one reader */
+class daemon_job
+{
+public:
+    string command;
+    read_options options;
+    string output;
+
+    bool ok = false;
+    string error;
+    read_result result;
+    string report;
+    promise<void> done;
+};
+
+/* One reader port, with its own worker thread so jobs on a port run one at a time */
+class daemon_reader
+{
+public:
+    string name;
+    int com_port = -1;
+    string com_device;
+
+    /* Only the worker uses comms, so it is used without holding lock */
+    Comms comms;
+    atomic<bool> connected{false};  /* Read by request threads for the status */
+    bool busy = false;
+
+    mutex lock;
+    condition_variable wake;
+    deque<shared_ptr<daemon_job>> queue;
+    thread worker;
+};
+
+static vector<unique_ptr<daemon_reader>> readers;
+static atomic<bool> running(true);
+static int listen_fd = -1;
+
+/* Make sure the reader is open and the firmware is answering */
+static bool reader_ready(daemon_reader &reader)
+{
+    if(reader.connected && reader.comms.sync())
+    {
+        return true;
+    }
+
+    if(reader.connected)
+    {
+        printf("Status: Reader %s stopped answering, reconnecting.\n", reader.name.c_str());
+        reader.comms.close();
+    }
+    reader.connected = reader.comms.connect(reader.com_port, reader.com_device);
+    return reader.connected;
+}
+
+static void run_job(daemon_reader &reader, daemon_job &job)
+{
+    if(!reader_ready(reader))
+    {
+        job.error = "can't open reader " + reader.name;
+        return;
+    }
+
+    if(!read_rom(reader.comms, job.options, job.result))
+    {
+        /* The target may be part way through the command, resync before the next job */
+        reader.comms.close();
+        reader.connected = false;
+        job.error = "read failed on " + reader.name;
+        return;
+    }
+
+    if(job.command == "check")
+    {
+        job.report = check_rom(job.result.rom.data());
+    }
+    else if(!job.output.empty() && !write_read_result(job.output, job.result))
+    {
+        job.error = "can't write " + job.output;
+        return;
+    }
+    job.ok = true;
+}
+
+static void reader_worker(daemon_reader *reader)
+{
+    unique_lock<mutex> guard(reader->lock);
+    while(running)
+    {
+        if(reader->queue.empty())
+        {
+            /* Check idle readers now and then so a job doesn't wait on a reset */
+            if(!reader->wake.wait_for(guard, chrono::milliseconds(DAEMON_IDLE_PROBE_MS), [&] { return !reader->queue.empty() || !running; }))
+            {
+                /* The probe can take READY_PROBE_MS, don't hold up requests meanwhile */
+                guard.unlock();
+                if(reader->connected && !reader->comms.sync())
+                {
+                    printf("Status: Reader %s stopped answering.\n", reader->name.c_str());
+                    reader->comms.close();
+                    reader->connected = false;
+                }
+                guard.lock();
+            }
+            continue;
+        }
+
+        auto job = reader->queue.front();
+        reader->queue.pop_front();
+        reader->busy = true;
+        guard.unlock();
+
+        printf("Status: Running %s on %s.\n", job->command.c_str(), reader->name.c_str());
+        run_job(*reader, *job);
+        job->done.set_value();
+
+        guard.lock();
+        reader->busy = false;
+    }
+
+    if(reader->connected)
+    {
+        reader->comms.close();
+    }
+}
+
+/* Pick the named reader, or the one with the least work queued */
+static daemon_reader *find_reader(const string &name)
+{
+    daemon_reader *best = nullptr;
+    size_t best_load = 0;
+
+    for(auto &reader : readers)
+    {
+        lock_guard<mutex> guard(reader->lock);
+        size_t load = reader->queue.size() + (reader->busy ? 1 : 0);
+        if(!name.empty())
+        {
+            if(reader->name == name)
+            {
+                return reader.get();
+            }
+            continue;
+        }
+        if(!best || load < best_load)
+        {
+            best = reader.get();
+            best_load = load;
+        }
+    }
+    return best;
+}
+
+/* Parse the options of a read or check request */
+static bool parse_job(istringstream &tokens, daemon_job &job, string &port, string &error)
+{
+    const string kValueOptions = " --port --range --passes --agree --clock --baudrate ";
+    string token;
+    while(tokens >> token)
+    {
+        string value;
+        if(token == "--compact")
+        {
+            job.options.compact = true;
+        }
+        else if(token == "--framed")
+        {
+            job.options.framed = true;
+        }
+        else if(token == "--timing")
+        {
+            job.options.timing = true;
+        }
+        else if(token == "--unrolled")
+        {
+            job.options.unrolled = true;
+        }
+        else if(token == "--burst")
+        {
+            job.options.burst = true;
+        }
+        else if(token == "--snapshot")
+        {
+            job.options.snapshot = true;
+        }
+        else if(token.compare(0, 2, "--") == 0 && kValueOptions.find(" " + token + " ") == string::npos)
+        {
+            error = "unknown option " + token;
+            return false;
+        }
+        else if(token.compare(0, 2, "--") == 0 && !(tokens >> value))
+        {
+            error = "missing argument for " + token;
+            return false;
+        }
+        else if(token == "--port")
+        {
+            port = value;
+        }
+        else if(token == "--range")
+        {
+            size_t separator = value.find('-');
+            int start = strtol(value.substr(0, separator).c_str(), NULL, 0);
+            int end = separator == string::npos ? -1 : strtol(value.substr(separator + 1).c_str(), NULL, 0);
+            if(start < 0 || end < start || end > 0xFFF)
+            {
+                error = "bad range " + value;
+                return false;
+            }
+            job.options.range_start = start;
+            job.options.range_length = end - start + 1;
+        }
+        else if(token == "--passes")
+        {
+            job.options.passes = atoi(value.c_str());
+        }
+        else if(token == "--agree")
+        {
+            job.options.agree = atoi(value.c_str());
+        }
+        else if(token == "--clock")
+        {
+            if(!parse_clock_rate(value, job.options.clock_rate_khz))
+            {
+                error = "bad clock rate " + value;
+                return false;
+            }
+        }
+        else if(token == "--baudrate")
+        {
+            job.options.baud_rate = atoi(value.c_str());
+        }
+        else
+        {
+            job.output = token;
+        }
+    }
+
+    if(job.options.passes < 1 || job.options.passes > 255 || job.options.agree < 1)
+    {
+        error = "bad pass count";
+        return false;
+    }
+
+    /* The check report needs the whole ROM */
+    if(job.command == "check")
+    {
+        job.options.range_start = 0;
+        job.options.range_length = ROM_SIZE;
+    }
+    return true;
+}
+
+static bool send_all(int fd, const void *data, size_t size)
+{
+    const uint8_t *position = (const uint8_t *)data;
+    while(size)
+    {
+        ssize_t actual = send(fd, position, size, 0);
+        if(actual <= 0)
+        {
+            if(actual < 0 && errno == EINTR)
+            {
+                continue;
+            }
+            return false;
+        }
+        position += actual;
+        size -= actual;
+    }
+    return true;
+}
+
+static bool send_line(int fd, const string &line)
+{
+    return send_all(fd, line.data(), line.size());
+}
+
+/* Run one request line and send the response */
+static bool handle_request(int fd, const string &line, const read_options &defaults)
+{
+    istringstream tokens(line);
+    string command;
+    tokens >> command;
+
+    if(command == "ports")
+    {
+        string response = format("ok %d\n", (int)readers.size());
+        for(auto &reader : readers)
+        {
+            lock_guard<mutex> guard(reader->lock);
+            response += format("%s %s %d\n", reader->name.c_str(),
+                reader->busy ? "busy" : (reader->connected ? "ready" : "closed"), (int)reader->queue.size());
+        }
+        return send_line(fd, response);
+    }
+
+    if(command != "read" && command != "check")
+    {
+        return send_line(fd, "error unknown command " + command + "\n");
+    }
+
+    auto job = make_shared<daemon_job>();
+    string port;
+    string error;
+    job->command = command;
+    job->options = defaults;
+    if(!parse_job(tokens, *job, port, error))
+    {
+        return send_line(fd, "error " + error + "\n");
+    }
+
+    daemon_reader *reader = find_reader(port);
+    if(!reader)
+    {
+        return send_line(fd, "error no reader " + port + "\n");
+    }
+
+    /* Queue the job on the reader and wait for it to finish */
+    auto done = job->done.get_future();
+    {
+        lock_guard<mutex> guard(reader->lock);
+        reader->queue.push_back(job);
+    }
+    reader->wake.notify_one();
+    done.wait();
+
+    if(!job->ok)
+    {
+        return send_line(fd, "error " + job->error + "\n");
+    }
+
+    if(command == "check")
+    {
+        return send_line(fd, format("ok %d\n", (int)job->report.size()) + job->report);
+    }
+
+    read_result &result = job->result;
+    if(!job->output.empty())
+    {
+        return send_line(fd, format("ok %d file %s\n", result.passes, job->output.c_str()));
+    }
+    return send_line(fd, format("ok %d %d %d %d\n", result.passes,
+            (int)result.rom.size(), (int)result.log.size(), (int)result.confidence.size()))
+        && send_all(fd, result.rom.data(), result.rom.size())
+        && send_all(fd, result.log.data(), result.log.size())
+        && send_all(fd, result.confidence.data(), result.confidence.size());
+}
+
+/* Read request lines from a client until it disconnects */
+static void handle_client(int fd, read_options defaults)
+{
+    string pending;
+    char buffer[256];
+
+    while(running)
+    {
+        ssize_t actual = recv(fd, buffer, sizeof(buffer), 0);
+        if(actual <= 0)
+        {
+            break;
+        }
+        pending.append(buffer, actual);
+
+        size_t end;
+        while((end = pending.find('\n')) != string::npos)
+        {
+            string line = pending.substr(0, end);
+            pending.erase(0, end + 1);
+            if(!line.empty() && line.back() == '\r')
+            {
+                line.pop_back();
+            }
+            if(!line.empty() && !handle_request(fd, line, defaults))
+            {
+                close(fd);
+                return;
+            }
+        }
+    }
+    close(fd);
+}
+
+static void stop_daemon(int signal)
+{
+    running = false;
+    shutdown(listen_fd, SHUT_RDWR);
+}
+
+int run_daemon(const string &socket_path, const vector<string> &ports, const read_options &defaults)
+{
+    struct sockaddr_un address = {0};
+
+    /* Log lines go out as they happen even when redirected to a file */
+    setvbuf(stdout, NULL, _IOLBF, 0);
+
+    if(socket_path.size() >= sizeof(address.sun_path))
+    {
+        printf("Error: Socket path `%s' is too long.\n", socket_path.c_str());
+        return 1;
+    }
+
+    /* Open every reader up front so the first job doesn't wait for it */
+    for(const string &port : ports)
+    {
+        auto reader = make_unique<daemon_reader>();
+        reader->name = port.empty() ? "default" : port;
+        if(port.empty() || !isdigit(port[0]))
+        {
+            reader->com_device = port;
+        }
+        else
+        {
+            reader->com_port = atoi(port.c_str());
+        }
+        reader->connected = reader->comms.connect(reader->com_port, reader->com_device);
+        if(!reader->connected)
+        {
+            printf("Warning: Reader %s isn't available yet.\n", reader->name.c_str());
+        }
+        readers.push_back(move(reader));
+    }
+
+    listen_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    address.sun_family = AF_UNIX;
+    strcpy(address.sun_path, socket_path.c_str());
+    unlink(socket_path.c_str());
+    if(listen_fd < 0 || bind(listen_fd, (struct sockaddr *)&address, sizeof(address)) != 0 || listen(listen_fd, 8) != 0)
+    {
+        printf("Error: Can't listen on `%s' (%s).\n", socket_path.c_str(), strerror(errno));
+        return 1;
+    }
+
+    signal(SIGPIPE, SIG_IGN);
+    signal(SIGINT, stop_daemon);
+    signal(SIGTERM, stop_daemon);
+
+    for(auto &reader : readers)
+    {
+        reader->worker = thread(reader_worker, reader.get());
+    }
+    printf("Status: Listening on `%s' with %d readers.\n", socket_path.c_str(), (int)readers.size());
+
+    while(running)
+    {
+        int client = accept(listen_fd, NULL, NULL);
+        if(client < 0)
+        {
+            if(errno == EINTR)
+            {
+                continue;
+            }
+            break;
+        }
+        thread(handle_client, client, defaults).detach();
+    }
+
+    running = false;
+    for(auto &reader : readers)
+    {
+        reader->wake.notify_all();
+        reader->worker.join();
+    }
+    close(listen_fd);
+    unlink(socket_path.c_str());
+    printf("Status: Daemon stopped.\n");
+    return 0;
+}
+
+#else
+
+int run_daemon(const string &socket_path, const vector<string> &ports, const read_options &defaults)
+{
+    printf("Error: Daemon mode needs Unix domain sockets and isn't supported on Windows.\n");
+    return 1;
+}
+
+#endif
+
+/* End */
@@ -0,0 +1,13 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include "reader.hpp"
+using namespace std;
+
+/* How often an idle reader is checked to still be running */
+#define DAEMON_IDLE_PROBE_MS        10000
+
+int run_daemon(const string &socket_path, const vector<string> &ports, const read_options &defaults);
+
+/* End */
@@ -0,0 +1,1492 @@
+/*
+    Software reader. Emulates the firmware running on a reader shield with an
+    HD6805V1 fitted, so the whole read pipeline can run without hardware,
+    either in memory (--emulate) or on a pseudo-terminal (emulate).
+
+    The read modes are ports of the firmware's cmds.cpp on top of a model of
+    the target bus, and keep the firmware's names so the two can be compared.
+*/
+
+#include <stdio.h>
+#include <stdarg.h>
+#include <string.h>
+#include <thread>
+#include "emulator.hpp"
+#include "utility.hpp"
+
+/* Give up on a scan the firmware would wait on forever */
+#define EMULATOR_SCAN_LIMIT         0x100000
+#define EMULATOR_SEEK_TIMEOUT       0xFFFFFFFF
+
+/* Same as the firmware's shuffle(), undoes the A7-A0 order on port B */
+static uint8_t shuffle(uint8_t in)
+{
+    constexpr uint8_t order[] = {0, 2, 6, 7, 5, 4, 3, 1};
+    uint8_t temp = 0;
+
+    for(int index = 0; index < 8; index++)
+    {
+        if(in & (1 << index))
+        {
+            temp |= (1 << order[index]);
+        }
+    }
+    return temp;
+}
+
+/******************************************************************************/
+/* Emulator */
+/******************************************************************************/
+
+ReaderEmulator::ReaderEmulator(const vector<uint8_t> &rom, const emulator_options &options)
+    : model(rom), options_(options), random_(options.seed), chance_(0.0, 1.0)
+{
+    memset(parameters_, 0, sizeof(parameters_));
+}
+
+/* Power on, the firmware announces itself at the end of setup() */
+void ReaderEmulator::reset(void)
+{
+    state_ = EMU_COMMAND;
+    input_.clear();
+    input_head_ = 0;
+    pending_.clear();
+    pending_head_ = 0;
+    link_rate_ = LINK_BASE_BAUD_RATE;
+    send_ready();
+}
+
+void ReaderEmulator::receive(const uint8_t *data, size_t size)
+{
+    line_bytes += size;
+    line_us += size * 10 * 1e6 / link_rate_;
+    input_.insert(input_.end(), data, data + size);
+    process_input();
+}
+
+size_t ReaderEmulator::transmit(uint8_t *data, size_t size)
+{
+    /* In real time the host sees data a packet at a time, as it arrives */
+    if(options_.realtime)
+    {
+        size = min<size_t>(size, EMULATOR_USB_PACKET_SIZE);
+    }
+
+    /* Output already queued goes first */
+    size_t count = min(size, pending_.size() - pending_head_);
+    memcpy(data, &pending_[pending_head_], count);
+    pending_head_ += count;
+    if(pending_head_ == pending_.size())
+    {
+        pending_.clear();
+        pending_head_ = 0;
+    }
+
+    /* Then read data is generated straight into the host's buffer */
+    out_ = &data[count];
+    out_end_ = &data[size];
+    while(out_ < out_end_ && generate())
+    {
+    }
+    if(out_ == data && compress_time && waiting())
+    {
+        expire();
+        while(out_ < out_end_ && generate())
+        {
+        }
+    }
+
+    size_t actual = out_ - data;
+    out_ = nullptr;
+    out_end_ = nullptr;
+    line_bytes += actual;
+    line_us += actual * 10 * 1e6 / link_rate_;
+    if(options_.realtime && actual)
+    {
+        pace_uart_us_ += actual * 10 * 1e6 / link_rate_;
+        pace();
+    }
+    return actual;
+}
+
+bool ReaderEmulator::waiting(void)
+{
+    return state_ == EMU_READ && framed_ && next_seq_ != acked_seq_;
+}
+
+void ReaderEmulator::expire(void)
+{
+    switch(state_)
+    {
+        case EMU_LINK_TEST:
+        case EMU_LINK_CONFIRM:
+            link_rate_ = LINK_BASE_BAUD_RATE;
+            state_ = EMU_COMMAND;
+            break;
+
+        case EMU_READ:
+            if(!waiting())
+            {
+                break;
+            }
+            if(++retries_ > EMULATOR_FRAME_RETRIES)
+            {
+                frame_active_ = false;
+                event(EVENT_FRAME_FAILED);
+                finish_read();
+                break;
+            }
+            ++frame_timeouts_;
+            frame_resend(acked_seq_);
+            break;
+
+        default:
+            break;
+    }
+}
+
+/* Take as long as the target clock and the link would */
+void ReaderEmulator::pace(void)
+{
+    double clock_us = (model.clocks - pace_clocks_) * 1000.0 / clock_khz_;
+    double target_us = max(clock_us, pace_uart_us_);
+    this_thread::sleep_until(pace_start_ + chrono::microseconds((int64_t)target_us));
+}
+
+/******************************************************************************/
+/* Output */
+/******************************************************************************/
+
+void ReaderEmulator::emit(uint8_t value)
+{
+    /* Line faults only hit read data, so the handshakes still get through */
+    if(noisy_)
+    {
+        if(options_.dropped_bytes > 0.0 && chance_(random_) < options_.dropped_bytes)
+        {
+            return;
+        }
+        if(options_.line_errors > 0.0 && chance_(random_) < options_.line_errors)
+        {
+            value ^= 1 << (random_() & 7);
+        }
+    }
+
+    if(pending_head_ == pending_.size() && out_ < out_end_)
+    {
+        *out_++ = value;
+        return;
+    }
+    pending_.push_back(value);
+}
+
+void ReaderEmulator::emit(const uint8_t *data, size_t size)
+{
+    for(size_t i = 0; i < size; i++)
+    {
+        emit(data[i]);
+    }
+}
+
+/* Binary log event, arguments as unsigned LEB128 varints */
+void ReaderEmulator::event(uint8_t id, vector<uint32_t> args)
+{
+    vector<uint8_t> data = {id, (uint8_t)args.size()};
+    for(uint32_t value : args)
+    {
+        while(value >= 0x80)
+        {
+            data.push_back((value & 0x7F) | 0x80);
+            value >>= 7;
+        }
+        data.push_back(value);
+    }
+
+    /* A framed dump sends everything in frames */
+    if(frame_active_)
+    {
+        frame_send(FRAME_EVENT, data.data(), data.size());
+        return;
+    }
+    emit(SUB_CMD_EVENT);
+    emit(data.data(), data.size());
+}
+
+void ReaderEmulator::log(const char *fmt, ...)
+{
+    char message[EMULATOR_MAX_MESSAGE];
+    memset(message, 0, sizeof(message));
+    va_list ap;
+    va_start(ap, fmt);
+    vsnprintf(message, sizeof(message) - 1, fmt, ap);
+    va_end(ap);
+
+    size_t size = strlen(message);
+    emit(SUB_CMD_LOG);
+    emit(size);
+    emit((const uint8_t *)message, size);
+}
+
+void ReaderEmulator::acknowledge(uint8_t command)
+{
+    emit(COMMS_ACK);
+    emit(command);
+}
+
+void ReaderEmulator::send_ready(void)
+{
+    emit(SUB_CMD_READY);
+    emit(ready_magic, sizeof(ready_magic));
+    emit(PROTOCOL_VERSION);
+}
+
+/* Like comms_send_stats() */
+void ReaderEmulator::send_stats(void)
+{
+    const uint32_t *fields = (const uint32_t *)&stats_;
+    emit(SUB_CMD_STATS);
+    emit(kStatsFields * sizeof(uint32_t));
+    for(int i = 0; i < kStatsFields; i++)
+    {
+        for(int j = 0; j < 4; j++)
+        {
+            emit((fields[i] >> (j * 8)) & 0xFF);
+        }
+    }
+}
+
+/******************************************************************************/
+/* Commands */
+/******************************************************************************/
+
+/* Handle input until the current state needs more, or is generating output */
+void ReaderEmulator::process_input(void)
+{
+    while(input_head_ < input_.size())
+    {
+        size_t available = input_.size() - input_head_;
+        uint8_t value = input_[input_head_];
+
+        switch(state_)
+        {
+            case EMU_COMMAND:
+                ++input_head_;
+                dispatch(value);
+                break;
+
+            case EMU_ECHO:
+                ++input_head_;
+                emit(value);
+                if(value == ASCII_ESC)
+                {
+                    end_command();
+                }
+                break;
+
+            case EMU_LINK_RATE:
+                if(available < 4)
+                {
+                    return;
+                }
+                link_request_ = 0;
+                for(int i = 0; i < 4; i++)
+                {
+                    link_request_ |= (uint32_t)input_[input_head_++] << (i * 8);
+                }
+                state_ = EMU_COMMAND;
+                for(int rate : link_baud_rates)
+                {
+                    if((uint32_t)rate == link_request_)
+                    {
+                        state_ = EMU_LINK_TEST;
+                    }
+                }
+                emit(state_ == EMU_LINK_TEST ? COMMS_ACK : COMMS_NACK);
+                link_count_ = 0;
+                break;
+
+            case EMU_LINK_TEST:
+                ++input_head_;
+                emit(value);
+                if(++link_count_ == LINK_TEST_SIZE)
+                {
+                    state_ = EMU_LINK_CONFIRM;
+                }
+                break;
+
+            case EMU_LINK_CONFIRM:
+                ++input_head_;
+                if(value == COMMS_ACK)
+                {
+                    emit(COMMS_ACK);
+                    link_rate_ = link_request_;
+                }
+                else
+                {
+                    link_rate_ = LINK_BASE_BAUD_RATE;
+                }
+                state_ = EMU_COMMAND;
+                break;
+
+            case EMU_PARAM_SIZE:
+                ++input_head_;
+                parameter_size_ = value;
+                parameter_count_ = 0;
+                memset(parameters_, 0, sizeof(parameters_));
+                event(EVENT_GET_PARAMETERS, {value});
+                state_ = EMU_PARAMS;
+                if(parameter_size_ == 0)
+                {
+                    start_read();
+                }
+                break;
+
+            case EMU_PARAMS:
+                ++input_head_;
+                if(parameter_count_ < EMULATOR_MAX_PARAMETERS)
+                {
+                    parameters_[parameter_count_] = value;
+                }
+                if(++parameter_count_ == parameter_size_)
+                {
+                    start_read();
+                }
+                break;
+
+            case EMU_READ:
+                if(framed_)
+                {
+                    if(!frame_control())
+                    {
+                        return;
+                    }
+                    break;
+                }
+                ++input_head_;
+                if(value == ASCII_ESC)
+                {
+                    stop_requested_ = true;
+                }
+                break;
+
+            case EMU_HALTED:
+                input_head_ = input_.size();
+                break;
+        }
+    }
+
+    input_.clear();
+    input_head_ = 0;
+}
+
+void ReaderEmulator::dispatch(uint8_t command)
+{
+    pace_start_ = chrono::steady_clock::now();
+    pace_clocks_ = model.clocks;
+    pace_uart_us_ = 0.0;
+
+    /* Windows sends 0xF0-0xFF when opening a COM port */
+    if(command & 0x80)
+    {
+        end_command();
+        return;
+    }
+
+    switch(command)
+    {
+        case CMD_NOP:
+            acknowledge(command);
+            end_command();
+            break;
+
+        case CMD_ECHO:
+            acknowledge(command);
+            state_ = EMU_ECHO;
+            break;
+
+        case CMD_READ:
+            acknowledge(command);
+            emit(SUB_CMD_GET_PARAMETERS);
+            state_ = EMU_PARAM_SIZE;
+            break;
+
+        case CMD_LINK:
+            acknowledge(command);
+            state_ = EMU_LINK_RATE;
+            break;
+
+        case CMD_SYNC:
+            acknowledge(command);
+            send_ready();
+            end_command();
+            break;
+
+        case CMD_STATS:
+            acknowledge(command);
+            send_stats();
+            emit(SUB_CMD_EXIT);
+            end_command();
+            break;
+
+        default:
+            emit(COMMS_NACK);
+            emit(command);
+            end_command();
+            break;
+    }
+}
+
+/* Back to the base rate after every command except CMD_LINK, like link_reset() */
+void ReaderEmulator::end_command(void)
+{
+    state_ = EMU_COMMAND;
+    link_rate_ = LINK_BASE_BAUD_RATE;
+}
+
+void ReaderEmulator::start_read(void)
+{
+    random_.seed(options_.seed);
+    state_ = EMU_READ;
+    mode_ = parameters_[READ_PARAM_MODE];
+    stats_ = {};
+    timing_ = parameters_[READ_PARAM_FLAGS] & READ_FLAG_TIMING;
+    event(EVENT_READ_MODE, {mode_});
+
+    /* The same rounding as the Timer1 clock engine at 16 MHz */
+    uint16_t rate_khz = parameters_[READ_PARAM_CLOCK_LO] | parameters_[READ_PARAM_CLOCK_HI] << 8;
+    if(rate_khz == 0)
+    {
+        clock_khz_ = EMULATOR_CLOCK_LEGACY_KHZ;
+        event(EVENT_CLOCK_LEGACY);
+    }
+    else
+    {
+        rate_khz = max<uint16_t>(rate_khz, EMULATOR_CLOCK_MIN_KHZ);
+        rate_khz = min<uint16_t>(rate_khz, EMULATOR_CLOCK_MAX_KHZ);
+        clock_khz_ = 8000 / (8000 / rate_khz);
+        event(EVENT_CLOCK_TIMER, {clock_khz_});
+    }
+    if(parameters_[READ_PARAM_FLAGS] & READ_FLAG_UNROLLED)
+    {
+        event(EVENT_CLOCK_UNROLLED, {EMULATOR_CLOCK_UNROLLED_KHZ});
+    }
+
+    switch(mode_)
+    {
+        case 0x00:
+            read_raw_cycles();
+            finish_read();
+            break;
+
+        case 0x01:
+            validate_adl_1bit();
+            finish_read();
+            break;
+
+        case 0x02:
+            test_address_wrapping();
+            finish_read();
+            break;
+
+        case 0x03:
+            test_address_output(true);
+            finish_read();
+            break;
+
+        case 0x04:
+            test_address_output(false);
+            finish_read();
+            break;
+
+        case 0x05:
+            test_dump();
+            finish_read();
+            break;
+
+        case 0x06:
+            phase_ = READ_SEEK;
+            break;
+
+        case 0x07:
+            /* free_run() never returns, the target has to be reset */
+            emit(SUB_CMD_EXIT);
+            state_ = EMU_HALTED;
+            break;
+
+        case 0x08:
+            start_ = (parameters_[READ_PARAM_START_LO] | parameters_[READ_PARAM_START_HI] << 8) & (ROM_SIZE - 1);
+            length_ = parameters_[READ_PARAM_LENGTH_LO] | parameters_[READ_PARAM_LENGTH_HI] << 8;
+            if(length_ == 0 || length_ > ROM_SIZE)
+            {
+                length_ = ROM_SIZE;
+            }
+            passes_ = parameters_[READ_PARAM_PASSES] ? parameters_[READ_PARAM_PASSES] : 1;
+            framed_ = parameters_[READ_PARAM_FLAGS] & READ_FLAG_FRAMED;
+            stop_requested_ = false;
+            phase_ = READ_SEEK;
+            break;
+
+        case 0x09:
+            phase_ = READ_SEEK;
+            break;
+
+        default:
+            event(EVENT_UNKNOWN_MODE, {mode_});
+            finish_read();
+            break;
+    }
+}
+
+void ReaderEmulator::finish_read(void)
+{
+    noisy_ = false;
+    frame_active_ = false;
+    event(EVENT_UART_STATS, {0, EMULATOR_TX_RING_SIZE - 1, 0, 0});
+    stats_.read_us = (uint32_t)(stats_.clocks * 1000.0 / clock_khz_);
+    stats_.clock_us = timing_ ? stats_.read_us : 0;
+    send_stats();
+    event(EVENT_NORMAL_EXIT);
+    emit(SUB_CMD_EXIT);
+    framed_ = false;
+    end_command();
+}
+
+/* Generate more of a read, returns false when waiting on the host or done */
+bool ReaderEmulator::generate(void)
+{
+    if(state_ != EMU_READ)
+    {
+        return false;
+    }
+    switch(mode_)
+    {
+        case 0x06:
+            return binary_dump_step();
+
+        case 0x09:
+            return snapshot_dump_step();
+
+        default:
+            return compact_dump_step();
+    }
+}
+
+/******************************************************************************/
+/* Target access */
+/******************************************************************************/
+
+void ReaderEmulator::clock_target(uint32_t count)
+{
+    model.clock(count);
+    clock_us += count * 1000.0 / clock_khz_;
+    stats_.clocks += count;
+}
+
+void ReaderEmulator::reset_target(void)
+{
+    model.set_reset(true);
+    model.clock(EMULATOR_RESET_CLOCKS);
+    model.set_reset(false);
+    clock_us += EMULATOR_RESET_CLOCKS * 1000.0 / clock_khz_;
+    stats_.clocks += EMULATOR_RESET_CLOCKS;
+}
+
+void ReaderEmulator::get_target_state(bus_state &state)
+{
+    model.sample(state);
+    if(options_.bus_errors > 0.0 && chance_(random_) < options_.bus_errors)
+    {
+        state.adl ^= 1 << (random_() & 7);
+    }
+}
+
+uint16_t ReaderEmulator::decode_address(const bus_state &state)
+{
+    uint8_t adh = (state.ah & 0x0C) | ((state.ah >> 1) & 0x01) | ((state.ah << 1) & 0x02);
+    return adh << 8 | shuffle(state.adl);
+}
+
+/******************************************************************************/
+/* Read modes */
+/******************************************************************************/
+
+void ReaderEmulator::read_raw_cycles(void)
+{
+    int cycles = 0;
+    bus_state &state = bus_[0];
+
+    reset_target();
+    log("START\n");
+
+    do
+    {
+        clock_target(1);
+        get_target_state(state);
+    } while((state.strobe == 0 || state.ah != 0x0F || state.adl != 0xFE) && ++cycles < EMULATOR_SCAN_LIMIT);
+
+    log("Started output sequence in %02X cycles.\n", cycles);
+    for(int i = 0; i < 0x18; i++)
+    {
+        log("%08X : TEST=%d | NUM=%d | AH:%02X ADL:%02X\n", i, state.strobe, state.num, state.ah, state.adl);
+        clock_target(1);
+        get_target_state(state);
+    }
+    log("END\n");
+}
+
+void ReaderEmulator::validate_adl_1bit(void)
+{
+    int cycles = 0;
+    bus_state &state = bus_[0];
+
+    reset_target();
+    log("START\n");
+
+    do
+    {
+        clock_target(1);
+        get_target_state(state);
+    } while((state.strobe == 0 || state.ah != 0x0F || state.adl != 0xFE) && ++cycles < EMULATOR_SCAN_LIMIT);
+
+    log("Started boot sequence in %02X cycles.\n", cycles);
+    for(int i = 0; i < 4; i++)
+    {
+        log("%02X ", state.adl);
+        clock_target(4);
+        get_target_state(state);
+    }
+
+    cycles = 0;
+    log("Scanning for address zero.\n");
+    for(int i = 0; i < 0x10000; i++)
+    {
+        if(state.adl == 0x00 && state.ah == 0x00)
+        {
+            break;
+        }
+        clock_target(8);
+        get_target_state(state);
+        ++cycles;
+    }
+    clock_target(4);
+    log("Found zero in %08X cycles.\n", cycles);
+
+    clock_target(4);
+    get_target_state(state);
+
+    cycles = 0;
+    int segment = 0;
+    log("Scanning for address max.\n");
+    for(int i = 0; i < 0x20000; i++)
+    {
+        if(++segment == 0x800)
+        {
+            log("seg=%08X\n", i);
+            segment = 0;
+        }
+        if(state.adl == 0xFF && state.ah == 0x0F)
+        {
+            break;
+        }
+        clock_target(8);
+        get_target_state(state);
+        ++cycles;
+    }
+    clock_target(4);
+    log("Found max in %08X cycles.\n", cycles);
+
+    log("Started output sequence:\n");
+    for(int i = 0; i < 0x100; i++)
+    {
+        if((i & 0x0F) == 0x00)
+        {
+            log("%08X : %04X: ", i, (i & 0xFF) | state.ah << 8);
+        }
+        log("%02X ", state.adl);
+        clock_target(4);
+        get_target_state(state);
+        clock_target(4);
+        if((i & 0x0F) == 0x0F)
+        {
+            log("\n");
+        }
+    }
+    log("END\n");
+}
+
+/* Step one clock at a time until the raw bus shows an address */
+uint32_t ReaderEmulator::seek_bus_cycle(uint16_t address, uint32_t limit)
+{
+    uint8_t adh = (address >> 8) & 0xFF;
+    uint8_t adl = (address >> 0) & 0xFF;
+
+    if(limit == 0)
+    {
+        limit = EMULATOR_SCAN_LIMIT;
+    }
+
+    for(uint32_t cycles = 0; ; cycles++)
+    {
+        get_target_state(bus_[0]);
+        if(bus_[0].strobe == 1 && bus_[0].num == 0 && bus_[0].ah == adh && bus_[0].adl == adl)
+        {
+            return count_seek(cycles);
+        }
+        if(cycles >= limit)
+        {
+            count_seek(cycles);
+            return EMULATOR_SEEK_TIMEOUT;
+        }
+        clock_target(1);
+    }
+}
+
+/* Step one clock at a time until a logical address is on the bus */
+uint32_t ReaderEmulator::seek_address(uint16_t address, uint32_t limit)
+{
+    for(uint32_t cycles = 0; cycles <= limit; cycles++)
+    {
+        get_target_state(bus_[0]);
+        if(bus_[0].strobe == 1 && bus_[0].num == 0 && decode_address(bus_[0]) == address)
+        {
+            return count_seek(cycles);
+        }
+        clock_target(1);
+    }
+    count_seek(limit);
+    return EMULATOR_SEEK_TIMEOUT;
+}
+
+uint32_t ReaderEmulator::count_seek(uint32_t clocks)
+{
+    ++stats_.seeks;
+    stats_.seek_clocks += clocks;
+    stats_.seek_max = max(stats_.seek_max, clocks);
+    return clocks;
+}
+
+void ReaderEmulator::test_address_wrapping(void)
+{
+    event(EVENT_TEST_WRAPPING);
+    reset_target();
+
+    event(EVENT_SEEK_FIRST);
+    event(EVENT_FOUND_FIRST, {seek_bus_cycle(0x0FFE)});
+
+    event(EVENT_SEEK_FIRST);
+    event(EVENT_FOUND_OUTPUT, {seek_bus_cycle(0x0EEA)});
+
+    event(EVENT_SEEK_ZERO);
+    event(EVENT_FOUND_WRAP, {seek_bus_cycle(0x0000)});
+
+    event(EVENT_SEEK_ZERO);
+    event(EVENT_FOUND_WRAP_LAST, {seek_bus_cycle(0x0FFF)});
+
+    event(EVENT_FINISHED);
+}
+
+void ReaderEmulator::test_address_output(bool dump)
+{
+    event(EVENT_TEST_WRAPPING);
+    reset_target();
+
+    event(EVENT_SEEK_FIRST);
+    event(EVENT_FOUND_FIRST, {seek_bus_cycle(0x0FFE)});
+
+    event(EVENT_SEEK_FIRST);
+    event(EVENT_FOUND_OUTPUT, {seek_bus_cycle(0x0EEA)});
+
+    event(EVENT_SEEK_ZERO);
+    event(EVENT_FOUND_WRAP, {seek_bus_cycle(0x0000)});
+
+    int write_count = 0;
+    uint32_t cycles_elapsed = 0;
+    uint8_t latched_ah = 0xFF;
+    bus_state &state = bus_[0];
+
+    while(cycles_elapsed < EMULATOR_SCAN_LIMIT)
+    {
+        get_target_state(state);
+
+        if(state.num == 0)
+        {
+            if(dump)
+            {
+                event(EVENT_ADDRESS, {(uint32_t)(state.ah << 8 | state.adl)});
+            }
+            else
+            {
+                if((write_count & 0x0F) == 0x00)
+                {
+                    event(EVENT_ROW_START, {cycles_elapsed, state.ah});
+                    latched_ah = state.ah;
+                }
+                event(EVENT_ROW_DATA, {state.adl, (uint32_t)((latched_ah != state.ah) ? '*' : ' ')});
+                if((write_count & 0x0F) == 0x0F)
+                {
+                    event(EVENT_NEWLINE);
+                }
+                ++write_count;
+            }
+        }
+
+        if(state.strobe == 1 && state.num == 0 && state.ah == 0x0F && state.adl == 0xFF)
+        {
+            break;
+        }
+
+        clock_target(8);
+        ++cycles_elapsed;
+    }
+    event(EVENT_NEWLINE);
+
+    event(EVENT_SEEK_ZERO);
+    event(EVENT_FOUND_WRAP_LAST, {seek_bus_cycle(0x0FFF)});
+    event(EVENT_FINISHED);
+}
+
+void ReaderEmulator::test_dump(void)
+{
+    event(EVENT_TEST_WRAPPING);
+    reset_target();
+
+    event(EVENT_SEEK_FIRST);
+    event(EVENT_FOUND_FIRST, {seek_bus_cycle(0x0FFE)});
+
+    event(EVENT_SEEK_FIRST);
+    event(EVENT_FOUND_OUTPUT, {seek_bus_cycle(0x0EEA)});
+
+    event(EVENT_SEEK_ZERO);
+    event(EVENT_FOUND_WRAP, {seek_bus_cycle(0x0000)});
+
+    for(int address = 0; address < ROM_SIZE; address++)
+    {
+        for(int i = 0; i < 4; i++)
+        {
+            get_target_state(bus_[i]);
+            clock_target(2);
+        }
+        event(EVENT_DUMP_ENTRY, {bus_[0].ah, bus_[0].adl, bus_[1].adl, bus_[3].adl});
+    }
+    event(EVENT_NEWLINE);
+
+    event(EVENT_SEEK_ZERO);
+    event(EVENT_FOUND_WRAP_LAST, {seek_bus_cycle(0x0FFF)});
+    event(EVENT_FINISHED);
+}
+
+/* Reset the target and step to the entry address of the output sequence,
+   bursting most of the way to 0xFFE once the distance has been saved */
+uint16_t ReaderEmulator::seek_entry(void)
+{
+    uint32_t cycles = EMULATOR_SEEK_TIMEOUT;
+    event(EVENT_TEST_WRAPPING);
+    reset_target();
+
+    event(EVENT_SEEK_FIRST);
+    if(saved_reset_clocks_ > EMULATOR_SEEK_MARGIN)
+    {
+        uint32_t burst = saved_reset_clocks_ - EMULATOR_SEEK_MARGIN;
+        clock_target(burst);
+        cycles = seek_bus_cycle(0x0FFE, 2 * EMULATOR_SEEK_MARGIN);
+        if(cycles != EMULATOR_SEEK_TIMEOUT)
+        {
+            event(EVENT_FOUND_FIRST_FAST, {burst, cycles});
+            cycles += burst;
+        }
+        else
+        {
+            event(EVENT_CALIBRATION_STALE, {0x0FFE});
+            reset_target();
+            event(EVENT_SEEK_FIRST);
+        }
+    }
+    if(cycles == EMULATOR_SEEK_TIMEOUT)
+    {
+        cycles = seek_bus_cycle(0x0FFE);
+        event(EVENT_FOUND_FIRST, {cycles});
+    }
+    reset_clocks_ = cycles;
+
+    clock_target(EMULATOR_ENTRY_CLOCKS);
+    get_target_state(bus_[0]);
+    for(int i = 0; i < 8 && bus_[0].num != 0; i++)
+    {
+        clock_target(1);
+        get_target_state(bus_[0]);
+    }
+
+    uint16_t entry = decode_address(bus_[0]);
+    event(EVENT_FOUND_ENTRY, {entry});
+    return entry;
+}
+
+void ReaderEmulator::save_calibration(uint16_t entry, uint32_t wrap_clocks)
+{
+    calibration_[entry] = wrap_clocks;
+    saved_reset_clocks_ = reset_clocks_;
+    event(EVENT_CALIBRATION_SAVED, {entry, wrap_clocks});
+}
+
+/* Seek to the address wrap, using the calibration from an earlier read if there is one */
+void ReaderEmulator::seek_address_wrap(void)
+{
+    uint16_t entry = seek_entry();
+    uint32_t cycles;
+
+    event(EVENT_SEEK_ZERO);
+    auto calibration = calibration_.find(entry);
+    if(calibration != calibration_.end() && calibration->second > EMULATOR_SEEK_MARGIN)
+    {
+        uint32_t burst = calibration->second - EMULATOR_SEEK_MARGIN;
+        clock_target(burst);
+        cycles = seek_bus_cycle(0x0000, 2 * EMULATOR_SEEK_MARGIN);
+        if(cycles != EMULATOR_SEEK_TIMEOUT)
+        {
+            event(EVENT_FOUND_WRAP_FAST, {burst, cycles});
+            if(burst + cycles != calibration->second || reset_clocks_ != saved_reset_clocks_)
+            {
+                save_calibration(entry, burst + cycles);
+            }
+            return;
+        }
+
+        event(EVENT_CALIBRATION_STALE, {entry});
+        entry = seek_entry();
+        event(EVENT_SEEK_ZERO);
+    }
+
+    cycles = seek_bus_cycle(0x0000);
+    event(EVENT_FOUND_WRAP, {cycles});
+    save_calibration(entry, cycles);
+}
+
+/* Mode 6, the full bus state of every address in pages */
+bool ReaderEmulator::binary_dump_step(void)
+{
+    switch(phase_)
+    {
+        case READ_SEEK:
+            seek_address_wrap();
+            /* Bursts only change when data is sent, not what is sent */
+            if(parameters_[READ_PARAM_FLAGS] & READ_FLAG_BURST)
+            {
+                event(EVENT_BURST_SIZE, {EMULATOR_BURST_ADDRESSES});
+            }
+            count_ = 0;
+            index_ = 0;
+            checksum_ = EMULATOR_CHECKSUM_INIT;
+            last_offset_ = 0xFFFF;
+            phase_ = READ_DUMP;
+            return true;
+
+        case READ_DUMP:
+            {
+                uint16_t address = count_;
+                if((last_offset_ & 0x0100) != (address & 0x0100))
+                {
+                    event(EVENT_READ_OFFSET, {address});
+                    last_offset_ = address;
+                }
+
+                for(int i = 0; i < 4; i++)
+                {
+                    get_target_state(bus_[i]);
+                    clock_target(2);
+                }
+
+                uint8_t *entry = &page_[index_];
+                entry[0] = bus_[0].ah;
+                entry[1] = bus_[0].adl;
+                entry[2] = bus_[1].ah;
+                entry[3] = bus_[3].adl;
+                if(address >= EMULATOR_RIOT_SIZE)
+                {
+                    checksum_ += entry[0] + entry[1] + entry[2] + entry[3];
+                }
+
+                index_ += 4;
+                if(index_ >= EMULATOR_PAGE_SIZE)
+                {
+                    noisy_ = true;
+                    emit(SUB_CMD_SEND_PAGE);
+                    emit(page_, EMULATOR_PAGE_SIZE);
+                    noisy_ = false;
+                    index_ = 0;
+                }
+                if(++count_ == ROM_SIZE)
+                {
+                    phase_ = READ_DONE;
+                }
+            }
+            return true;
+
+        default:
+            event(EVENT_CHECKSUM, {checksum_});
+            event(EVENT_FINISHED);
+            finish_read();
+            return true;
+    }
+}
+
+/* The ports behind a bus state, as the firmware reads them. Pins that
+   aren't on the bus are high: the idle UART lines on port D, RES_N and
+   EXTAL on port B. */
+static void encode_ports(const bus_state &state, uint8_t &pind, uint8_t &pinb, uint8_t &pinc)
+{
+    pind = (state.adl & 0xFC) | 0x03;
+    pinb = ((state.adl & 0x03) << 3) | 0x03;
+    pinc = (state.ah & 0x07) | ((state.ah & 0x08) << 1) | (state.strobe << 3) | (state.num << 5);
+}
+
+/* Mode 9, the ports as read for every address, packed into pages and
+   decoded by the host */
+bool ReaderEmulator::snapshot_dump_step(void)
+{
+    switch(phase_)
+    {
+        case READ_SEEK:
+            seek_address_wrap();
+            /* Bursts only change when data is sent, not what is sent */
+            if(parameters_[READ_PARAM_FLAGS] & READ_FLAG_BURST)
+            {
+                event(EVENT_BURST_SIZE, {EMULATOR_SNAPSHOT_BURST});
+            }
+            count_ = 0;
+            index_ = 0;
+            checksum_ = EMULATOR_CHECKSUM_INIT;
+            phase_ = READ_DUMP;
+            return true;
+
+        case READ_DUMP:
+            {
+                uint16_t address = count_;
+                if((address & 0xFF) == 0)
+                {
+                    event(EVENT_READ_OFFSET, {address});
+                }
+
+                for(int i = 0; i < 4; i++)
+                {
+                    get_target_state(bus_[i]);
+                    clock_target(2);
+                }
+
+                uint8_t ports[EMULATOR_SNAPSHOT_SIZE];
+                uint8_t unused;
+                encode_ports(bus_[0], ports[0], ports[1], ports[2]);
+                encode_ports(bus_[1], unused, unused, ports[3]);
+                encode_ports(bus_[3], ports[4], ports[5], unused);
+
+                /* A snapshot can straddle two pages */
+                for(uint8_t value : ports)
+                {
+                    checksum_ += value;
+                    page_[index_++] = value;
+                    if(index_ == EMULATOR_PAGE_SIZE)
+                    {
+                        noisy_ = true;
+                        emit(SUB_CMD_SEND_PAGE);
+                        emit(page_, EMULATOR_PAGE_SIZE);
+                        noisy_ = false;
+                        index_ = 0;
+                    }
+                }
+                if(++count_ == ROM_SIZE)
+                {
+                    phase_ = READ_DONE;
+                }
+            }
+            return true;
+
+        default:
+            event(EVENT_CHECKSUM, {checksum_});
+            event(EVENT_FINISHED);
+            finish_read();
+            return true;
+    }
+}
+
+/* Mode 8, data bytes for a range of addresses over one or more passes */
+bool ReaderEmulator::compact_dump_step(void)
+{
+    switch(phase_)
+    {
+        case READ_SEEK:
+            seek_address_wrap();
+            if(framed_)
+            {
+                frame_begin();
+            }
+            skip_ = start_;
+            pass_ = 0;
+            phase_ = READ_PASS_START;
+            return true;
+
+        case READ_PASS_START:
+            /* Every address takes the same number of clocks, so skip straight to the start */
+            if(skip_)
+            {
+                int clocks = skip_ * 2 * HD6805_CLOCKS_PER_CYCLE - EMULATOR_SEEK_MARGIN;
+                if(clocks > 0)
+                {
+                    clock_target(clocks);
+                }
+                uint32_t cycles = seek_address(start_, 2 * EMULATOR_SEEK_MARGIN);
+                if(cycles == EMULATOR_SEEK_TIMEOUT)
+                {
+                    event(EVENT_SEEK_FAILED, {start_});
+                    phase_ = READ_FAILED;
+                    return true;
+                }
+                event(EVENT_FOUND_START, {start_, cycles});
+            }
+            skip_ = ROM_SIZE - length_;
+            count_ = 0;
+            index_ = 0;
+            checksum_ = EMULATOR_CHECKSUM_INIT;
+            exceptions_ = 0;
+            phase_ = READ_DUMP;
+            return true;
+
+        case READ_DUMP:
+            {
+                /* Up to three frames go out per address, wait for room first */
+                if(framed_ && !frame_flush())
+                {
+                    return false;
+                }
+
+                uint16_t address = (start_ + count_) & (ROM_SIZE - 1);
+                for(int i = 0; i < 4; i++)
+                {
+                    get_target_state(bus_[i]);
+                    clock_target(2);
+                }
+
+                noisy_ = true;
+                if(decode_address(bus_[0]) != address || bus_[1].ah != bus_[0].ah)
+                {
+                    if(index_)
+                    {
+                        send_block(index_);
+                    }
+                    index_ = 0;
+                    send_exception(address);
+                    ++exceptions_;
+                    ++stats_.mismatches;
+                }
+
+                if(address >= EMULATOR_RIOT_SIZE)
+                {
+                    checksum_ += bus_[0].ah + bus_[0].adl + bus_[1].ah + bus_[3].adl;
+                }
+
+                page_[index_++] = bus_[3].adl;
+                if(index_ >= EMULATOR_PAGE_SIZE || count_ == length_ - 1)
+                {
+                    send_block(index_);
+                    index_ = 0;
+                }
+                noisy_ = false;
+
+                if(++count_ == length_)
+                {
+                    phase_ = READ_PASS_END;
+                }
+            }
+            return true;
+
+        case READ_PASS_END:
+            /* Every frame of the pass is acknowledged before its result */
+            if(framed_ && (!frame_flush() || next_seq_ != acked_seq_))
+            {
+                return false;
+            }
+            event(EVENT_PASS_RESULT, {(uint32_t)pass_ + 1, exceptions_, checksum_});
+
+            /* Let the host see the end of the pass before deciding to stop */
+            phase_ = READ_PASS_CHECK;
+            return false;
+
+        case READ_PASS_CHECK:
+            if(pass_ + 1 < passes_ && stop_requested_)
+            {
+                event(EVENT_PASSES_STOPPED, {(uint32_t)pass_ + 1});
+                phase_ = READ_DONE;
+            }
+            else
+            {
+                phase_ = (++pass_ < passes_) ? READ_PASS_START : READ_DONE;
+            }
+            return true;
+
+        case READ_FAILED:
+            if(!frame_end())
+            {
+                return false;
+            }
+            finish_read();
+            return true;
+
+        default:
+            if(!frame_end())
+            {
+                return false;
+            }
+            if(framed_)
+            {
+                event(EVENT_FRAME_STATS, {frames_sent_, frames_resent_, frame_naks_, frame_timeouts_});
+            }
+            event(EVENT_FINISHED);
+            finish_read();
+            return true;
+    }
+}
+
+/******************************************************************************/
+/* Frames */
+/******************************************************************************/
+
+void ReaderEmulator::frame_begin(void)
+{
+    outbox_.clear();
+    next_seq_ = 0;
+    acked_seq_ = 0;
+    retries_ = 0;
+    frames_sent_ = 0;
+    frames_resent_ = 0;
+    frame_naks_ = 0;
+    frame_timeouts_ = 0;
+    frame_active_ = true;
+    frame_ending_ = false;
+    emit(frame_sync, sizeof(frame_sync));
+}
+
+void ReaderEmulator::frame_send(uint8_t type, const uint8_t *data, uint8_t size)
+{
+    frame_slot slot;
+    slot.type = type;
+    slot.size = size;
+    if(size)
+    {
+        memcpy(slot.data, data, size);
+    }
+    outbox_.push_back(slot);
+    frame_flush();
+}
+
+/* Send queued frames while the window has room, returns true once all are sent */
+bool ReaderEmulator::frame_flush(void)
+{
+    size_t sent = 0;
+    while(sent < outbox_.size() && (uint16_t)(next_seq_ - acked_seq_) < EMULATOR_FRAME_WINDOW)
+    {
+        window_[next_seq_ % EMULATOR_FRAME_WINDOW] = outbox_[sent++];
+        frame_transmit(next_seq_++);
+        ++frames_sent_;
+    }
+    outbox_.erase(outbox_.begin(), outbox_.begin() + sent);
+    return outbox_.empty();
+}
+
+/* Queue FRAME_END, returns true once it is acknowledged and sub-commands go bare again */
+bool ReaderEmulator::frame_end(void)
+{
+    if(!frame_active_)
+    {
+        return true;
+    }
+    if(!frame_ending_)
+    {
+        frame_send(FRAME_END, nullptr, 0);
+        frame_ending_ = true;
+    }
+    if(!frame_flush() || next_seq_ != acked_seq_)
+    {
+        return false;
+    }
+    frame_active_ = false;
+    return true;
+}
+
+void ReaderEmulator::frame_transmit(uint16_t seq)
+{
+    frame_slot &slot = window_[seq % EMULATOR_FRAME_WINDOW];
+    uint8_t header[] = {slot.type, (uint8_t)(seq & 0xFF), (uint8_t)(seq >> 8), slot.size};
+    uint16_t crc = FRAME_CRC_INIT;
+
+    for(uint8_t value : header)
+    {
+        crc = crc16_update(crc, value);
+    }
+    for(int i = 0; i < slot.size; i++)
+    {
+        crc = crc16_update(crc, slot.data[i]);
+    }
+
+    bool noisy = noisy_;
+    noisy_ = true;
+    emit(SUB_CMD_FRAME);
+    emit(header, sizeof(header));
+    emit(slot.data, slot.size);
+    emit((crc >> 0) & 0xFF);
+    emit((crc >> 8) & 0xFF);
+    noisy_ = noisy;
+}
+
+void ReaderEmulator::frame_resend(uint16_t seq)
+{
+    emit(frame_sync, sizeof(frame_sync));
+    for(; seq != next_seq_; seq++)
+    {
+        frame_transmit(seq);
+        ++frames_resent_;
+    }
+}
+
+/* Handle one acknowledgement or stop request, returns false if it hasn't all arrived */
+bool ReaderEmulator::frame_control(void)
+{
+    uint8_t control = input_[input_head_];
+    if(control != FRAME_ACK && control != FRAME_NAK)
+    {
+        stop_requested_ |= (control == ASCII_ESC);
+        ++input_head_;
+        return true;
+    }
+    if(input_.size() - input_head_ < 3)
+    {
+        return false;
+    }
+
+    uint16_t seq = input_[input_head_ + 1] | input_[input_head_ + 2] << 8;
+    input_head_ += 3;
+
+    /* Ignore anything outside the unacknowledged window */
+    if((uint16_t)(seq - acked_seq_) > (uint16_t)(next_seq_ - acked_seq_))
+    {
+        return true;
+    }
+    if(seq != acked_seq_)
+    {
+        acked_seq_ = seq;
+        retries_ = 0;
+    }
+    if(control == FRAME_NAK && seq != next_seq_)
+    {
+        ++frame_naks_;
+        frame_resend(seq);
+    }
+    return true;
+}
+
+bool ReaderEmulator::send_block(uint8_t size)
+{
+    if(framed_)
+    {
+        frame_send(FRAME_DATA, page_, size);
+        return true;
+    }
+    emit(SUB_CMD_SEND_DATA);
+    emit(size);
+    emit(page_, size);
+    return true;
+}
+
+void ReaderEmulator::send_exception(uint16_t address)
+{
+    uint8_t record[] = {
+        (uint8_t)((address >> 0) & 0xFF),
+        (uint8_t)((address >> 8) & 0xFF),
+        bus_[0].ah,
+        bus_[0].adl,
+        bus_[1].ah,
+        bus_[3].adl,
+    };
+
+    if(framed_)
+    {
+        frame_send(FRAME_EXCEPTION, record, sizeof(record));
+        return;
+    }
+    emit(SUB_CMD_EXCEPTION);
+    emit(record, sizeof(record));
+}
+
+/******************************************************************************/
+/******************************************************************************/
+
+/* Load a ROM image, a short image is padded with 0xFF */
+bool load_rom_image(const string &filename, vector<uint8_t> &rom)
+{
+    FILE *fd = fopen(filename.c_str(), "rb");
+    if(!fd)
+    {
+        printf("Error: Can't open file `%s' for reading.\n", filename.c_str());
+        return false;
+    }
+
+    rom.assign(ROM_SIZE + 1, 0xFF);
+    size_t size = fread(rom.data(), 1, rom.size(), fd);
+    fclose(fd);
+    if(size > ROM_SIZE)
+    {
+        printf("Error: ROM image `%s' is larger than %d bytes.\n", filename.c_str(), ROM_SIZE);
+        return false;
+    }
+    rom.resize(ROM_SIZE);
+    return true;
+}
+
+/* Run the emulator on a pseudo-terminal until killed */
+int serve_emulator(ReaderEmulator &emulator)
+{
+#ifdef _WIN32
+    printf("Error: The emulator needs a pseudo-terminal, use --emulate instead.\n");
+    return 1;
+#else
+    PtyTransport transport;
+    uint8_t buffer[EMULATOR_TX_RING_SIZE];
+
+    if(!transport.open(-1, ""))
+    {
+        return 1;
+    }
+
+    /* Timeouts happen in real time, the host may just not have caught up */
+    emulator.compress_time = false;
+    emulator.reset();
+    auto last_activity = chrono::steady_clock::now();
+    bool busy = false;
+
+    while(true)
+    {
+        size_t size = transport.read_some(buffer, sizeof(buffer), busy ? 0 : 1);
+        if(size)
+        {
+            emulator.receive(buffer, size);
+            last_activity = chrono::steady_clock::now();
+        }
+
+        /* Small writes, like the firmware's TX ring, so input is handled promptly */
+        size = emulator.transmit(buffer, sizeof(buffer));
+        busy = size != 0;
+        if(busy)
+        {
+            transport.write(buffer, size);
+            last_activity = chrono::steady_clock::now();
+            continue;
+        }
+
+        if(emulator.waiting() && chrono::steady_clock::now() - last_activity >= chrono::milliseconds(EMULATOR_FRAME_TIMEOUT_MS))
+        {
+            emulator.expire();
+            last_activity = chrono::steady_clock::now();
+        }
+    }
+    return 0;
+#endif
+}
+
+/* End */
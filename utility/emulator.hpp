@@ -0,0 +1,238 @@
+#pragma once
+
+#include <stdint.h>
+#include <chrono>
+#include <list>
+#include <map>
+#include <random>
+#include <string>
+#include <vector>
+#include "comms.hpp"
+#include "hd6805.hpp"
+#include "reader.hpp"
+#include "transport.hpp"
+using namespace std;
+
+/* Must match the firmware, see board.hpp, target.hpp and frame.hpp */
+#define EMULATOR_RESET_CLOCKS       8       /* kNumResetClocks */
+#define EMULATOR_ENTRY_CLOCKS       16      /* kEntryClocks */
+#define EMULATOR_SEEK_MARGIN        16      /* kSeekMargin */
+#define EMULATOR_CLOCK_MIN_KHZ      10      /* kClockRateMinKhz */
+#define EMULATOR_CLOCK_MAX_KHZ      400     /* kClockRateMaxKhz */
+#define EMULATOR_CLOCK_LEGACY_KHZ   40      /* Rough rate of the bit-banged EXTAL clock */
+#define EMULATOR_CLOCK_UNROLLED_KHZ 400     /* kUnrolledRateKhz */
+#define EMULATOR_TX_RING_SIZE       0x100   /* kUartTxRingSize */
+#define EMULATOR_MAX_PARAMETERS     0x10    /* kMaxParameters */
+#define EMULATOR_MAX_MESSAGE        0x80    /* kMaxMsgSize */
+#define EMULATOR_PAGE_SIZE          0x40    /* kPageSize */
+#define EMULATOR_BURST_ADDRESSES    256     /* kReadBufferSize in whole pages, see burst_dump() */
+#define EMULATOR_SNAPSHOT_SIZE      6       /* kSnapshotSize */
+#define EMULATOR_SNAPSHOT_BURST     170     /* kReadBufferSize / kSnapshotSize */
+#define EMULATOR_RIOT_SIZE          0x80    /* kRiotSize */
+#define EMULATOR_CHECKSUM_INIT      0x81    /* kChecksumInit */
+#define EMULATOR_FRAME_WINDOW       4       /* kFrameWindow */
+#define EMULATOR_FRAME_RETRIES      10      /* kFrameRetries */
+#define EMULATOR_FRAME_TIMEOUT_MS   100     /* kFrameTimeoutMs */
+#define EMULATOR_USB_PACKET_SIZE    0x40    /* Most a USB serial bridge hands over at once */
+
+/* Faults and timing for the emulated reader */
+class emulator_options
+{
+public:
+    double bus_errors = 0.0;        /* Chance of a bit flipping in each port B sample */
+    double line_errors = 0.0;       /* Chance of a bit flipping in each byte sent during a read */
+    double dropped_bytes = 0.0;     /* Chance of a byte sent during a read being lost */
+    bool realtime = false;          /* Take as long as the hardware would */
+    uint32_t seed = 1;
+};
+
+/* Looks like a reader running the firmware to the host. It is driven by
+   the host: input is handled as it arrives, and read data is generated
+   straight into the host's receive buffer when the host asks for more, so
+   the emulator never runs ahead of the host. Waits that time out on the
+   real firmware (missing frame acknowledgements) time out as soon as the
+   host has nothing more to read, unless the emulator is served in real
+   time, when expire() is called by whoever notices the timeout. */
+class ReaderEmulator : public TransportPeer
+{
+public:
+    ReaderEmulator(const vector<uint8_t> &rom, const emulator_options &options);
+
+    void receive(const uint8_t *data, size_t size) override;
+    size_t transmit(uint8_t *data, size_t size) override;
+    void reset(void) override;
+
+    /* True if a read is waiting on the host with nothing to send */
+    bool waiting(void);
+
+    /* The firmware's timeout expired while waiting */
+    void expire(void);
+
+    /* Time out waits as soon as the host runs dry, off when served in real time */
+    bool compress_time = true;
+
+    /* How long the hardware would have taken: EXTAL clocks at the selected
+       rate, and bytes in either direction at the link rate */
+    double clock_us = 0.0;
+    double line_us = 0.0;
+    uint64_t line_bytes = 0;
+
+    HD6805Model model;
+
+private:
+    enum emulator_state
+    {
+        EMU_COMMAND,
+        EMU_ECHO,
+        EMU_LINK_RATE,
+        EMU_LINK_TEST,
+        EMU_LINK_CONFIRM,
+        EMU_PARAM_SIZE,
+        EMU_PARAMS,
+        EMU_READ,
+        EMU_HALTED,
+    };
+
+    enum read_phase
+    {
+        READ_SEEK,
+        READ_PASS_START,
+        READ_DUMP,
+        READ_PASS_END,
+        READ_PASS_CHECK,
+        READ_FAILED,
+        READ_DONE,
+    };
+
+    class frame_slot
+    {
+    public:
+        uint8_t type;
+        uint8_t size;
+        uint8_t data[FRAME_MAX_SIZE];
+    };
+
+    /* Output */
+    void emit(uint8_t value);
+    void emit(const uint8_t *data, size_t size);
+    void event(uint8_t id, vector<uint32_t> args = {});
+    void log(const char *fmt, ...);
+    void acknowledge(uint8_t command);
+    void send_ready(void);
+    void send_stats(void);
+
+    /* Command handling */
+    void process_input(void);
+    void dispatch(uint8_t command);
+    void end_command(void);
+    void start_read(void);
+    void finish_read(void);
+    bool generate(void);
+    void pace(void);
+
+    /* Target access, the same as the firmware's target.cpp */
+    void clock_target(uint32_t count);
+    void reset_target(void);
+    void get_target_state(bus_state &state);
+    uint16_t decode_address(const bus_state &state);
+
+    /* Ports of the firmware's read modes */
+    void read_raw_cycles(void);
+    void validate_adl_1bit(void);
+    uint32_t seek_bus_cycle(uint16_t address, uint32_t limit = 0);
+    uint32_t seek_address(uint16_t address, uint32_t limit);
+    uint32_t count_seek(uint32_t clocks);
+    void test_address_wrapping(void);
+    void test_address_output(bool dump);
+    void test_dump(void);
+    uint16_t seek_entry(void);
+    void save_calibration(uint16_t entry, uint32_t wrap_clocks);
+    void seek_address_wrap(void);
+    bool binary_dump_step(void);
+    bool compact_dump_step(void);
+    bool snapshot_dump_step(void);
+
+    /* Framed transfer, the same as the firmware's frame.cpp */
+    void frame_begin(void);
+    void frame_send(uint8_t type, const uint8_t *data, uint8_t size);
+    bool frame_flush(void);
+    bool frame_end(void);
+    void frame_transmit(uint16_t seq);
+    void frame_resend(uint16_t seq);
+    bool frame_control(void);
+    bool send_block(uint8_t size);
+    void send_exception(uint16_t address);
+
+    const emulator_options &options_;       /* Read at use, so options can be changed later */
+    mt19937 random_;
+    uniform_real_distribution<double> chance_;
+
+    emulator_state state_ = EMU_COMMAND;
+    vector<uint8_t> input_;
+    size_t input_head_ = 0;
+    vector<uint8_t> pending_;
+    size_t pending_head_ = 0;
+    uint8_t *out_ = nullptr;
+    uint8_t *out_end_ = nullptr;
+    bool noisy_ = false;                    /* Line faults apply to what is sent */
+
+    /* Link */
+    uint32_t link_rate_ = LINK_BASE_BAUD_RATE;
+    uint32_t link_request_ = 0;
+    int link_count_ = 0;
+
+    /* Read command */
+    uint8_t parameters_[EMULATOR_MAX_PARAMETERS];
+    int parameter_size_ = 0;
+    int parameter_count_ = 0;
+    uint8_t mode_ = 0;
+    uint16_t clock_khz_ = EMULATOR_CLOCK_LEGACY_KHZ;
+    bus_state bus_[4];
+    map<uint16_t, uint32_t> calibration_;   /* The firmware keeps this in EEPROM */
+    uint32_t saved_reset_clocks_ = 0;       /* Reset distance saved with the calibration */
+    uint32_t reset_clocks_ = 0;             /* Reset distance found by the last seek_entry() */
+
+    /* Counters for the last read. Only EXTAL time is modeled, so with
+       READ_FLAG_TIMING all of the read is clocking. */
+    read_stats_t stats_ = {};
+    bool timing_ = false;
+
+    /* Dump progress */
+    read_phase phase_ = READ_DONE;
+    uint16_t start_ = 0;
+    uint16_t length_ = 0;
+    uint8_t passes_ = 1;
+    uint8_t pass_ = 0;
+    uint16_t count_ = 0;
+    uint16_t skip_ = 0;
+    uint8_t page_[EMULATOR_PAGE_SIZE];
+    size_t index_ = 0;
+    uint8_t checksum_ = EMULATOR_CHECKSUM_INIT;
+    uint16_t exceptions_ = 0;
+    uint16_t last_offset_ = 0xFFFF;
+    bool framed_ = false;
+    bool stop_requested_ = false;
+
+    /* Frames */
+    frame_slot window_[EMULATOR_FRAME_WINDOW];
+    vector<frame_slot> outbox_;
+    uint16_t next_seq_ = 0;
+    uint16_t acked_seq_ = 0;
+    int retries_ = 0;
+    bool frame_active_ = false;     /* Events go in frames, see frame_end() */
+    bool frame_ending_ = false;     /* FRAME_END is queued */
+    uint32_t frames_sent_ = 0;
+    uint32_t frames_resent_ = 0;
+    uint32_t frame_naks_ = 0;
+    uint32_t frame_timeouts_ = 0;
+
+    /* Real time pacing */
+    chrono::steady_clock::time_point pace_start_;
+    uint64_t pace_clocks_ = 0;
+    double pace_uart_us_ = 0.0;
+};
+
+bool load_rom_image(const string &filename, vector<uint8_t> &rom);
+int serve_emulator(ReaderEmulator &emulator);
+
+/* End */
@@ -0,0 +1,186 @@
+/*
+    Reader farm. Reads the ROM on several readers at once, each with its
+    own Comms session on its own thread. Every reader writes its own set
+    of files, named after the port: `dump.bin' read on /dev/ttyACM1 is
+    written to `dump-ttyACM1.bin', `dump-ttyACM1.bin.log' and so on.
+
+    Each thread only waits on its own port, so the combined rate grows
+    with the number of readers until the USB host runs out of bandwidth.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <ctype.h>
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <thread>
+#include "farm.hpp"
+#include "utility.hpp"
+
+enum
+{
+    FARM_CONNECTING,
+    FARM_READING,
+    FARM_DONE,
+    FARM_FAILED
+};
+
+static const char *farm_state_names[] = {"connecting", "reading", "done", "failed"};
+
+/* One reader and the result of its read */
+class farm_reader
+{
+public:
+    string name;
+    int com_port = -1;
+    string com_device;
+    string filename;
+
+    Comms comms;
+    atomic<int> state{FARM_CONNECTING};
+    read_result result;
+    double elapsed = 0.0;
+};
+
+/* Name a reader after its port, without any directory */
+static string port_label(const string &port)
+{
+    string name = (!port.empty() && isdigit(port[0])) ? com_port_name(atoi(port.c_str())) : port;
+    size_t separator = name.find_last_of("/\\");
+    return separator == string::npos ? name : name.substr(separator + 1);
+}
+
+/* Insert the reader name before the file extension */
+static string farm_filename(const string &filename, const string &name)
+{
+    size_t separator = filename.find_last_of("/\\");
+    size_t extension = filename.rfind('.');
+    if(extension == string::npos || (separator != string::npos && extension < separator))
+    {
+        return filename + "-" + name;
+    }
+    return filename.substr(0, extension) + "-" + name + filename.substr(extension);
+}
+
+static void farm_worker(farm_reader *reader, read_options options)
+{
+    auto start = chrono::steady_clock::now();
+
+    if(!reader->comms.connect(reader->com_port, reader->com_device))
+    {
+        printf("Error: [%s] Couldn't open serial port.\n", reader->name.c_str());
+        reader->state = FARM_FAILED;
+        return;
+    }
+
+    reader->state = FARM_READING;
+    bool status = read_rom(reader->comms, options, reader->result);
+    reader->comms.close();
+    reader->elapsed = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+    if(!status)
+    {
+        printf("Error: [%s] Read failed.\n", reader->name.c_str());
+        reader->state = FARM_FAILED;
+        return;
+    }
+    reader->state = write_read_result(reader->filename, reader->result) ? FARM_DONE : FARM_FAILED;
+}
+
+int run_farm(const string &filename, const vector<string> &ports, const read_options &options)
+{
+    vector<unique_ptr<farm_reader>> readers;
+    vector<thread> workers;
+
+    /* Status lines from several readers shouldn't be cut into each other */
+    setvbuf(stdout, NULL, _IOLBF, 0);
+
+    for(const string &port : ports)
+    {
+        auto reader = make_unique<farm_reader>();
+        reader->name = port_label(port);
+        if(isdigit(port[0]))
+        {
+            reader->com_port = atoi(port.c_str());
+        }
+        else
+        {
+            reader->com_device = port;
+        }
+        reader->filename = farm_filename(filename, reader->name);
+        printf("Status: [%s] Reading to `%s'.\n", reader->name.c_str(), reader->filename.c_str());
+        readers.push_back(move(reader));
+    }
+
+    auto start = chrono::steady_clock::now();
+    for(auto &reader : readers)
+    {
+        workers.push_back(thread(farm_worker, reader.get(), options));
+    }
+
+    /* Report progress until every reader has finished */
+    auto finished = [&]() {
+        for(auto &reader : readers)
+        {
+            if(reader->state < FARM_DONE)
+            {
+                return false;
+            }
+        }
+        return true;
+    };
+    while(!finished())
+    {
+        for(int delay = 0; delay < FARM_STATUS_MS && !finished(); delay += 50)
+        {
+            sleep_ms(50);
+        }
+        if(finished())
+        {
+            break;
+        }
+
+        string line = "Status:";
+        for(auto &reader : readers)
+        {
+            line += format(" %s %s %uK", reader->name.c_str(), farm_state_names[reader->state], (unsigned)(reader->comms.rx_bytes / 1024));
+        }
+        printf("%s\n", line.c_str());
+    }
+
+    for(auto &worker : workers)
+    {
+        worker.join();
+    }
+    double elapsed = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+    /* Per-reader rates, and how the combined rate compares to a single reader */
+    size_t total_bytes = 0;
+    double rate_sum = 0.0;
+    int succeeded = 0;
+    for(auto &reader : readers)
+    {
+        if(reader->state != FARM_DONE)
+        {
+            printf("Result: %s failed.\n", reader->name.c_str());
+            continue;
+        }
+        double rate = reader->elapsed > 0.0 ? reader->comms.rx_bytes / reader->elapsed / 1024.0 : 0.0;
+        printf("Result: %s read %u bytes in %.2f s (%.1f KB/s), %d passes.\n",
+            reader->name.c_str(), (unsigned)reader->comms.rx_bytes, reader->elapsed, rate, reader->result.passes);
+        total_bytes += reader->comms.rx_bytes;
+        rate_sum += rate;
+        ++succeeded;
+    }
+
+    if(succeeded)
+    {
+        double rate = elapsed > 0.0 ? total_bytes / elapsed / 1024.0 : 0.0;
+        printf("Result: %d of %d readers finished in %.2f s, %.1f KB/s combined (%.2fx one reader).\n",
+            succeeded, (int)readers.size(), elapsed, rate, rate_sum > 0.0 ? rate * succeeded / rate_sum : 0.0);
+    }
+    return succeeded == (int)readers.size() ? 0 : 1;
+}
+
+/* End */
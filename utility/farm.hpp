@@ -0,0 +1,13 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include "reader.hpp"
+using namespace std;
+
+/* How often progress for all readers is printed */
+#define FARM_STATUS_MS              1000
+
+int run_farm(const string &filename, const vector<string> &ports, const read_options &options);
+
+/* End */
@@ -0,0 +1,64 @@
+/*
+    Model of the HD6805V1 bus as the reader sees it. Shared by the software
+    reader in the utility and the host build of the firmware.
+*/
+
+#include "hd6805.hpp"
+
+/* Convert a logical address to the AH/ADL values the reader samples from
+   ports C and B. This is the inverse of the firmware's decode_address():
+   A8 and A9 are swapped on port C, and A7-A0 are scrambled on port B. */
+void encode_bus_address(uint16_t address, uint8_t *ah, uint8_t *adl)
+{
+    constexpr uint8_t order[] = {0, 2, 6, 7, 5, 4, 3, 1};
+    uint8_t adh = (address >> 8) & 0x0F;
+    uint8_t temp = 0;
+
+    for(int index = 0; index < 8; index++)
+    {
+        if(address & (1 << order[index]))
+        {
+            temp |= (1 << index);
+        }
+    }
+
+    *ah = (adh & 0x0C) | ((adh >> 1) & 0x01) | ((adh << 1) & 0x02);
+    *adl = temp;
+}
+
+void HD6805Model::sample(bus_state &state) const
+{
+    uint64_t startup_clocks = (uint64_t)startup_cycles * HD6805_CLOCKS_PER_CYCLE;
+
+    /* Nothing is driven on the bus until the vector fetch */
+    if(reset_ || position_ < startup_clocks)
+    {
+        state.adl = 0xFF;
+        state.ah = 0x00;
+        state.num = 1;
+        state.strobe = 0;
+        return;
+    }
+
+    uint64_t cycle = (position_ - startup_clocks) / HD6805_CLOCKS_PER_CYCLE;
+    int phase = (position_ - startup_clocks) % HD6805_CLOCKS_PER_CYCLE;
+    uint16_t address;
+
+    /* Vector fetch and load, then two cycles per NOP */
+    if(cycle < 4)
+    {
+        address = (cycle == 0) ? 0xFFE : 0xFFF;
+    }
+    else
+    {
+        address = (entry_address() + (cycle - 4) / 2) & (HD6805_ROM_SIZE - 1);
+    }
+
+    uint8_t adl;
+    encode_bus_address(address, &state.ah, &adl);
+    state.num = (phase >= 2) ? 1 : 0;
+    state.strobe = 1;
+    state.adl = state.num ? rom_[address] : adl;
+}
+
+/* End */
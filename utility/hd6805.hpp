@@ -0,0 +1,75 @@
+#pragma once
+
+#include <stdint.h>
+#include <vector>
+using namespace std;
+
+#define HD6805_ROM_SIZE             0x1000  /* 4K address space */
+#define HD6805_CLOCKS_PER_CYCLE     4       /* EXTAL clocks per machine cycle */
+#define HD6805_STARTUP_CYCLES       8       /* Machine cycles from reset to the vector fetch */
+
+/* Ports B and C as the reader samples them, the same as target_state_t */
+class bus_state
+{
+public:
+    uint8_t adl;        /* Multiplexed address/data */
+    uint8_t ah;         /* High order address, A8 and A9 swapped */
+    uint8_t num;        /* Low while the address is on the bus */
+    uint8_t strobe;
+};
+
+/* Cycle level model of an HD6805V1 in non-user mode (NUM high). After reset
+   is released the CPU waits startup_cycles machine cycles, fetches the reset
+   vector from 0xFFE/0xFFF, spends two more cycles loading it, then executes
+   the NOP jumpered on port A forever. Each NOP is two machine cycles, so the
+   address counter steps every 8 clocks from the vector up to 0xFFF and wraps
+   to 0x000. In every machine cycle NUM is low for two clocks while the
+   address is on ports B and C, then high while the data byte is on port B. */
+class HD6805Model
+{
+public:
+    HD6805Model(const vector<uint8_t> &rom) : rom_(rom)
+    {
+        rom_.resize(HD6805_ROM_SIZE, 0xFF);
+    }
+
+    /* Drive RES#, clocks while it is low don't advance the CPU */
+    void set_reset(bool asserted)
+    {
+        reset_ = asserted;
+        if(asserted)
+        {
+            position_ = 0;
+        }
+    }
+
+    void clock(uint32_t count)
+    {
+        clocks += count;
+        if(!reset_)
+        {
+            position_ += count;
+        }
+    }
+
+    void sample(bus_state &state) const;
+
+    /* Address the output sequence starts from, the reset vector unless overridden */
+    uint16_t entry_address(void) const
+    {
+        return entry >= 0 ? entry : ((rom_[0xFFE] << 8) | rom_[0xFFF]) & (HD6805_ROM_SIZE - 1);
+    }
+
+    int startup_cycles = HD6805_STARTUP_CYCLES;
+    int entry = -1;
+    uint64_t clocks = 0;            /* Total clocks issued, for pacing */
+
+private:
+    vector<uint8_t> rom_;
+    bool reset_ = false;
+    uint64_t position_ = 0;         /* Clocks since reset was released */
+};
+
+void encode_bus_address(uint16_t address, uint8_t *ah, uint8_t *adl);
+
+/* End */
@@ -4,9 +4,12 @@
 
 #include <stdio.h>
 #include <stdlib.h>
-#include <conio.h>
 #include <stdint.h>
+#include <string.h>
+#ifdef _WIN32
+#include <conio.h>
 #include <windows.h>
+#endif
 
 #include <iostream>
 #include <string>
@@ -21,19 +24,36 @@
 #include <cassert>
 
 #include "comms.hpp"
+#include "reader.hpp"
+#include "daemon.hpp"
+#include "farm.hpp"
+#include "emulator.hpp"
 #include "utility.hpp"
-#include "winserial.hpp"
+#include "serial.hpp"
 #include "arduino_serial.hpp"
-#include "third_party/sha256.h"
 using namespace std;
 
-#define ASCII_ESC                   0x1B
-#define COM_BAUD_RATE               115200
+#define COM_BAUD_RATE               LINK_MAX_BAUD_RATE
 
 /* Global variables */
 Comms comms;
 int com_port = -1;
+string com_device;
 int com_baud_rate = COM_BAUD_RATE;
+int clock_rate_khz = 0;
+bool compact_mode = false;
+bool framed_mode = false;
+bool timing_mode = false;
+bool unrolled_mode = false;
+bool burst_mode = false;
+bool snapshot_mode = false;
+int range_start = 0x000;
+int range_length = 0x1000;
+int read_passes = 1;
+int agree_threshold = 3;
+string trace_filename;
+emulator_options emulator_settings;
+unique_ptr<ReaderEmulator> emulator;
 string app_name;
 
 /******************************************************************************/
@@ -42,12 +62,18 @@ string app_name;
 
 bool cmd_generic_handler(Comms &comms, command_context *p)
 {
-    if(!comms.port.openArduino(com_port, com_baud_rate))
+    if(!comms.connect(com_port, com_device))
     {
         printf("Error: Couldn't open serial port.\n");
         return false;
     }
 
+    /* Commands that don't talk to the target beyond a handshake stay at the base rate */
+    if(p->type == CMD_DISPATCH && com_baud_rate > LINK_BASE_BAUD_RATE)
+    {
+        comms.negotiate_link(com_baud_rate);
+    }
+
     printf("Sending command.\n");
     if(!comms.send_command(p->command))
     {
@@ -65,7 +91,7 @@ bool cmd_generic_handler(Comms &comms, command_context *p)
                 break;
 
             case CMD_DISPATCH:
-                if(!comms.dispatch_target(p->tx_buffer, p->tx_size, p->rx_buffer, p->rx_size, &p->parameters))
+                if(!comms.dispatch_target(p))
                 {
                     printf("Error: Aborting command processing\n");
                     exit(1);
@@ -76,10 +102,10 @@ bool cmd_generic_handler(Comms &comms, command_context *p)
             default:
                 break;
         }
-        printf("Status: Normal exit.\n");
+        printf("Status: Normal exit (%u bytes received in %u reads).\n", (unsigned)comms.rx_bytes, (unsigned)comms.rx_reads);
     }
     
-    if(!comms.port.close())
+    if(!comms.close())
     { 
         printf("Error: Couldn't close serial port.\n");
         return false;
@@ -173,22 +199,34 @@ Command def_cmd_scan = {
         int value = ListComPort(true);
         if(value != -1)
         {
-            printf("Found Arduino at COM%d\n", value);
+            printf("Found Arduino at %s\n", com_port_name(value).c_str());
         }
         return true;
     }
 };
 
+/* Get the firmware's counters for the last read */
+Command def_cmd_stats = {
+    .name = "stats",
+    .usage = "%s",
+    .help = "Get the target's counters from the last read",
+    .parse = [](auto &parser) {
+    command_context p;
+        p.command = CMD_STATS;
+        p.type = CMD_DISPATCH;
+        return cmd_generic_handler(comms, &p);
+    }
+};
+
 /* Read raw test data and decode it as ROM data */
 Command def_cmd_read = {
     .name = "read",
-    .usage = "%s output.bin",
+    .usage = "%s [--range start-end] [--passes count] [--agree count] output.bin",
     .help = "Read HD6805V1 device",
     .parse = [](auto &parser) { 
         string filename;
-        command_context p;
-        size_t buffer_size;
-        uint8_t *buffer;
+        read_options options;
+        read_result result;
 
         /* Get filename */
         if(!parser.next(filename)) {
@@ -196,75 +234,54 @@ Command def_cmd_read = {
             return false;
         }
 
-        /* Allocate dump output buffer (4K addresses x 4 bytes per address) */
-        buffer_size = 4096 * 4;
-        buffer = new uint8_t [buffer_size];
-        if(!buffer) {
-            printf("Error: Couldn't allocate %d bytes.\n", buffer_size);
-            return false;
+        options.baud_rate = com_baud_rate;
+        options.clock_rate_khz = clock_rate_khz;
+        options.compact = compact_mode;
+        options.framed = framed_mode;
+        options.timing = timing_mode;
+        options.unrolled = unrolled_mode;
+        options.burst = burst_mode;
+        options.snapshot = snapshot_mode;
+        options.range_start = range_start;
+        options.range_length = range_length;
+        options.passes = read_passes;
+        options.agree = agree_threshold;
+
+        /* Time each phase if a trace was asked for */
+        PhaseTimer phases;
+        if(!trace_filename.empty())
+        {
+            comms.phases = &phases;
         }
+        comms.progress.enabled = stdout_is_terminal();
 
-        /* Send parameters for read command */
-        p.parameters.push_back(6);
-        p.command = CMD_READ;
-        p.type = CMD_DISPATCH;
-        p.rx_buffer = buffer;
-        p.rx_size = buffer_size;
-
-        /* Run command */        
-        if(!cmd_generic_handler(comms, &p))
+        /* Run command */
+        if(!comms.connect(com_port, com_device))
         {
-            printf("Error: Failed to run command on target.\n");
+            printf("Error: Couldn't open serial port.\n");
+            comms.phases = nullptr;
             return false;
         }
-
-        /* Checksum data */
-        uint8_t checksum = 0x81;
-        for(int i = 0x200; i < buffer_size; i++)
+        bool status = read_rom(comms, options, result);
+        comms.close();
+        if(status)
         {
-            checksum += buffer[i];
+            printf("Status: Normal exit (%u bytes received in %u reads).\n", (unsigned)comms.rx_bytes, (unsigned)comms.rx_reads);
+            comms.mark_phase("write");
+            status = write_read_result(filename, result);
         }
-        printf("Local checksum = %02X\n", checksum);
 
-        FILE *fd = NULL;
-        
-        printf("Status: Writing ROM image to file `%s'.\n", filename.c_str());
-        fd = fopen(filename.c_str(), "wb");
-        if(!fd)
-        {
-            printf("Error: Can't open file `%s' for writing.\n", filename.c_str());
-            delete []buffer;
-            return false;
-        }
-        for(int i = 0; i < buffer_size; i+=4)
+        if(comms.phases)
         {
-            uint8_t ah1 =  buffer[i+0];
-            uint8_t adl =  buffer[i+1];
-            uint8_t ah2 =  buffer[i+2];
-            uint8_t data = buffer[i+3];
-
-            if(i < 0x200)
+            phases.stop(comms.rx_bytes);
+            comms.phases = nullptr;
+            phases.print_summary();
+            if(phases.write_trace(trace_filename))
             {
-                data = 0xff; /* Blank out first 128 bytes */
+                printf("Status: Wrote trace to `%s'.\n", trace_filename.c_str());
             }
-            fputc(data, fd);
-        }
-        fclose(fd);
-
-        filename += ".log";
-        printf("Status: Writing raw test data to `%s'.\n", filename.c_str());
-        fd = fopen(filename.c_str(), "wb");    
-        if(!fd)
-        {
-            printf("Error: Can't open file `%s' for writing.\n", filename.c_str());
-            delete []buffer;
-            return false;
         }
-        fwrite(buffer, buffer_size, 1, fd);
-        fclose(fd);
-
-        delete []buffer;
-        return true;
+        return status;
      }
 };
 
@@ -283,9 +300,9 @@ Command def_cmd_echo = {
             bool running = true;
             while(running)
             {
-                if(_kbhit())
+                if(key_pressed())
                 {
-                    uint8_t ch = getch();
+                    uint8_t ch = read_key();
                     printf("Got user key input: %02X\n", ch);
                     printf("Sending input\n");
                     comms.sendb(ch);
@@ -321,53 +338,111 @@ Command def_cmd_echo = {
 /******************************************************************************/
 
 
-template<size_t N>
-class BeMemory
-{
-public:
-    static constexpr uint16_t mask = (uint16_t)(N-1);
-    uint8_t readb(uint16_t addr) { 
-        return data[addr & mask]; 
-    }
-    uint16_t readw(uint16_t addr) { 
-        return (readb(addr) << 8) | readb(addr+1);
-    }
-    void writeb(uint16_t addr, uint8_t value) {
-        data[addr] = value;
-    }
+/* Serve read jobs over a Unix domain socket */
+Command def_cmd_daemon = {
+    .name = "daemon",
+    .usage = "%s socket [port ...]",
+    .help = "Keep readers open and run jobs sent to a local socket",
+    .parse = [](auto &parser) { 
+        string socket_path;
+        vector<string> ports;
+        string port;
+        read_options defaults;
+
+        if(!parser.next(socket_path)) {
+            printf("Error: No socket path specified.\n");
+            return false;
+        }
+        while(parser.next(port)) {
+            ports.push_back(port);
+        }
+
+        /* Without a port list, use --port or the first reader found */
+        if(ports.empty()) {
+            ports.push_back(com_device.empty() && com_port != -1 ? format("%d", com_port) : com_device);
+        }
 
-    static const size_t size = N;
-    uint8_t data[size];
+        /* Read options given with the daemon are defaults for every job, as with farm */
+        defaults.baud_rate = com_baud_rate;
+        defaults.clock_rate_khz = clock_rate_khz;
+        defaults.compact = compact_mode;
+        defaults.framed = framed_mode;
+        defaults.timing = timing_mode;
+        defaults.unrolled = unrolled_mode;
+        defaults.burst = burst_mode;
+        defaults.snapshot = snapshot_mode;
+        defaults.range_start = range_start;
+        defaults.range_length = range_length;
+        defaults.passes = read_passes;
+        defaults.agree = agree_threshold;
+        return run_daemon(socket_path, ports, defaults) == 0;
+     }
 };
 
+/* Read every reader attached to the host at once */
+Command def_cmd_farm = {
+    .name = "farm",
+    .usage = "%s [--range start-end] [--passes count] output.bin [port ...]",
+    .help = "Read HD6805V1 devices on several readers concurrently",
+    .parse = [](auto &parser) { 
+        string filename;
+        vector<string> ports;
+        string port;
+        read_options options;
 
-uint8_t ascii2dec(uint8_t value)
-{
-    value = tolower(value);
-    uint8_t temp = 0;
-    if(value > '0' && value <= '9')
-        temp = value - '0';
-    else
-        temp = value - 'a';
-    return temp;
-}
+        if(!parser.next(filename)) {
+            printf("Error: No file name specified.\n");
+            return false;
+        }
+        while(parser.next(port)) {
+            ports.push_back(port);
+        }
 
-constexpr std::array<uint8_t, SHA256_DIGEST_LENGTH> SHA256_DIGEST(const char *input)
-{
-    std::array<uint8_t, SHA256_DIGEST_LENGTH> data{};
-    assert(strlen(input) == SHA256_DIGEST_LENGTH*2);
-    for(int i = 0; i < SHA256_DIGEST_LENGTH*2; i++) {        
-        uint8_t digit = ascii2dec(input[i]);
-        if(i & 1)
-            data[i] |= digit;
-        else
-            data[i] = digit << 4;
-    }
-    return data;
-}
+        /* Without a port list, use every reader found */
+        if(ports.empty()) {
+            ports = FindReaderPorts();
+        }
+        if(ports.empty()) {
+            printf("Error: No readers found.\n");
+            return false;
+        }
+
+        options.baud_rate = com_baud_rate;
+        options.clock_rate_khz = clock_rate_khz;
+        options.compact = compact_mode;
+        options.framed = framed_mode;
+        options.timing = timing_mode;
+        options.unrolled = unrolled_mode;
+        options.burst = burst_mode;
+        options.snapshot = snapshot_mode;
+        options.range_start = range_start;
+        options.range_length = range_length;
+        options.passes = read_passes;
+        options.agree = agree_threshold;
+        return run_farm(filename, ports, options) == 0;
+     }
+};
 
-map<string, string> self_check_sha256_map = {
-    {"9088fee917e5a748c2f0b4f5458c1cbdabbd696291c69be6e605bae0ef779e8f", "HD6805V1"},
+/* Run the software reader on a pseudo-terminal */
+Command def_cmd_emulate = {
+    .name = "emulate",
+    .usage = "%s rom.bin",
+    .help = "Emulate a reader with a ROM image fitted, for another program to attach to",
+    .parse = [](auto &parser) { 
+        string filename;
+        vector<uint8_t> rom;
+
+        if(!parser.next(filename)) {
+            printf("Error: No file name specified.\n");
+            return false;
+        }
+        if(!load_rom_image(filename, rom)) {
+            return false;
+        }
+
+        ReaderEmulator target(rom, emulator_settings);
+        return serve_emulator(target) == 0;
+     }
 };
 
 /* Analyze ROM and report information */
@@ -376,36 +451,10 @@ Command def_cmd_check = {
     .usage = "%s file.bin",
     .help = "Analyze HD6805V1 ROM",
     .parse = [](auto &parser) { 
-
-        /* Vector names */
-        const uint16_t vector_base = 0xFF0;
-        const char *vector_names[] = {
-            "TIMER",
-            "INT#",
-            "SWI",
-            "RES#"
-        };
-
-        const char *vector_types[] = {
-            "Self-check",
-            "Customer"
-        };
-
-        const uint16_t checksum_address = 0xFEF;
-        const uint16_t self_check_reset_vector_address = 0xFF6;
-        const uint16_t self_check_reset_vector = 0xF80;
-        const uint16_t self_check_rom_base = self_check_reset_vector;
-        const uint16_t rom_base = 0x80;
-        const uint16_t self_check_size = 0x78;
-
-        const size_t rom_size = 0x1000;
-
-        BeMemory<rom_size> rom;
+        uint8_t rom[ROM_SIZE];
         size_t file_size;
         string filename;
-        command_context p;
         FILE *fd;
-        bool has_self_check_rom = true;
 
         /* Get filename */
         if(!parser.next(filename)) {
@@ -425,89 +474,154 @@ Command def_cmd_check = {
         file_size = ftell(fd);
         fseek(fd, 0, SEEK_SET);
 
-        if(file_size != rom.size) {
-            printf("Invalid file size (%d bytes).\n", file_size);
+        if(file_size != sizeof(rom)) {
+            printf("Invalid file size (%d bytes).\n", (int)file_size);
             fclose(fd);
             return false;
         }
 
         /* Read file data */
-        fread(rom.data, file_size, 1, fd);        
+        fread(rom, file_size, 1, fd);        
         fclose(fd);
-        
-        for(int i = 0; i < 8; i++)
-        {
-            if((i & 3) == 0)
-                printf("%s vectors:\n", vector_types[(i >> 2) & 1]);
-            printf("* %-5s = $%04X\n", vector_names[i&3], rom.readw(vector_base + i * 2));
-        }
 
-        printf("Self-check ROM analysis:\n");
+        printf("%s", check_rom(rom).c_str());
+        return true;
+     }
+};
 
-        uint16_t temp = rom.readw(self_check_reset_vector_address);
-        if(temp != self_check_reset_vector || temp & 0xf000) {
-            printf("* Reset vector is not valid (%04X, expected %04X).\n", temp, self_check_reset_vector);
-        } else {
-            printf("* Reset vector is valid.\n");
 
-            /* Save ROM checksum and initialize it */
-            uint8_t rom_checksum = rom.readb(checksum_address);
-            rom.writeb(checksum_address, 0xFF);
+/******************************************************************************/
+/******************************************************************************/
 
-            /* Compute checksum of entire ROM */
-            uint8_t acc = 0;
-            for(int i = rom_base; i < rom.size; i++)
-            {
-                acc ^= rom.readb(i);
-            }
+/* Option: Specify COM port */
+Command def_opt_port = {
+    .name = "--port",
+    .usage = "%s number|device|pty",
+    .help = "Specify COM port number, serial device path, or a pseudo-terminal for a target emulator",
+    .parse = [](auto &parser) { 
+        string parameter;
+        if(!parser.next(parameter)) {
+            printf("Error: Missing argument.\n");
+            return false;
+        }
+#ifndef _WIN32
+        if(parameter == "pty")
+        {
+            comms.use_transport(make_unique<PtyTransport>());
+            printf("Status: Using a pseudo-terminal\n");
+            return true;
+        }
+#endif
+        if(!isdigit(parameter[0]))
+        {
+            com_device = parameter;
+            printf("Status: Using serial port %s\n", com_device.c_str());
+            return true;
+        }
+        com_port = atoi(parameter.c_str());
+        printf("Status: Using serial port %s\n", com_port_name(com_port).c_str());
+        return true;
+     }
+};
 
-            printf("* Internal checksum   = %02X\n", rom_checksum);
-            printf("* Calculated checksum = %02X\n", acc);
-            if(rom_checksum != acc) {
-                printf("* Checksum mismatch. Bad ROM dump or non-standard ROM size?");
-            }
+/* Option: Talk to the software reader instead of hardware */
+Command def_opt_emulate = {
+    .name = "--emulate",
+    .usage = "%s rom.bin",
+    .help = "Read from an emulated reader with a ROM image fitted",
+    .parse = [](auto &parser) { 
+        string filename;
+        vector<uint8_t> rom;
+        if(!parser.next(filename)) {
+            printf("Error: Missing argument.\n");
+            return false;
+        }
+        if(!load_rom_image(filename, rom)) {
+            return false;
+        }
+        emulator = make_unique<ReaderEmulator>(rom, emulator_settings);
+        comms.use_transport(make_unique<MemoryTransport>(emulator.get()));
+        printf("Status: Using an emulated reader with `%s'\n", filename.c_str());
+        return true;
+     }
+};
 
-            /* Compute SHA256 of self-check ROM */
-            uint8_t raw_digest[SHA256_DIGEST_LENGTH];
-            string digest;
-            sha256(rom.data, self_check_size, raw_digest);
-            for(int i = 0; i < SHA256_DIGEST_LENGTH; i++)
-            {
-                const char *hextab = "0123456789abcdef";
-                digest += hextab[(raw_digest[i] >> 4) & 0x0F];
-                digest += hextab[(raw_digest[i] >> 0) & 0x0F];
-            }
-            printf("* ROM SHA256 = %s\n", digest.c_str());
+/* Option: Emulated bus errors */
+Command def_opt_bus_errors = {
+    .name = "--bus-errors",
+    .usage = "%s rate (e.g. 0.001)",
+    .help = "Flip a bit in this fraction of the emulated reader's bus samples",
+    .parse = [](auto &parser) { 
+        string parameter;
+        if(!parser.next(parameter)) {
+            printf("Error: Missing argument.\n");
+            return false;
+        }
+        emulator_settings.bus_errors = atof(parameter.c_str());
+        printf("Status: Emulating bus errors at a rate of %g\n", emulator_settings.bus_errors);
+        return true;
+     }
+};
 
-            auto result = self_check_sha256_map.find(digest);
-            if(result != self_check_sha256_map.end())
-            {
-                printf("* ROM matches device type %s\n", result->second.c_str());
-            } else {
-                printf("* ROM does not match any known device type.\n");
-            }
+/* Option: Emulated line errors */
+Command def_opt_line_errors = {
+    .name = "--line-errors",
+    .usage = "%s rate (e.g. 0.0001)",
+    .help = "Flip a bit in this fraction of the bytes the emulated reader sends during a read",
+    .parse = [](auto &parser) { 
+        string parameter;
+        if(!parser.next(parameter)) {
+            printf("Error: Missing argument.\n");
+            return false;
         }
+        emulator_settings.line_errors = atof(parameter.c_str());
+        printf("Status: Emulating line errors at a rate of %g\n", emulator_settings.line_errors);
         return true;
      }
 };
 
+/* Option: Emulated dropped bytes */
+Command def_opt_drop_bytes = {
+    .name = "--drop-bytes",
+    .usage = "%s rate (e.g. 0.0001)",
+    .help = "Lose this fraction of the bytes the emulated reader sends during a read",
+    .parse = [](auto &parser) { 
+        string parameter;
+        if(!parser.next(parameter)) {
+            printf("Error: Missing argument.\n");
+            return false;
+        }
+        emulator_settings.dropped_bytes = atof(parameter.c_str());
+        printf("Status: Emulating dropped bytes at a rate of %g\n", emulator_settings.dropped_bytes);
+        return true;
+     }
+};
 
-/******************************************************************************/
-/******************************************************************************/
+/* Option: Emulate in real time */
+Command def_opt_realtime = {
+    .name = "--realtime",
+    .usage = "%s",
+    .help = "Make the emulated reader take as long as the hardware would",
+    .parse = [](auto &parser) { 
+        emulator_settings.realtime = true;
+        printf("Status: Emulating in real time\n");
+        return true;
+     }
+};
 
-/* Option: Specify COM port */
-Command def_opt_port = {
-    .name = "--port",
-    .usage = "%s number",
-    .help = "Specify COM port to use",
+/* Option: Seed for emulated faults */
+Command def_opt_seed = {
+    .name = "--seed",
+    .usage = "%s value (default 1)",
+    .help = "Seed the emulated reader's faults, each read repeats the same faults",
     .parse = [](auto &parser) { 
         string parameter;
         if(!parser.next(parameter)) {
             printf("Error: Missing argument.\n");
             return false;
         }
-        com_port = atoi(parameter.c_str());
-        printf("Status: Using serial port COM%d\n", com_port);
+        emulator_settings.seed = strtoul(parameter.c_str(), NULL, 0);
+        printf("Status: Using fault seed %u\n", emulator_settings.seed);
         return true;
      }
 };
@@ -515,8 +629,8 @@ Command def_opt_port = {
 /* Option: Specify baud rate */
 Command def_opt_baudrate = {
     .name = "--baudrate",
-    .usage = "%s rate (default 115200 bps)",
-    .help = "Specify baud rate",
+    .usage = "%s rate (default 2000000 bps)",
+    .help = "Specify highest baud rate to negotiate with the target",
     .parse = [](auto &parser) { 
         string parameter;
         if(!parser.next(parameter)) {
@@ -529,6 +643,187 @@ Command def_opt_baudrate = {
      }
 };
 
+/* Option: Specify target clock rate */
+Command def_opt_clock = {
+    .name = "--clock",
+    .usage = "%s rate (kHz, default 0 = bit-banged)",
+    .help = "Specify EXTAL clock rate generated by Timer1",
+    .parse = [](auto &parser) { 
+        string parameter;
+        if(!parser.next(parameter)) {
+            printf("Error: Missing argument.\n");
+            return false;
+        }
+        if(!parse_clock_rate(parameter, clock_rate_khz)) {
+            printf("Error: Clock rate must be 0 or %d-%d kHz.\n", CLOCK_RATE_MIN_KHZ, CLOCK_RATE_MAX_KHZ);
+            return false;
+        }
+        printf("Status: Using EXTAL clock rate of %d kHz\n", clock_rate_khz);
+        return true;
+     }
+};
+
+/* Option: Compact read mode */
+Command def_opt_compact = {
+    .name = "--compact",
+    .usage = "%s",
+    .help = "Transfer only data bytes and address exceptions when reading",
+    .parse = [](auto &parser) { 
+        compact_mode = true;
+        printf("Status: Using compact read mode\n");
+        return true;
+     }
+};
+
+/* Option: Framed read mode */
+Command def_opt_framed = {
+    .name = "--framed",
+    .usage = "%s",
+    .help = "Send read data in checked frames, resending only bad ones",
+    .parse = [](auto &parser) { 
+        framed_mode = true;
+        printf("Status: Using framed read mode\n");
+        return true;
+     }
+};
+
+/* Option: Firmware timing */
+Command def_opt_timing = {
+    .name = "--timing",
+    .usage = "%s",
+    .help = "Have the target time clocking, sampling and sending during a read (slows it down)",
+    .parse = [](auto &parser) { 
+        timing_mode = true;
+        printf("Status: Timing the target's work\n");
+        return true;
+     }
+};
+
+/* Option: Unrolled address loop */
+Command def_opt_unrolled = {
+    .name = "--unrolled",
+    .usage = "%s",
+    .help = "Clock and sample each address with the target's cycle-counted loop (400 kHz)",
+    .parse = [](auto &parser) { 
+        unrolled_mode = true;
+        printf("Status: Using the unrolled address loop\n");
+        return true;
+     }
+};
+
+/* Option: Burst capture */
+Command def_opt_burst = {
+    .name = "--burst",
+    .usage = "%s",
+    .help = "Capture blocks of addresses on the target before sending them (not with --compact)",
+    .parse = [](auto &parser) { 
+        burst_mode = true;
+        printf("Status: Using burst capture\n");
+        return true;
+     }
+};
+
+/* Option: Port snapshots */
+Command def_opt_snapshot = {
+    .name = "--snapshot",
+    .usage = "%s",
+    .help = "Have the target send its ports as read and decode them here (not with --compact)",
+    .parse = [](auto &parser) { 
+        snapshot_mode = true;
+        printf("Status: Using port snapshots\n");
+        return true;
+     }
+};
+
+/* Option: Address range to read */
+Command def_opt_range = {
+    .name = "--range",
+    .usage = "%s start-end (e.g. 0x080-0xFFF)",
+    .help = "Read only an address range, the rest of the ROM image is blank",
+    .parse = [](auto &parser) { 
+        string parameter;
+        if(!parser.next(parameter)) {
+            printf("Error: Missing argument.\n");
+            return false;
+        }
+
+        size_t separator = parameter.find('-');
+        if(separator == string::npos) {
+            printf("Error: Range must be given as start-end.\n");
+            return false;
+        }
+
+        int start = strtol(parameter.substr(0, separator).c_str(), NULL, 0);
+        int end = strtol(parameter.substr(separator + 1).c_str(), NULL, 0);
+        if(start < 0 || end > 0xFFF || start > end) {
+            printf("Error: Invalid range %03X-%03X.\n", start, end);
+            return false;
+        }
+
+        range_start = start;
+        range_length = end - start + 1;
+        printf("Status: Reading range %03X-%03X\n", start, end);
+        return true;
+     }
+};
+
+/* Option: Number of passes to read */
+Command def_opt_passes = {
+    .name = "--passes",
+    .usage = "%s count",
+    .help = "Read the ROM several times without resetting the target",
+    .parse = [](auto &parser) { 
+        string parameter;
+        if(!parser.next(parameter)) {
+            printf("Error: Missing argument.\n");
+            return false;
+        }
+        read_passes = atoi(parameter.c_str());
+        if(read_passes < 1 || read_passes > 255) {
+            printf("Error: Pass count must be 1-255.\n");
+            return false;
+        }
+        printf("Status: Reading %d passes\n", read_passes);
+        return true;
+     }
+};
+
+/* Option: Passes that must agree before a multi-pass read stops early */
+Command def_opt_agree = {
+    .name = "--agree",
+    .usage = "%s count",
+    .help = "Stop a multi-pass read once every byte agrees in this many passes",
+    .parse = [](auto &parser) { 
+        string parameter;
+        if(!parser.next(parameter)) {
+            printf("Error: Missing argument.\n");
+            return false;
+        }
+        agree_threshold = atoi(parameter.c_str());
+        if(agree_threshold < 1 || agree_threshold > 255) {
+            printf("Error: Agreement count must be 1-255.\n");
+            return false;
+        }
+        printf("Status: Stopping once %d passes agree\n", agree_threshold);
+        return true;
+     }
+};
+
+/* Option: Trace file */
+Command def_opt_trace = {
+    .name = "--trace",
+    .usage = "%s file.json",
+    .help = "Time each phase of a read and write a trace viewable in chrome://tracing or Perfetto",
+    .parse = [](auto &parser) { 
+        if(!parser.next(trace_filename)) {
+            printf("Error: Missing argument.\n");
+            return false;
+        }
+        printf("Status: Writing trace to `%s'\n", trace_filename.c_str());
+        return true;
+     }
+};
+
 /******************************************************************************/
 /******************************************************************************/
 /******************************************************************************/
@@ -536,7 +831,24 @@ Command def_opt_baudrate = {
 /* Options */
 vector<Command*> sub_option_list = { 
     &def_opt_port,
-    &def_opt_baudrate
+    &def_opt_baudrate,
+    &def_opt_clock,
+    &def_opt_compact,
+    &def_opt_framed,
+    &def_opt_timing,
+    &def_opt_unrolled,
+    &def_opt_burst,
+    &def_opt_snapshot,
+    &def_opt_range,
+    &def_opt_passes,
+    &def_opt_agree,
+    &def_opt_trace,
+    &def_opt_emulate,
+    &def_opt_bus_errors,
+    &def_opt_line_errors,
+    &def_opt_drop_bytes,
+    &def_opt_realtime,
+    &def_opt_seed
 };
 
 /* Commands */
@@ -552,6 +864,10 @@ vector<Command*> sub_command_list = {
     // Device
     &def_cmd_read, 
     &def_cmd_check,
+    &def_cmd_stats,
+    &def_cmd_daemon,
+    &def_cmd_farm,
+    &def_cmd_emulate,
 };
 
 /* All supported commands and options */
@@ -630,6 +946,17 @@ int parse_args(int argc, char *argv[])
         printf("\n");
     }
 
+    /* Any option or command that failed makes the exit status non-zero */
+    for(auto *table : app_command_list)
+    {
+        for(auto &opt : *table)
+        {
+            if(opt->failed)
+            {
+                return 1;
+            }
+        }
+    }
     return 0;
 }
 
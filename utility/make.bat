@@ -1 +1 @@
-@g++ main.cpp comms.cpp utility.cpp winserial.cpp third_party\sha256.c -Ithird_party -o hdread.exe -static -I. -std=c++17
\ No newline at end of file
+@g++ main.cpp comms.cpp consensus.cpp reader.cpp daemon.cpp farm.cpp emulator.cpp hd6805.cpp phases.cpp utility.cpp winserial.cpp third_party\sha256.c -Ithird_party -o hdread.exe -static -I. -std=c++17
\ No newline at end of file
@@ -0,0 +1,2 @@
+#!/bin/sh
+g++ main.cpp comms.cpp consensus.cpp utility.cpp reader.cpp daemon.cpp farm.cpp emulator.cpp hd6805.cpp phases.cpp posixserial.cpp third_party/sha256.c -Ithird_party -o hdread -I. -std=c++17 -pthread
@@ -0,0 +1,321 @@
+#include <stdio.h>
+#include <algorithm>
+#include <chrono>
+#ifdef _WIN32
+#include <windows.h>
+#include <io.h>
+#else
+#include <time.h>
+#include <unistd.h>
+#endif
+#include "phases.hpp"
+#include "utility.hpp"
+
+#define PROGRESS_INTERVAL_US    100000.0    /* Redraw the progress line at most this often */
+
+double wall_clock_us(void)
+{
+    return chrono::duration<double, micro>(chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+double cpu_clock_us(void)
+{
+#ifdef _WIN32
+    FILETIME creation, exit, kernel, user;
+    if(!GetProcessTimes(GetCurrentProcess(), &creation, &exit, &kernel, &user))
+    {
+        return 0.0;
+    }
+    uint64_t kernel_time = (uint64_t)kernel.dwHighDateTime << 32 | kernel.dwLowDateTime;
+    uint64_t user_time = (uint64_t)user.dwHighDateTime << 32 | user.dwLowDateTime;
+    return (kernel_time + user_time) / 10.0;
+#else
+    struct timespec now;
+    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &now);
+    return now.tv_sec * 1e6 + now.tv_nsec / 1e3;
+#endif
+}
+
+bool stdout_is_terminal(void)
+{
+#ifdef _WIN32
+    return _isatty(_fileno(stdout));
+#else
+    return isatty(STDOUT_FILENO);
+#endif
+}
+
+double PhaseTimer::now_us(void)
+{
+    double now = wall_clock_us();
+    if(origin_us_ < 0.0)
+    {
+        origin_us_ = now;
+    }
+    return now - origin_us_;
+}
+
+void PhaseTimer::mark(const string &name, size_t bytes)
+{
+    if(current_ >= 0 && phases_[current_].name == name)
+    {
+        return;
+    }
+    stop(bytes);
+
+    for(current_ = 0; current_ < (int)phases_.size(); current_++)
+    {
+        if(phases_[current_].name == name)
+        {
+            break;
+        }
+    }
+    if(current_ == (int)phases_.size())
+    {
+        phases_.push_back(phase());
+        phases_.back().name = name;
+    }
+    ++phases_[current_].count;
+    now_us();
+    wall_start_ = wall_clock_us();
+    cpu_start_ = cpu_clock_us();
+    bytes_start_ = bytes;
+}
+
+void PhaseTimer::stop(size_t bytes)
+{
+    if(current_ < 0)
+    {
+        return;
+    }
+    phase &entry = phases_[current_];
+    double wall_end = wall_clock_us();
+    entry.wall_us += wall_end - wall_start_;
+    entry.cpu_us += cpu_clock_us() - cpu_start_;
+
+    /* The count restarts when Comms reconnects */
+    size_t received = bytes >= bytes_start_ ? bytes - bytes_start_ : bytes;
+    entry.bytes += received;
+
+    trace_event event;
+    event.name = entry.name;
+    event.start_us = wall_start_ - origin_us_;
+    event.duration_us = wall_end - wall_start_;
+    event.bytes = received;
+    trace_.push_back(event);
+    current_ = -1;
+}
+
+void PhaseTimer::instant(const string &name, size_t bytes)
+{
+    trace_event event;
+    event.name = name;
+    event.type = 'i';
+    event.start_us = now_us();
+    event.bytes = bytes;
+    trace_.push_back(event);
+}
+
+void PhaseTimer::block(size_t size)
+{
+    if(block_times_.empty())
+    {
+        block_first_ = size;
+    }
+    block_times_.push_back(now_us());
+    block_bytes_ += size;
+}
+
+void PhaseTimer::clear(void)
+{
+    current_ = -1;
+    origin_us_ = -1.0;
+    phases_.clear();
+    trace_.clear();
+    block_times_.clear();
+    block_bytes_ = 0;
+    block_first_ = 0;
+}
+
+double PhaseTimer::wall_us(void) const
+{
+    double total = 0.0;
+    for(auto &entry : phases_)
+    {
+        total += entry.wall_us;
+    }
+    return total;
+}
+
+double PhaseTimer::cpu_us(void) const
+{
+    double total = 0.0;
+    for(auto &entry : phases_)
+    {
+        total += entry.cpu_us;
+    }
+    return total;
+}
+
+/* Names are event text, which may hold quotes or newlines */
+static string json_escape(const string &text)
+{
+    string result;
+    for(char c : text)
+    {
+        if(c == '"' || c == '\\')
+        {
+            result += '\\';
+            result += c;
+        }
+        else if((unsigned char)c >= 0x20)
+        {
+            result += c;
+        }
+    }
+    return result;
+}
+
+bool PhaseTimer::write_trace(const string &filename) const
+{
+    FILE *fd = fopen(filename.c_str(), "w");
+    if(!fd)
+    {
+        printf("Error: Can't open file `%s' for writing.\n", filename.c_str());
+        return false;
+    }
+
+    /* Spans are recorded as they end, the viewer wants them in start order */
+    vector<trace_event> events = trace_;
+    stable_sort(events.begin(), events.end(), [](const trace_event &a, const trace_event &b) {
+        return a.start_us < b.start_us;
+    });
+
+    fprintf(fd, "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [\n");
+    for(size_t i = 0; i < events.size(); i++)
+    {
+        const trace_event &event = events[i];
+        const char *separator = i + 1 < events.size() ? "," : "";
+        if(event.type == 'X')
+        {
+            fprintf(fd, "  {\"name\": \"%s\", \"ph\": \"X\", \"pid\": 1, \"tid\": 1, \"ts\": %.1f, \"dur\": %.1f, \"args\": {\"bytes\": %zu}}%s\n",
+                json_escape(event.name).c_str(), event.start_us, event.duration_us, event.bytes, separator);
+        }
+        else
+        {
+            fprintf(fd, "  {\"name\": \"%s\", \"ph\": \"i\", \"s\": \"t\", \"pid\": 1, \"tid\": 1, \"ts\": %.1f, \"args\": {\"bytes\": %zu}}%s\n",
+                json_escape(event.name).c_str(), event.start_us, event.bytes, separator);
+        }
+    }
+    fprintf(fd, "]}\n");
+    fclose(fd);
+    return true;
+}
+
+void PhaseTimer::print_summary(void) const
+{
+    for(auto &entry : phases_)
+    {
+        printf("Result: %-12s %9.2f ms wall %9.2f ms CPU %8zu bytes (%u)\n",
+            entry.name.c_str(), entry.wall_us / 1e3, entry.cpu_us / 1e3, entry.bytes, (unsigned)entry.count);
+    }
+
+    if(block_times_.size() < 2)
+    {
+        return;
+    }
+
+    vector<double> gaps;
+    for(size_t i = 1; i < block_times_.size(); i++)
+    {
+        gaps.push_back(block_times_[i] - block_times_[i - 1]);
+    }
+    sort(gaps.begin(), gaps.end());
+    auto percentile = [&gaps](int p) {
+        return gaps[min(gaps.size() - 1, gaps.size() * p / 100)] / 1e3;
+    };
+
+    /* The first block's bytes arrived before the clock started */
+    double elapsed_us = block_times_.back() - block_times_.front();
+    double rate = elapsed_us > 0.0 ? (block_bytes_ - block_first_) * 1e6 / elapsed_us : 0.0;
+    printf("Result: %zu blocks, inter-arrival p50 %.3f ms p90 %.3f ms p99 %.3f ms max %.3f ms.\n",
+        block_times_.size(), percentile(50), percentile(90), percentile(99), gaps.back() / 1e3);
+    printf("Result: %zu bytes of data in %.2f ms (%.1f KB/s).\n", block_bytes_, elapsed_us / 1e3, rate / 1024.0);
+}
+
+void ProgressMeter::start(size_t total)
+{
+    total_ = total;
+    done_ = 0;
+    start_done_ = 0;
+    start_us_ = -1.0;
+    drawn_us_ = 0.0;
+    width_ = 0;
+}
+
+void ProgressMeter::update(size_t done)
+{
+    done_ = done;
+    if(!enabled || total_ == 0)
+    {
+        return;
+    }
+    /* The rate is measured from the first block, not from the seek before it */
+    double now = wall_clock_us();
+    if(start_us_ < 0.0)
+    {
+        start_us_ = now;
+        start_done_ = done;
+    }
+    if(now - drawn_us_ >= PROGRESS_INTERVAL_US)
+    {
+        drawn_us_ = now;
+        draw();
+    }
+}
+
+void ProgressMeter::draw(void)
+{
+    double elapsed = (wall_clock_us() - start_us_) / 1e6;
+    double rate = elapsed > 0.0 ? (done_ - start_done_) / elapsed : 0.0;
+    string line = format("Status: Received %zu/%zu bytes (%d%%), %.1f KB/s", done_, total_, (int)(done_ * 100 / total_), rate / 1024.0);
+    if(rate > 0.0 && done_ < total_)
+    {
+        int eta = (int)((total_ - done_) / rate + 0.5);
+        line += format(", ETA %d:%02d", eta / 60, eta % 60);
+    }
+
+    /* Pad out whatever was left of a longer line */
+    printf("\r%-*s", width_, line.c_str());
+    width_ = max<int>(width_, line.size());
+    fflush(stdout);
+}
+
+void ProgressMeter::clear(void)
+{
+    /* Leave a finished transfer on screen */
+    if(width_ && done_ >= total_)
+    {
+        finish();
+    }
+    else if(width_)
+    {
+        printf("\r%*s\r", width_, "");
+        fflush(stdout);
+        width_ = 0;
+        drawn_us_ = 0.0;
+    }
+}
+
+void ProgressMeter::finish(void)
+{
+    if(width_)
+    {
+        draw();
+        printf("\n");
+        width_ = 0;
+    }
+    total_ = 0;
+}
+
+/* End */
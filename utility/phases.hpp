@@ -0,0 +1,112 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string>
+#include <vector>
+using namespace std;
+
+/* Wall clock and CPU time spent in each phase of a command. mark() ends the
+   phase that is running and starts the next one, marking the phase that is
+   already running does nothing. Phases that run more than once add up, and
+   are listed in the order they first ran.
+
+   Every visit to a phase is also kept as a span in a trace, along with
+   instant events for things like firmware log events, and the arrival time
+   of each block of data so inter-arrival latency can be summarized. */
+class PhaseTimer
+{
+public:
+    class phase
+    {
+    public:
+        string name;
+        uint32_t count = 0;         /* Times the phase was entered */
+        double wall_us = 0.0;
+        double cpu_us = 0.0;
+        size_t bytes = 0;           /* Received from the target during the phase */
+    };
+
+    /* One entry in the trace, times are from the first mark() */
+    class trace_event
+    {
+    public:
+        string name;
+        char type = 'X';            /* 'X' for a phase span, 'i' for an instant */
+        double start_us = 0.0;
+        double duration_us = 0.0;
+        size_t bytes = 0;           /* Received during a span, or the size of a block */
+    };
+
+    /* Start a phase, bytes is the receive count so far */
+    void mark(const string &name, size_t bytes);
+
+    /* End the running phase */
+    void stop(size_t bytes);
+
+    /* Record something that happened at this moment */
+    void instant(const string &name, size_t bytes);
+
+    /* Record the arrival of a block of data */
+    void block(size_t size);
+
+    void clear(void);
+
+    const vector<phase> &phases(void) const { return phases_; }
+    const vector<trace_event> &trace(void) const { return trace_; }
+    double wall_us(void) const;
+    double cpu_us(void) const;
+
+    /* Write the trace in the Trace Event Format chrome://tracing and Perfetto load */
+    bool write_trace(const string &filename) const;
+
+    /* Print time per phase, and block inter-arrival percentiles and throughput */
+    void print_summary(void) const;
+
+private:
+    int current_ = -1;
+    double origin_us_ = -1.0;
+    double wall_start_ = 0.0;
+    double cpu_start_ = 0.0;
+    size_t bytes_start_ = 0;
+    vector<phase> phases_;
+    vector<trace_event> trace_;
+    vector<double> block_times_;
+    size_t block_bytes_ = 0;
+    size_t block_first_ = 0;
+
+    double now_us(void);
+};
+
+/* A single status line showing how much of a transfer has arrived, its rate
+   and time left, redrawn in place. Anything else printed while it is shown
+   must call clear() first. Does nothing unless enabled. */
+class ProgressMeter
+{
+public:
+    bool enabled = false;
+
+    void start(size_t total);
+    void update(size_t done);
+    void clear(void);
+    void finish(void);
+
+private:
+    size_t total_ = 0;
+    size_t done_ = 0;
+    size_t start_done_ = 0;
+    double start_us_ = -1.0;
+    double drawn_us_ = 0.0;
+    int width_ = 0;                 /* Length of the line on screen, zero if not shown */
+
+    void draw(void);
+};
+
+/* True if stdout is a terminal rather than a file or pipe */
+bool stdout_is_terminal(void);
+
+/* Monotonic wall clock and process CPU time, in microseconds */
+double wall_clock_us(void);
+double cpu_clock_us(void);
+
+/* End */
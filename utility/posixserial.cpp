@@ -0,0 +1,44 @@
+#include <stdint.h>
+#include <sys/ioctl.h>
+
+#ifdef __linux__
+#include <asm/termbits.h>
+#include <linux/serial.h>
+#endif
+
+/* Set a baud rate that has no Bxxx constant (e.g. 250000) */
+bool set_custom_baud_rate(int fd, int baud_rate)
+{
+#ifdef __linux__
+    struct termios2 parameters;
+    if(ioctl(fd, TCGETS2, &parameters) != 0)
+    {
+        return false;
+    }
+    parameters.c_cflag &= ~CBAUD;
+    parameters.c_cflag |= BOTHER;
+    parameters.c_ispeed = baud_rate;
+    parameters.c_ospeed = baud_rate;
+    return ioctl(fd, TCSETS2, &parameters) == 0;
+#else
+    return false;
+#endif
+}
+
+/* Ask the driver not to hold received bytes back (FTDI and 16550 ports) */
+bool set_low_latency(int fd)
+{
+#ifdef __linux__
+    struct serial_struct serial;
+    if(ioctl(fd, TIOCGSERIAL, &serial) != 0)
+    {
+        return false;
+    }
+    serial.flags |= ASYNC_LOW_LATENCY;
+    return ioctl(fd, TIOCSSERIAL, &serial) == 0;
+#else
+    return false;
+#endif
+}
+
+/* End */
@@ -0,0 +1,405 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <glob.h>
+#include <unistd.h>
+#include <termios.h>
+#include <sys/ioctl.h>
+#include <string>
+#include <iostream>
+#include <vector>
+#include "utility.hpp"
+using namespace std;
+
+/* Linux-only tty settings, these live in posixserial.cpp because the kernel's
+   termios2 header can't be included alongside <termios.h> */
+bool set_custom_baud_rate(int fd, int baud_rate);
+bool set_low_latency(int fd);
+
+class SerialPort
+{
+public:
+    SerialPort()
+    {
+    }
+
+    ~SerialPort()
+    {
+        if(opened_)
+        {
+            close();
+        }        
+    }
+
+    /* Scan for USB serial devices, preferring the CDC ACM ports an Uno shows up as */
+    bool scan(int *port_number, vector<string> *devices)
+    {
+        bool found = false;
+        glob_t result;
+
+        for(const char *pattern : {"/dev/ttyACM*", "/dev/ttyUSB*"})
+        {
+            if(glob(pattern, 0, NULL, &result) != 0)
+            {
+                continue;
+            }
+
+            for(size_t index = 0; index < result.gl_pathc; index++)
+            {
+                const char *device_name = result.gl_pathv[index];
+
+                /* If the device list exists, add the device name */
+                if(devices)
+                {
+                    devices->push_back(device_name);
+                }
+
+                /* Match /dev/ttyACM0-/dev/ttyACM999 */
+                int number;
+                if(!found && sscanf(device_name, "/dev/ttyACM%d", &number) == 1)
+                {
+                    *port_number = number;
+                    found = true;
+                }
+            }
+            globfree(&result);
+        }
+
+        return found;
+    }
+
+    /* Open a serial port using 8-N-1, no flow control  */
+    bool open(int com_number, int baud_rate)
+    {
+        /* If port -1 is requested, scan for available ports */
+        if(com_number == -1)
+        {
+            if(!scan(&com_number, NULL))
+            {
+                printf("Error: No serial port found.\n");
+                return false;
+            }
+        }
+
+        return open(com_port_name(com_number).c_str(), baud_rate);
+    }
+
+    /* Open a serial port by device path */
+    bool open(const char *device_name, int baud_rate)
+    {
+        snprintf(port_name, sizeof(port_name), "%s", device_name);
+        handle = ::open(port_name, O_RDWR | O_NOCTTY | O_NONBLOCK);
+        if(handle < 0)
+        {
+            printf("Error: Couldn't open `%s'.\n", port_name);
+            fatal_error();
+            return false;
+        }
+
+        /* Stop anyone else from opening the port while we use it */
+        ioctl(handle, TIOCEXCL);
+
+        /* Configure baud rate */
+        if(!configure_uart(baud_rate))
+        {
+            printf("Error: Couldn't configure serial port.\n");
+            fatal_error();
+            return false;
+        }
+
+        /* Deliver bytes as soon as they arrive instead of batching them up */
+        set_low_latency(handle);
+
+        /* Flag port as successfully open */
+        opened_ = true;
+
+        return true;
+    }
+
+    /* Close the serial port */
+    bool close(void)
+    {
+        opened_ = false;
+        if(::close(handle) != 0)
+        {
+            return false;
+        }
+        handle = -1;
+        return true;
+    }
+
+    void fatal_error(void)
+    {
+        cout << "System Error: " << strerror(errno) << "\n";
+
+        if(handle >= 0)
+        {
+            close();
+        }
+    }
+
+    bool configure_uart(int baud_rate = 115200)
+    {
+        struct termios parameters;
+
+        if(tcgetattr(handle, &parameters) != 0)
+        {
+            return false;
+        }
+
+        /* Raw 8-N-1, no flow control, reads return whatever is available */
+        cfmakeraw(&parameters);
+        parameters.c_cflag |= CLOCAL | CREAD;
+        parameters.c_cflag &= ~(CSTOPB | PARENB | CRTSCTS);
+
+        /* Keep DTR up when the port is closed, dropping it resets the Arduino on the next open */
+        parameters.c_cflag &= ~HUPCL;
+        parameters.c_iflag &= ~(IXON | IXOFF | IXANY);
+        parameters.c_cc[VMIN] = 0;
+        parameters.c_cc[VTIME] = 0;
+
+        speed_t speed = get_speed(baud_rate);
+        cfsetispeed(&parameters, speed != B0 ? speed : B115200);
+        cfsetospeed(&parameters, speed != B0 ? speed : B115200);
+
+        /* Set new UART parameters */
+        if(tcsetattr(handle, TCSANOW, &parameters) != 0)
+        {
+            return false;
+        }
+
+        /* Rates without a Bxxx constant have to be set directly */
+        if(speed == B0)
+        {
+            return set_custom_baud_rate(handle, baud_rate);
+        }
+        return true;
+    }
+
+    /* Flush the UART receive queue */
+    bool flush_rx_queue(void)
+    {
+        if(tcflush(handle, TCIFLUSH) != 0)
+        {
+            fatal_error();
+            return false;
+        }
+        return true;
+    }
+
+    /* Flush the UART transmit queue */
+    bool flush_tx_queue(void)
+    {
+        if(tcflush(handle, TCOFLUSH) != 0)
+        {
+            fatal_error();
+            return false;
+        }
+        return true;
+    }
+
+    /* Write to serial port */
+    bool write(uint8_t *buffer, uint32_t size)
+    {
+        uint32_t buffer_index = 0;
+
+        while(size)
+        {
+            ssize_t actual = ::write(handle, &buffer[buffer_index], size);
+            if(actual < 0)
+            {
+                if(errno != EAGAIN && errno != EINTR)
+                {
+                    fatal_error();
+                    return false;
+                }
+
+                /* Transmit queue is full, wait for room */
+                struct pollfd entry = {handle, POLLOUT, 0};
+                poll(&entry, 1, kWriteTimeoutMs);
+                continue;
+            }
+
+            /* Adjust remaining size and advance buffer position */
+            size -= actual;
+            buffer_index += actual;
+        }
+        return true;
+    }
+
+    /* Perform a blocking read from the UART until all data is read */
+    bool read(uint8_t *buffer, uint32_t size)
+    {
+        uint32_t buffer_index = 0;
+
+        while(size)
+        {
+            /* Wait until some data has arrived */
+            if(!wait_readable(-1))
+            {
+                return false;
+            }
+
+            /* Read as much as is available straight into the output buffer */
+            ssize_t actual = ::read(handle, &buffer[buffer_index], size);
+            if(actual < 0)
+            {
+                if(errno == EAGAIN || errno == EINTR)
+                {
+                    continue;
+                }
+                fatal_error();
+                return false;
+            }
+
+            size -= actual;
+            buffer_index += actual;
+        }
+
+        return true;
+    }
+
+    /* Read whatever has arrived, up to size bytes. Waits for the first byte
+       until the timeout expires (-1 waits forever) and returns the count read. */
+    size_t read_some(uint8_t *buffer, size_t size, int timeout_ms)
+    {
+        while(wait_readable(timeout_ms))
+        {
+            ssize_t actual = ::read(handle, buffer, size);
+            if(actual > 0)
+            {
+                return actual;
+            }
+            if(actual < 0 && errno != EAGAIN && errno != EINTR)
+            {
+                fatal_error();
+                return 0;
+            }
+        }
+        return 0;
+    }
+
+    /* Write a single character */
+    bool write(uint8_t ch)
+    {
+        uint8_t buffer[1] = {ch};
+        return write(buffer, 1);
+    }
+
+    /* Read a single character, or return false if nothing arrives in time (-1 waits forever) */
+    bool read_byte(uint8_t &ch, int timeout_ms)
+    {
+        while(wait_readable(timeout_ms))
+        {
+            ssize_t actual = ::read(handle, &ch, 1);
+            if(actual == 1)
+            {
+                return true;
+            }
+            if(actual < 0 && errno != EAGAIN && errno != EINTR)
+            {
+                fatal_error();
+                return false;
+            }
+        }
+        return false;
+    }
+
+    /* Wait until the transmit queue has gone out */
+    bool wait_transmit(void)
+    {
+        return tcdrain(handle) == 0;
+    }
+
+    /* Wait until the UART has receieved 1+ characters, or the timeout expires (-1 waits forever) */
+    bool wait_readable(int timeout_ms)
+    {
+        struct pollfd entry = {handle, POLLIN, 0};
+        int status;
+
+        do
+        {
+            status = poll(&entry, 1, timeout_ms);
+        } while(status < 0 && errno == EINTR);
+
+        if(status < 0 || (entry.revents & (POLLERR | POLLHUP | POLLNVAL)))
+        {
+            printf("Error: Serial port closed or failed.\n");
+            return false;
+        }
+
+        return status > 0;
+    }
+
+    /* Get number of bytes in recieve queue */
+    size_t get_rx_queue_size(void)
+    {
+        int size = 0;
+        if(ioctl(handle, FIONREAD, &size) != 0)
+        {
+            return 0;
+        }
+        return size;
+    }
+
+    /* Get number of bytes in transmit queue */
+    size_t get_tx_queue_size(void)
+    {
+        int size = 0;
+        if(ioctl(handle, TIOCOUTQ, &size) != 0)
+        {
+            return 0;
+        }
+        return size;
+    }
+
+    /* Control DTR pin, ports without modem lines (e.g. a pty) just ignore this */
+    bool set_dtr(bool enable)
+    {
+        int lines = TIOCM_DTR;
+        return ioctl(handle, enable ? TIOCMBIS : TIOCMBIC, &lines) == 0;
+    }
+
+    /* Control RTS pin */
+    bool set_rts(bool enable)
+    {
+        int lines = TIOCM_RTS;
+        return ioctl(handle, enable ? TIOCMBIS : TIOCMBIC, &lines) == 0;
+    }
+
+    int handle = -1;
+    char port_name[256];
+
+private:
+    static constexpr int kWriteTimeoutMs = 100;
+    bool opened_ = false;
+
+    /* Get the termios constant for a baud rate, or B0 if there isn't one */
+    static speed_t get_speed(int baud_rate)
+    {
+        static const struct { int rate; speed_t speed; } kSpeeds[] = {
+            {9600, B9600}, {19200, B19200}, {38400, B38400}, {57600, B57600},
+            {115200, B115200}, {230400, B230400},
+#ifdef B500000
+            {500000, B500000}, {1000000, B1000000}, {2000000, B2000000},
+#endif
+        };
+
+        for(auto &entry : kSpeeds)
+        {
+            if(entry.rate == baud_rate)
+            {
+                return entry.speed;
+            }
+        }
+        return B0;
+    }
+
+}; /* end class */
+
+/* End */
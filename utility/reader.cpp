@@ -0,0 +1,497 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <cassert>
+#include <array>
+#include <map>
+#include "reader.hpp"
+#include "consensus.hpp"
+#include "utility.hpp"
+#include "third_party/sha256.h"
+
+/* Negotiate the link, run CMD_READ on a connected target and decode what it sends */
+bool read_rom(Comms &comms, const read_options &options, read_result &result)
+{
+    command_context p;
+    int range_start = options.range_start;
+    int range_length = options.range_length;
+    int read_passes = options.passes;
+
+    /* A range, multi-pass or framed read always uses compact mode */
+    bool compact = options.compact || options.framed || range_start != 0 || range_length != ROM_SIZE || read_passes > 1;
+    size_t total = range_length * read_passes;
+
+    /* Raw test data buffer (4 bytes per address read) */
+    vector<uint8_t> buffer(total * 4);
+
+    /* Burst and snapshot only apply to a full raw read, say so rather than quietly reading another way */
+    if(compact && (options.burst || options.snapshot))
+    {
+        printf("Warning: %s%s%s ignored, a range, multi-pass, framed or compact read always uses compact mode.\n",
+            options.burst ? "--burst" : "", options.burst && options.snapshot ? " and " : "", options.snapshot ? "--snapshot" : "");
+    }
+    bool burst = options.burst && !compact;
+
+    /* Snapshot mode receives the target's ports as read, 6 bytes per address */
+    bool snapshot = options.snapshot && !compact;
+    vector<uint8_t> snapshots(snapshot ? total * SNAPSHOT_SIZE : 0);
+
+    /* Compact mode only receives data bytes, the log is rebuilt afterwards */
+    vector<uint8_t> data(total);
+
+    /* Send parameters for read command */
+    p.parameters.push_back(compact ? 8 : (snapshot ? 9 : 6));
+    p.parameters.push_back((options.clock_rate_khz >> 0) & 0xFF);
+    p.parameters.push_back((options.clock_rate_khz >> 8) & 0xFF);
+    p.parameters.push_back((range_start >> 0) & 0xFF);
+    p.parameters.push_back((range_start >> 8) & 0xFF);
+    p.parameters.push_back((range_length >> 0) & 0xFF);
+    p.parameters.push_back((range_length >> 8) & 0xFF);
+    p.parameters.push_back(read_passes);
+    p.parameters.push_back((options.framed ? READ_FLAG_FRAMED : 0) | (options.timing ? READ_FLAG_TIMING : 0) |
+        (options.unrolled ? READ_FLAG_UNROLLED : 0) | (burst ? READ_FLAG_BURST : 0));
+    p.command = CMD_READ;
+    p.type = CMD_DISPATCH;
+    p.framed = options.framed;
+    p.rx_buffer = compact ? data.data() : (snapshot ? snapshots.data() : buffer.data());
+    p.rx_size = compact ? data.size() : (snapshot ? snapshots.size() : buffer.size());
+
+    /* Vote on each pass as it arrives, and stop the target once every byte agrees */
+    Consensus consensus(range_start, range_length, min(options.agree, read_passes));
+    bool stop_sent = false;
+
+    /* Compare each pass with the first one as it arrives */
+    vector<int> differences(read_passes, 0);
+    auto on_data = [&](size_t offset, size_t size) {
+        for(size_t position = offset; position < offset + size; position++)
+        {
+            int pass = position / range_length;
+            int index = position % range_length;
+            if(pass != 0 && data[position] != data[index])
+            {
+                differences[pass]++;
+            }
+            if(index != range_length - 1)
+            {
+                continue;
+            }
+            comms.progress.clear();
+            if(pass != 0)
+            {
+                printf("Status: Pass %d received, %d bytes differ from pass 1.\n", pass + 1, differences[pass]);
+            }
+            consensus.add_pass(&data[pass * range_length]);
+            if(!stop_sent && pass + 1 < read_passes && consensus.converged())
+            {
+                comms.progress.clear();
+                printf("Status: All bytes agree in %d passes, stopping.\n", consensus.passes());
+                comms.sendb(ASCII_ESC);
+                stop_sent = true;
+            }
+        }
+    };
+    if(compact)
+    {
+        p.on_data = on_data;
+    }
+
+    /* Run command */
+    if(options.baud_rate > LINK_BASE_BAUD_RATE)
+    {
+        comms.negotiate_link(options.baud_rate);
+    }
+    comms.mark_phase("command");
+    if(!comms.send_command(CMD_READ) || !comms.dispatch_target(&p))
+    {
+        printf("Error: Failed to run command on target.\n");
+        return false;
+    }
+
+    if(options.framed)
+    {
+        printf("Status: %u bad frames resent, %u duplicate frames.\n", (unsigned)comms.frame_errors, (unsigned)comms.frame_duplicates);
+    }
+
+    comms.mark_phase("decode");
+
+    /* The target may stop early, only keep the passes it finished. Less
+       data than that means some was lost on the way. */
+    if(compact && comms.target_checksums.empty())
+    {
+        printf("Error: Target didn't finish a pass.\n");
+        return false;
+    }
+    int passes = compact ? min((int)comms.target_checksums.size(), read_passes) : 1;
+    size_t expected = compact ? (size_t)range_length * passes : p.rx_size;
+    if(p.rx_received != expected)
+    {
+        printf("Error: Received %u bytes of read data, expected %u.\n", (unsigned)p.rx_received, (unsigned)expected);
+        return false;
+    }
+
+    if(comms.target_checksums.size() < (size_t)passes)
+    {
+        printf("Error: Target didn't report a checksum.\n");
+        return false;
+    }
+    total = range_length * passes;
+    buffer.resize(total * 4);
+
+    if(snapshot)
+    {
+        /* The target checksums the port bytes as sent, as it never decodes them */
+        uint8_t checksum = 0x81;
+        for(uint8_t value : snapshots)
+        {
+            checksum += value;
+        }
+        printf("Local snapshot checksum = %02X\n", checksum);
+        if(checksum != comms.target_checksums[0])
+        {
+            printf("Error: Snapshot checksum doesn't match the target's (%02X), data was damaged in transfer.\n", comms.target_checksums[0]);
+            return false;
+        }
+        unscramble_snapshots(snapshots.data(), total, buffer.data());
+    }
+
+    /* Rebuild raw test data from the expected address sequence and exceptions */
+    if(compact)
+    {
+        printf("Status: Rebuilding raw test data (%d address exceptions).\n", (int)p.exceptions.size());
+        for(size_t position = 0; position < total; position++)
+        {
+            uint8_t *entry = &buffer[position * 4];
+            encode_bus_address(range_start + position % range_length, &entry[0], &entry[1]);
+            entry[2] = entry[0];
+            entry[3] = data[position];
+        }
+        for(auto &record : p.exceptions)
+        {
+            if(record.offset >= total)
+            {
+                continue;
+            }
+            uint8_t *entry = &buffer[record.offset * 4];
+            entry[0] = record.ah;
+            entry[1] = record.adl;
+            entry[2] = record.ah2;
+            entry[3] = record.data;
+        }
+    }
+
+    /* Checksum each pass, and place the first pass in a ROM image with unread locations blank */
+    vector<uint8_t> rom(ROM_SIZE, 0xFF);
+    int bad_pass = 0;
+    for(int pass = 0; pass < passes; pass++)
+    {
+        uint8_t *entries = &buffer[pass * range_length * 4];
+        uint8_t checksum = checksum_pass(entries, range_start, range_length, pass == 0 ? rom.data() : nullptr);
+        if(passes > 1)
+        {
+            printf("Local checksum (pass %d) = %02X\n", pass + 1, checksum);
+        }
+        else
+        {
+            printf("Local checksum = %02X\n", checksum);
+        }
+        if(!snapshot && checksum != comms.target_checksums[pass] && !bad_pass)
+        {
+            bad_pass = pass + 1;
+        }
+    }
+
+    /* The target checksums what it read, so a difference means the data was damaged on the way */
+    if(bad_pass)
+    {
+        printf("Error: Pass %d checksum doesn't match the target's (%02X), data was damaged in transfer.\n",
+            bad_pass, comms.target_checksums[bad_pass - 1]);
+        return false;
+    }
+
+    /* Replace the ROM image with the vote over all passes, and note which bytes were unstable */
+    vector<uint8_t> confidence;
+    if(passes > 1)
+    {
+        int unstable = 0;
+        int weak = 0;
+        confidence.assign(ROM_SIZE * 2, 0);
+        for(size_t index = 0; index < consensus.length(); index++)
+        {
+            uint16_t address = consensus.address(index);
+            if(address < 0x80)
+            {
+                continue;
+            }
+            rom[address] = consensus.value(index);
+            confidence[address * 2 + 0] = consensus.agreement(index);
+            confidence[address * 2 + 1] = consensus.unstable(index);
+            if(consensus.unstable(index))
+            {
+                if(unstable < 16)
+                {
+                    printf("Warning: Byte %03X = %02X has unstable bits %02X (%d of %d passes agree).\n",
+                        address, rom[address], consensus.unstable(index), consensus.agreement(index), passes);
+                }
+                ++unstable;
+            }
+            if(consensus.agreement(index) < consensus.threshold())
+            {
+                ++weak;
+            }
+        }
+        if(unstable)
+        {
+            printf("Warning: %d bytes have unstable bits, ROM image is the majority vote of %d passes.\n", unstable, passes);
+        }
+        if(weak)
+        {
+            printf("Warning: %d bytes did not reach %d passes in agreement.\n", weak, consensus.threshold());
+        }
+    }
+
+    result.rom = move(rom);
+    result.log = move(buffer);
+    result.confidence = move(confidence);
+    result.passes = passes;
+    return true;
+}
+
+/* Parse a --clock rate in kHz, zero or within the Timer1 engine's range */
+bool parse_clock_rate(const string &text, int &rate_khz)
+{
+    char *end = NULL;
+    long value = strtol(text.c_str(), &end, 10);
+    if(text.empty() || *end != '\0')
+    {
+        return false;
+    }
+    if(value != 0 && (value < CLOCK_RATE_MIN_KHZ || value > CLOCK_RATE_MAX_KHZ))
+    {
+        return false;
+    }
+    rate_khz = value;
+    return true;
+}
+
+/* Add up one pass of raw test data, 4 bytes per address from range_start,
+   and copy its data bytes into rom if it isn't null */
+uint8_t checksum_pass(const uint8_t *entries, int range_start, int range_length, uint8_t *rom)
+{
+    uint8_t checksum = 0x81;
+    for(int index = 0; index < range_length; index++)
+    {
+        int address = (range_start + index) & 0xFFF;
+        const uint8_t *entry = &entries[index * 4];
+
+        /* Don't use first 128 bytes, they are RAM, I/O and unused locations */
+        if(address < 0x80)
+        {
+            continue;
+        }
+        for(int i = 0; i < 4; i++)
+        {
+            checksum += entry[i];
+        }
+        if(rom)
+        {
+            rom[address] = entry[3];
+        }
+    }
+    return checksum;
+}
+
+/* Port bits to bus state. Port D has ADL7-ADL2 on PD7-PD2 and port B has
+   ADL1-ADL0 on PB4-PB3; port C has AH2-AH0 on PC2-PC0 and AH3 on PC4.
+   The other pins are the UART, RES_N, EXTAL, STROBE and NUM. */
+class snapshot_tables
+{
+public:
+    snapshot_tables()
+    {
+        for(int value = 0; value < 0x100; value++)
+        {
+            adl_d[value] = value & 0xFC;
+            adl_b[value] = (value >> 3) & 0x03;
+            ah[value] = (value & 0x07) | ((value >> 1) & 0x08);
+        }
+    }
+
+    uint8_t adl_d[0x100];
+    uint8_t adl_b[0x100];
+    uint8_t ah[0x100];
+};
+
+/* Decode port snapshots from read mode 0x09 into raw test data, the same
+   4 bytes per address as read mode 0x06 sends */
+void unscramble_snapshots(const uint8_t *snapshots, size_t count, uint8_t *entries)
+{
+    static const snapshot_tables tables;
+    for(size_t index = 0; index < count; index++)
+    {
+        const uint8_t *ports = &snapshots[index * SNAPSHOT_SIZE];
+        uint8_t *entry = &entries[index * 4];
+        entry[0] = tables.ah[ports[2]];
+        entry[1] = tables.adl_d[ports[0]] | tables.adl_b[ports[1]];
+        entry[2] = tables.ah[ports[3]];
+        entry[3] = tables.adl_d[ports[4]] | tables.adl_b[ports[5]];
+    }
+}
+
+/* Write one output file */
+static bool write_file(const string &filename, const vector<uint8_t> &data)
+{
+    FILE *fd = fopen(filename.c_str(), "wb");
+    if(!fd)
+    {
+        printf("Error: Can't open file `%s' for writing.\n", filename.c_str());
+        return false;
+    }
+    fwrite(data.data(), data.size(), 1, fd);
+    fclose(fd);
+    return true;
+}
+
+/* Write the ROM image, the raw test data to file.log and the confidence map to file.conf */
+bool write_read_result(string filename, const read_result &result)
+{
+    printf("Status: Writing ROM image to file `%s'.\n", filename.c_str());
+    if(!write_file(filename, result.rom))
+    {
+        return false;
+    }
+
+    printf("Status: Writing raw test data to `%s.log'.\n", filename.c_str());
+    if(!write_file(filename + ".log", result.log))
+    {
+        return false;
+    }
+
+    /* Confidence map is two bytes per address: passes in agreement, unstable bit mask */
+    if(result.confidence.size())
+    {
+        printf("Status: Writing confidence map to `%s.conf'.\n", filename.c_str());
+        if(!write_file(filename + ".conf", result.confidence))
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+/******************************************************************************/
+/******************************************************************************/
+/******************************************************************************/
+
+uint8_t ascii2dec(uint8_t value)
+{
+    value = tolower(value);
+    uint8_t temp = 0;
+    if(value > '0' && value <= '9')
+        temp = value - '0';
+    else
+        temp = value - 'a';
+    return temp;
+}
+
+constexpr std::array<uint8_t, SHA256_DIGEST_LENGTH> SHA256_DIGEST(const char *input)
+{
+    std::array<uint8_t, SHA256_DIGEST_LENGTH> data{};
+    assert(strlen(input) == SHA256_DIGEST_LENGTH*2);
+    for(int i = 0; i < SHA256_DIGEST_LENGTH*2; i++) {        
+        uint8_t digit = ascii2dec(input[i]);
+        if(i & 1)
+            data[i] |= digit;
+        else
+            data[i] = digit << 4;
+    }
+    return data;
+}
+
+map<string, string> self_check_sha256_map = {
+    {"9088fee917e5a748c2f0b4f5458c1cbdabbd696291c69be6e605bae0ef779e8f", "HD6805V1"},
+};
+
+/* Analyze a 4K ROM image and return the report */
+string check_rom(const uint8_t *data)
+{
+    /* Vector names */
+    const uint16_t vector_base = 0xFF0;
+    const char *vector_names[] = {
+        "TIMER",
+        "INT#",
+        "SWI",
+        "RES#"
+    };
+
+    const char *vector_types[] = {
+        "Self-check",
+        "Customer"
+    };
+
+    const uint16_t checksum_address = 0xFEF;
+    const uint16_t self_check_reset_vector_address = 0xFF6;
+    const uint16_t self_check_reset_vector = 0xF80;
+    const uint16_t rom_base = 0x80;
+    const uint16_t self_check_size = 0x78;
+
+    BeMemory<ROM_SIZE> rom;
+    string report;
+
+    memcpy(rom.data, data, rom.size);
+
+    for(int i = 0; i < 8; i++)
+    {
+        if((i & 3) == 0)
+            report += format("%s vectors:\n", vector_types[(i >> 2) & 1]);
+        report += format("* %-5s = $%04X\n", vector_names[i&3], rom.readw(vector_base + i * 2));
+    }
+
+    report += "Self-check ROM analysis:\n";
+
+    uint16_t temp = rom.readw(self_check_reset_vector_address);
+    if(temp != self_check_reset_vector || temp & 0xf000) {
+        report += format("* Reset vector is not valid (%04X, expected %04X).\n", temp, self_check_reset_vector);
+    } else {
+        report += "* Reset vector is valid.\n";
+
+        /* Save ROM checksum and initialize it */
+        uint8_t rom_checksum = rom.readb(checksum_address);
+        rom.writeb(checksum_address, 0xFF);
+
+        /* Compute checksum of entire ROM */
+        uint8_t acc = 0;
+        for(int i = rom_base; i < rom.size; i++)
+        {
+            acc ^= rom.readb(i);
+        }
+
+        report += format("* Internal checksum   = %02X\n", rom_checksum);
+        report += format("* Calculated checksum = %02X\n", acc);
+        if(rom_checksum != acc) {
+            report += "* Checksum mismatch. Bad ROM dump or non-standard ROM size?";
+        }
+
+        /* Compute SHA256 of self-check ROM */
+        uint8_t raw_digest[SHA256_DIGEST_LENGTH];
+        string digest;
+        sha256(rom.data, self_check_size, raw_digest);
+        for(int i = 0; i < SHA256_DIGEST_LENGTH; i++)
+        {
+            const char *hextab = "0123456789abcdef";
+            digest += hextab[(raw_digest[i] >> 4) & 0x0F];
+            digest += hextab[(raw_digest[i] >> 0) & 0x0F];
+        }
+        report += format("* ROM SHA256 = %s\n", digest.c_str());
+
+        auto result = self_check_sha256_map.find(digest);
+        if(result != self_check_sha256_map.end())
+        {
+            report += format("* ROM matches device type %s\n", result->second.c_str());
+        } else {
+            report += "* ROM does not match any known device type.\n";
+        }
+    }
+    return report;
+}
+
+/* End */
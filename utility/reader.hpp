@@ -0,0 +1,73 @@
+#pragma once
+
+#include <stdint.h>
+#include <list>
+#include <string>
+#include <vector>
+#include "comms.hpp"
+using namespace std;
+
+#define ROM_SIZE                0x1000
+#define ASCII_ESC               0x1B
+#define SNAPSHOT_SIZE           6       /* kSnapshotSize, port bytes per address in mode 0x09 */
+#define CLOCK_RATE_MIN_KHZ      10      /* kClockRateMinKhz */
+#define CLOCK_RATE_MAX_KHZ      400     /* kClockRateMaxKhz */
+
+/* Parse a --clock rate in kHz, zero or within the Timer1 engine's range */
+bool parse_clock_rate(const string &text, int &rate_khz);
+
+/* Settings for one read of the ROM */
+class read_options
+{
+public:
+    int baud_rate = LINK_MAX_BAUD_RATE;     /* Highest rate to negotiate */
+    int clock_rate_khz = 0;                 /* Zero for the bit-banged clock */
+    bool compact = false;
+    bool framed = false;
+    bool timing = false;                    /* Have the firmware time its work */
+    bool unrolled = false;                  /* Use the firmware's unrolled address loop */
+    bool burst = false;                     /* Capture blocks before sending, raw modes only */
+    bool snapshot = false;                  /* Raw mode sends port snapshots, decoded here */
+    int range_start = 0x000;
+    int range_length = ROM_SIZE;
+    int passes = 1;
+    int agree = 3;
+};
+
+/* Everything a read produces */
+class read_result
+{
+public:
+    vector<uint8_t> rom;            /* ROM image, unread locations are 0xFF */
+    vector<uint8_t> log;            /* Raw test data, 4 bytes per address read */
+    vector<uint8_t> confidence;     /* Agreement and unstable bits per address, multi-pass only */
+    int passes = 0;                 /* Passes actually received */
+};
+
+/* Big endian view of a power of two sized memory, addresses wrap */
+template<size_t N>
+class BeMemory
+{
+public:
+    static constexpr uint16_t mask = (uint16_t)(N-1);
+    uint8_t readb(uint16_t addr) { 
+        return data[addr & mask]; 
+    }
+    uint16_t readw(uint16_t addr) { 
+        return (readb(addr) << 8) | readb(addr+1);
+    }
+    void writeb(uint16_t addr, uint8_t value) {
+        data[addr] = value;
+    }
+
+    static const size_t size = N;
+    uint8_t data[size];
+};
+
+bool read_rom(Comms &comms, const read_options &options, read_result &result);
+uint8_t checksum_pass(const uint8_t *entries, int range_start, int range_length, uint8_t *rom);
+void unscramble_snapshots(const uint8_t *snapshots, size_t count, uint8_t *entries);
+bool write_read_result(string filename, const read_result &result);
+string check_rom(const uint8_t *data);
+
+/* End */
@@ -0,0 +1,8 @@
+#pragma once
+
+/* Select the serial port implementation for the host OS */
+#ifdef _WIN32
+#include "winserial.hpp"
+#else
+#include "posixserial.hpp"
+#endif
@@ -0,0 +1,308 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string>
+#include "serial.hpp"
+#include "arduino_serial.hpp"
+using namespace std;
+
+#ifndef _WIN32
+#include <stdlib.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <termios.h>
+#endif
+
+/* A byte stream to the target. Comms only talks to the target through this,
+   so the protocol code can run against something other than a COM port. */
+class Transport
+{
+public:
+    virtual ~Transport()
+    {
+    }
+
+    /* Open the connection, the arguments are the --port settings */
+    virtual bool open(int com_port, const string &com_device) = 0;
+    virtual bool close(void) = 0;
+
+    /* Restart the target, returns false if the transport can't */
+    virtual bool reset(void)
+    {
+        return false;
+    }
+
+    /* Change the line rate, transports without a UART ignore this */
+    virtual bool set_baud_rate(int baud_rate)
+    {
+        return true;
+    }
+
+    virtual bool write(const uint8_t *data, size_t size) = 0;
+
+    /* Read whatever has arrived, up to size bytes. Waits for the first byte
+       until the timeout expires (-1 waits forever) and returns the count read. */
+    virtual size_t read_some(uint8_t *data, size_t size, int timeout_ms) = 0;
+
+    /* Throw away anything received but not read yet */
+    virtual void flush_rx_queue(void)
+    {
+    }
+
+    bool write(uint8_t value)
+    {
+        return write(&value, 1);
+    }
+
+    /* Blocking read until all of the data has arrived */
+    bool read(uint8_t *data, size_t size)
+    {
+        while(size)
+        {
+            size_t actual = read_some(data, size, -1);
+            if(actual == 0)
+            {
+                return false;
+            }
+            data += actual;
+            size -= actual;
+        }
+        return true;
+    }
+};
+
+/* An Arduino on a COM port or serial device */
+class SerialTransport : public Transport
+{
+public:
+    SerialTransport(int baud_rate) : baud_rate_(baud_rate)
+    {
+    }
+
+    /* The port is opened without resetting the Arduino, see Comms::connect() */
+    bool open(int com_port, const string &com_device) override
+    {
+        return port.openArduino(com_port, baud_rate_, com_device, false);
+    }
+
+    bool close(void) override
+    {
+        return port.close();
+    }
+
+    bool reset(void) override
+    {
+        port.resetArduino(0);
+        return true;
+    }
+
+    bool set_baud_rate(int baud_rate) override
+    {
+        return port.configure_uart(baud_rate);
+    }
+
+    bool write(const uint8_t *data, size_t size) override
+    {
+        return port.write((uint8_t *)data, size);
+    }
+
+    size_t read_some(uint8_t *data, size_t size, int timeout_ms) override
+    {
+        return port.read_some(data, size, timeout_ms);
+    }
+
+    void flush_rx_queue(void) override
+    {
+        port.flush_rx_queue();
+    }
+
+    ArduinoSerialPort port;
+
+private:
+    int baud_rate_;
+};
+
+/* The target end of a MemoryTransport. It runs in the caller's thread: data
+   the host sends is handed to receive(), and transmit() is called whenever
+   the host wants more data from the target. */
+class TransportPeer
+{
+public:
+    virtual ~TransportPeer()
+    {
+    }
+
+    /* Data sent by the host, only valid for the duration of the call */
+    virtual void receive(const uint8_t *data, size_t size) = 0;
+
+    /* Put up to size bytes of output into data, returns the count written */
+    virtual size_t transmit(uint8_t *data, size_t size) = 0;
+
+    /* Restart the target */
+    virtual void reset(void)
+    {
+    }
+};
+
+/* An in-memory pipe to a TransportPeer. Nothing is buffered in between: the
+   peer writes its output straight into the Comms receive buffer and parses
+   host data straight out of the caller's buffer, so there are no copies or
+   system calls beyond the protocol code itself. A peer with nothing to send
+   makes a read return at once, as if its timeout had expired. */
+class MemoryTransport : public Transport
+{
+public:
+    MemoryTransport(TransportPeer *peer) : peer_(peer)
+    {
+    }
+
+    bool open(int com_port, const string &com_device) override
+    {
+        return peer_ != nullptr;
+    }
+
+    bool close(void) override
+    {
+        return true;
+    }
+
+    bool reset(void) override
+    {
+        peer_->reset();
+        return true;
+    }
+
+    bool write(const uint8_t *data, size_t size) override
+    {
+        peer_->receive(data, size);
+        return true;
+    }
+
+    size_t read_some(uint8_t *data, size_t size, int timeout_ms) override
+    {
+        return peer_->transmit(data, size);
+    }
+
+private:
+    TransportPeer *peer_;
+};
+
+#ifndef _WIN32
+
+/* The master side of a pseudo-terminal. A target emulator, or anything else
+   that speaks the firmware protocol, opens the slave device printed when the
+   transport is opened. */
+class PtyTransport : public Transport
+{
+public:
+    ~PtyTransport()
+    {
+        close();
+    }
+
+    bool open(int com_port, const string &com_device) override
+    {
+        master_ = posix_openpt(O_RDWR | O_NOCTTY | O_NONBLOCK);
+        if(master_ < 0 || grantpt(master_) != 0 || unlockpt(master_) != 0)
+        {
+            printf("Error: Couldn't create a pseudo-terminal (%s).\n", strerror(errno));
+            close();
+            return false;
+        }
+        peer_name_ = ptsname(master_);
+
+        /* Keep the slave open so reads don't fail before the peer attaches, and make it raw */
+        slave_ = ::open(peer_name_.c_str(), O_RDWR | O_NOCTTY);
+        struct termios settings;
+        if(slave_ < 0 || tcgetattr(slave_, &settings) != 0)
+        {
+            printf("Error: Couldn't open `%s'.\n", peer_name_.c_str());
+            close();
+            return false;
+        }
+        cfmakeraw(&settings);
+        tcsetattr(slave_, TCSANOW, &settings);
+
+        /* Whatever starts the target may be waiting on this line */
+        printf("Status: Target can attach to %s.\n", peer_name_.c_str());
+        fflush(stdout);
+        return true;
+    }
+
+    bool close(void) override
+    {
+        if(slave_ >= 0)
+        {
+            ::close(slave_);
+            slave_ = -1;
+        }
+        if(master_ >= 0)
+        {
+            ::close(master_);
+            master_ = -1;
+        }
+        return true;
+    }
+
+    bool write(const uint8_t *data, size_t size) override
+    {
+        while(size)
+        {
+            ssize_t actual = ::write(master_, data, size);
+            if(actual < 0)
+            {
+                if(errno != EAGAIN && errno != EINTR)
+                {
+                    return false;
+                }
+                struct pollfd entry = {master_, POLLOUT, 0};
+                poll(&entry, 1, 100);
+                continue;
+            }
+            data += actual;
+            size -= actual;
+        }
+        return true;
+    }
+
+    size_t read_some(uint8_t *data, size_t size, int timeout_ms) override
+    {
+        struct pollfd entry = {master_, POLLIN, 0};
+        while(poll(&entry, 1, timeout_ms) > 0)
+        {
+            ssize_t actual = ::read(master_, data, size);
+            if(actual > 0)
+            {
+                return actual;
+            }
+            if(actual < 0 && errno != EAGAIN && errno != EINTR)
+            {
+                return 0;
+            }
+        }
+        return 0;
+    }
+
+    void flush_rx_queue(void) override
+    {
+        tcflush(master_, TCIFLUSH);
+    }
+
+    /* Device the target end opens */
+    const string &peer_name(void) const
+    {
+        return peer_name_;
+    }
+
+private:
+    int master_ = -1;
+    int slave_ = -1;
+    string peer_name_;
+};
+
+#endif
+
+/* End */
@@ -1,6 +1,19 @@
 
+#include <stdio.h>
+#include <string.h>
+#include <ctype.h>
 #include "utility.hpp"
 
+#ifdef _WIN32
+#include <conio.h>
+#else
+#include <unistd.h>
+#include <poll.h>
+#include <glob.h>
+#endif
+
+#ifdef _WIN32
+
 /* Find device name associated with port if present */
 bool QueryComPort(int port_number, char *device_name, size_t size)
 {
@@ -15,13 +28,35 @@ bool QueryComPort(int port_number, char *device_name, size_t size)
     return false;
 }
 
+#else
+
+/* Find device name associated with port if present */
+bool QueryComPort(int port_number, char *device_name, size_t size)
+{
+    string name = com_port_name(port_number);
+    if(access(name.c_str(), F_OK) != 0) {
+        return false;
+    }
+
+    snprintf(device_name, size, "%s", name.c_str());
+    return true;
+}
+
+#endif
+
+
+#ifdef _WIN32
+static const char *serial_converter_prefix = "USBSER";
+static const int port_min = 1;
+#else
+static const char *serial_converter_prefix = "/dev/ttyACM";
+static const int port_min = 0;
+#endif
+static const int port_max = 128;
 
 int ListComPort(bool verbose)
 {
     constexpr size_t buffer_size = 256;
-    const char *serial_converter_prefix = "USBSER";
-    int port_min = 1;
-    int port_max = 128;
     bool found = false;
     char result[buffer_size];
     char device_name[buffer_size];
@@ -36,7 +71,7 @@ int ListComPort(bool verbose)
         if(QueryComPort(i, device_name, sizeof(device_name)))
         {
             if(verbose)
-                printf("- Found device COM%d (%s)\n", i, device_name);
+                printf("- Found device %s (%s)\n", com_port_name(i).c_str(), device_name);
 
             if(strstr(device_name, serial_converter_prefix))
             {                
@@ -46,6 +81,19 @@ int ListComPort(bool verbose)
         }
     }
 
+#ifndef _WIN32
+    /* USB serial converters that aren't numbered like a port */
+    glob_t converters;
+    if(verbose && glob("/dev/ttyUSB*", 0, NULL, &converters) == 0)
+    {
+        for(size_t i = 0; i < converters.gl_pathc; i++)
+        {
+            printf("- Found device %s (use --port %s)\n", converters.gl_pathv[i], converters.gl_pathv[i]);
+        }
+        globfree(&converters);
+    }
+#endif
+
     if(!found)
     {
         if(verbose)
@@ -56,6 +104,35 @@ int ListComPort(bool verbose)
     return index;
 }
 
+/* Find every port with a reader attached. Numbered ports are returned as
+   their number, other USB serial converters as a device path. */
+vector<string> FindReaderPorts(void)
+{
+    vector<string> ports;
+    char device_name[256];
+
+    for(int i = port_min; i < port_max; i++)
+    {
+        if(QueryComPort(i, device_name, sizeof(device_name)) && strstr(device_name, serial_converter_prefix))
+        {
+            ports.push_back(format("%d", i));
+        }
+    }
+
+#ifndef _WIN32
+    glob_t converters;
+    if(glob("/dev/ttyUSB*", 0, NULL, &converters) == 0)
+    {
+        for(size_t i = 0; i < converters.gl_pathc; i++)
+        {
+            ports.push_back(converters.gl_pathv[i]);
+        }
+        globfree(&converters);
+    }
+#endif
+
+    return ports;
+}
 
 /* Return a formatted string */
 string format(const char *fmt, ...)
@@ -73,11 +150,65 @@ string format(const char *fmt, ...)
 /* Set terminal text color */
 void set_terminal_color(uint8_t attribute)
 {
+#ifdef _WIN32
     static HANDLE console = nullptr;
     if(console == nullptr) {
         console = GetStdHandle(STD_OUTPUT_HANDLE);
     }
     SetConsoleTextAttribute(console, attribute);
+#else
+    /* Map console attribute (IRGB) to an ANSI color, normal white is a reset */
+    if(!isatty(STDOUT_FILENO)) {
+        return;
+    }
+    if((attribute & 0x0F) == 0x07) {
+        printf("\033[0m");
+        return;
+    }
+    int color = ((attribute & 0x04) ? 1 : 0) | ((attribute & 0x02) ? 2 : 0) | ((attribute & 0x01) ? 4 : 0);
+    printf("\033[%d;%dm", (attribute & 0x08) ? 1 : 0, 30 + color);
+#endif
+}
+
+/* Get the name of a numbered serial port */
+string com_port_name(int port_number)
+{
+#ifdef _WIN32
+    return format("COM%d", port_number);
+#else
+    return format("/dev/ttyACM%d", port_number);
+#endif
+}
+
+/* Wait for a number of milliseconds */
+void sleep_ms(uint32_t delay_ms)
+{
+#ifdef _WIN32
+    Sleep(delay_ms);
+#else
+    usleep(delay_ms * 1000);
+#endif
+}
+
+/* Check if a key is waiting on the console */
+bool key_pressed(void)
+{
+#ifdef _WIN32
+    return _kbhit();
+#else
+    struct pollfd entry = {STDIN_FILENO, POLLIN, 0};
+    return poll(&entry, 1, 0) > 0;
+#endif
+}
+
+/* Read a key from the console */
+int read_key(void)
+{
+#ifdef _WIN32
+    return getch();
+#else
+    return getchar();
+#endif
 }
 
 /* Print buffer as hex dump to stdout */
@@ -146,6 +277,19 @@ void print_hexdump(uint8_t *buffer, size_t buffer_size, int stride)
     }
 }
 
+/* Update a CRC-16/CCITT (polynomial 0x1021), the same as avr-libc's _crc_xmodem_update() */
+uint16_t crc16_update(uint16_t crc, uint8_t data)
+{
+    crc ^= data << 8;
+    for(int bit = 0; bit < 8; bit++)
+    {
+        crc = (crc & 0x8000) ? (crc << 1) ^ 0x1021 : (crc << 1);
+    }
+    return crc;
+}
+
+#ifdef _WIN32
+
 /* Print a Windows error message */
 string FormatWindowsError(void)
 {
@@ -166,4 +310,6 @@ string FormatWindowsError(void)
     return string((const char *)lpMsgBuf);
 }
 
+#endif
+
 /* End */
\ No newline at end of file
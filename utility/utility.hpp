@@ -1,16 +1,29 @@
 
 #pragma once
 
+#include <stdint.h>
 #include <stdarg.h>
+#ifdef _WIN32
 #include <windows.h>
+#endif
 #include <string>
+#include <vector>
+#include "hd6805.hpp"
 using namespace std;
 
 string format(const char *fmt, ...);
 void set_terminal_color(uint8_t attribute);
 void print_hexdump(uint8_t *buffer, size_t buffer_size, int stride = 0x10);
+#ifdef _WIN32
 string FormatWindowsError(void);
+#endif
 bool QueryComPort(int port_number, char *device_name, size_t size);
 int ListComPort(bool verbose);
+vector<string> FindReaderPorts(void);
+string com_port_name(int port_number);
+void sleep_ms(uint32_t delay_ms);
+bool key_pressed(void);
+int read_key(void);
+uint16_t crc16_update(uint16_t crc, uint8_t data);
 
 /* End */
\ No newline at end of file
@@ -77,7 +77,15 @@ public:
 
         /* Open file mapped to COM port */
         const char *kPortFormat = "\\\\.\\COM%d";
-        sprintf(port_name, kPortFormat, com_number);
+        char device_name[256];
+        sprintf(device_name, kPortFormat, com_number);
+        return open(device_name, baud_rate);
+    }
+
+    /* Open a serial port by device path */
+    bool open(const char *device_name, int baud_rate)
+    {
+        snprintf(port_name, sizeof(port_name), "%s", device_name);
         handle = CreateFileA(
             port_name,
             GENERIC_READ | GENERIC_WRITE,
@@ -186,10 +194,11 @@ public:
     {
         COMMTIMEOUTS timeouts = {0};
 
-        /* All in milliseconds */
-        timeouts.ReadIntervalTimeout = read_timeout_ms;
-        timeouts.ReadTotalTimeoutConstant = 1;
-        timeouts.ReadTotalTimeoutMultiplier = 1;
+        /* All in milliseconds. ReadFile() returns as soon as any data
+           arrives, or after read_timeout_ms with nothing read. */
+        timeouts.ReadIntervalTimeout = MAXDWORD;
+        timeouts.ReadTotalTimeoutConstant = read_timeout_ms;
+        timeouts.ReadTotalTimeoutMultiplier = MAXDWORD;
 
         timeouts.WriteTotalTimeoutConstant = write_timeout_ms;
         timeouts.WriteTotalTimeoutMultiplier = 1;
@@ -275,29 +284,18 @@ public:
             DWORD actual;
         } stride;
 
-        /* Buffer to hold largest amount of data we can read at once */
-        constexpr size_t kFragmentSize = 256;
-        uint8_t fragment[kFragmentSize];
-
         do
         {
-            /* Determine how much data we can attempt to read in a single stride */
-            if(size > kFragmentSize)
-            {
-                stride.expected = kFragmentSize;
-            }
-            else
-            {
-                stride.expected = size;
-            }
+            /* Attempt to read all remaining data in one stride */
+            stride.expected = size;
 
             /* Wait until some data has arrived */
             wait_recieve_queue();
 
-            /* Attempt to read one stride from recieve queue */
+            /* Read straight into the output buffer */
             bool status = ReadFile(
                 handle,
-                fragment,
+                &buffer[buffer_index],
                 stride.expected,
                 &stride.actual,
                 NULL
@@ -310,14 +308,10 @@ public:
                 return false;
             }
 
-            /* If any data was read, update the output buffer and remaining read size */
+            /* If any data was read, update the buffer position and remaining read size */
             if(stride.actual)
             {
-                for(int fragment_index = 0; fragment_index < stride.actual; fragment_index++)
-                {
-                    buffer[buffer_index++] = fragment[fragment_index];
-                }
-
+                buffer_index += stride.actual;
                 size -= stride.actual;
             }
 
@@ -340,6 +334,53 @@ public:
         return read(buffer, 1);
     }
 
+    /* Read whatever has arrived, up to size bytes. Waits for the first byte
+       until the timeout expires (-1 waits forever) and returns the count read. */
+    size_t read_some(uint8_t *buffer, size_t size, int timeout_ms)
+    {
+        DWORD start = GetTickCount();
+        DWORD actual = 0;
+
+        do
+        {
+            /* Returns as soon as any data arrives, or when the read timeout expires */
+            if(!ReadFile(handle, buffer, size, &actual, NULL))
+            {
+                fatal_error();
+                return 0;
+            }
+            if(actual)
+            {
+                return actual;
+            }
+        } while(timeout_ms < 0 || GetTickCount() - start < (DWORD)timeout_ms);
+
+        return 0;
+    }
+
+    /* Read a single character, or return false if nothing arrives in time (-1 waits forever) */
+    bool read_byte(uint8_t &ch, int timeout_ms)
+    {
+        DWORD start = GetTickCount();
+        DWORD actual = 0;
+
+        do
+        {
+            /* Blocks until a byte arrives or the read timeout expires */
+            if(!ReadFile(handle, &ch, 1, &actual, NULL))
+            {
+                fatal_error();
+                return false;
+            }
+            if(actual)
+            {
+                return true;
+            }
+        } while(timeout_ms < 0 || GetTickCount() - start < (DWORD)timeout_ms);
+
+        return false;
+    }
+
     bool wait_transmit(void)
     {
         DWORD event_mask = 0;